@@ -1,9 +1,13 @@
 #include <malloc.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
 
 #include "apu.h"
 #include "bus.h"
+#include "scheduler.h"
+#include "blip.h"
 
 #define REG_SQ1_VOL    0x00 // Square Wave 1 Volume/Envelope Control
 #define REG_SQ1_SWEEP  0x01 // Square Wave 1 Sweep Unit Control
@@ -41,21 +45,749 @@
 
 #define DEVICE_TO_APU(p) ((apu_device_t)(p))
 
+#define APU_STATE_OFFSET offsetof(struct apu_device_data, m_joypad)
+#define APU_STATE_SIZE (offsetof(struct apu_device_data, m_time) - APU_STATE_OFFSET)
+
+#define APU_CLOCK_RATE 1789773 // NTSC CPU clock, all APU times are in CPU cycles
+#define APU_DEFAULT_SAMPLE_RATE 44100
+#define APU_MAX_FRAME_CYCLES 8192 // The synthesizer frame is ended at least this often
+
+// Mixer weights per output level. The real mixer is non-linear, the linear approximation lets every channel add its
+// own amplitude changes to the synthesizer without knowing what the other channels are doing.
+#define APU_PULSE_WEIGHT 226    // ~0.00752 of full scale per level
+#define APU_TRIANGLE_WEIGHT 255 // ~0.00851
+#define APU_NOISE_WEIGHT 148    // ~0.00494
+#define APU_DMC_WEIGHT 100      // ~0.00335
+
+static const uint8_t s_length_table[32] =
+{
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const uint8_t s_pulse_duty_table[4] =
+{
+    0x02, // 01000000 (12.5%)
+    0x06, // 01100000 (25%)
+    0x1E, // 01111000 (50%)
+    0xF9, // 10011111 (25% negated)
+};
+
+static const uint8_t s_triangle_table[32] =
+{
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15
+};
+
+static const uint16_t s_noise_period_table[16] =
+{
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+static const uint16_t s_dmc_period_table[16] =
+{
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+// Frame counter step times in CPU cycles, relative to the previous step
+static const uint16_t s_frame_step_cycles[2][5] =
+{
+    { 7457, 7456, 7458, 7458, 0 },    // 4-step mode, the sequence restarts one cycle after the last step
+    { 7457, 7456, 7458, 7458, 7452 }, // 5-step mode
+};
+
+struct apu_envelope_data
+{
+    uint8_t start;
+    uint8_t loop;     // Also the length counter halt flag
+    uint8_t constant;
+    uint8_t period;   // Also the constant volume
+    uint8_t divider;
+    uint8_t decay;
+};
+
+struct apu_pulse_data
+{
+    struct apu_envelope_data envelope;
+    uint8_t length;
+    uint8_t duty;
+    uint8_t duty_pos;
+    uint8_t sweep_enabled;
+    uint8_t sweep_period;
+    uint8_t sweep_negate;
+    uint8_t sweep_shift;
+    uint8_t sweep_divider;
+    uint8_t sweep_reload;
+    uint8_t ones_complement; // Pulse 1 negates with one's complement
+    uint16_t timer_period;
+    uint32_t delay;          // CPU cycles until the next sequencer step
+    int32_t amp;             // Last output level
+};
+
+struct apu_triangle_data
+{
+    uint8_t length;
+    uint8_t control;          // Also the length counter halt flag
+    uint8_t linear_reload_value;
+    uint8_t linear_counter;
+    uint8_t linear_reload;
+    uint8_t pos;
+    uint16_t timer_period;
+    uint32_t delay;
+    int32_t amp;
+};
+
+struct apu_noise_data
+{
+    struct apu_envelope_data envelope;
+    uint8_t length;
+    uint8_t mode;
+    uint16_t shift;
+    uint16_t period;
+    uint32_t delay;
+    int32_t amp;
+};
+
+struct apu_dmc_data
+{
+    uint8_t irq_enabled;
+    uint8_t loop;
+    uint8_t level;       // 7-bit output level
+    uint8_t shift;
+    uint8_t bits_remaining;
+    uint8_t silence;
+    uint8_t buffer;
+    uint8_t buffer_full;
+    uint8_t irq;
+    uint16_t period;
+    uint16_t sample_addr;
+    uint16_t sample_length;
+    uint16_t addr;
+    uint16_t bytes_remaining;
+    uint8_t stall;               // CPU cycles the last fetch halts the CPU for, passed on by apu_device_run
+    uint32_t delay;
+    int32_t amp;
+};
+
 typedef struct apu_device_data {
     struct bus_device_data m_device;
     union apu_joypad_data m_joypad[2];
     uint8_t m_poll_joypad;
     uint16_t m_oam_dma_addr;
+
+    struct apu_pulse_data m_pulse[2];
+    struct apu_triangle_data m_triangle;
+    struct apu_noise_data m_noise;
+    struct apu_dmc_data m_dmc;
+
+    uint8_t m_channel_enabled;   // $4015 bits 0-3, the length counters can only be loaded while enabled
+
+    uint8_t m_frame_mode;        // 0: 4-step, 1: 5-step
+    uint8_t m_frame_irq_inhibit;
+    uint8_t m_frame_irq;
+    uint8_t m_frame_step;
+    uint32_t m_frame_delay;      // CPU cycles until the next frame counter step
+
+    // Everything from m_joypad up to here is APU state, the times below are relative to the synthesizer frame and
+    // a state is only taken with the channels caught up
+
+    uint32_t m_time;             // CPU cycles since the start of the synthesizer frame
+    uint32_t m_last_time;        // The channels have been run up to this time
+    uint32_t m_next_event;       // Time at which the tick has to do more than count the cycle
+    uint64_t m_clock;            // The last CPU cycle (see bus_data::m_clock) the APU has run
+
+    uint32_t m_sample_rate;
+    bool m_muted;                // See apu_device_set_muted
+    bus_t m_cpu_bus;             // For DMC sample fetches, the CPU clock and the scheduler
+    struct blip_data m_blip;
 } *apu_device_t;
 
+static void apu_output(apu_device_t a_apu, uint32_t a_time, int32_t *a_amp, int32_t a_new_amp)
+{
+    if (*a_amp != a_new_amp)
+    {
+        if (!a_apu->m_muted)
+        {
+            blip_add_delta(&a_apu->m_blip, a_time, a_new_amp - *a_amp);
+        }
+
+        *a_amp = a_new_amp;
+    }
+}
+
+static uint8_t apu_envelope_volume(struct apu_envelope_data *a_envelope)
+{
+    return a_envelope->constant ? a_envelope->period : a_envelope->decay;
+}
+
+static void apu_envelope_clock(struct apu_envelope_data *a_envelope)
+{
+    if (a_envelope->start)
+    {
+        a_envelope->start = 0;
+        a_envelope->decay = 15;
+        a_envelope->divider = a_envelope->period;
+    }
+    else if (a_envelope->divider)
+    {
+        a_envelope->divider--;
+    }
+    else
+    {
+        a_envelope->divider = a_envelope->period;
+
+        if (a_envelope->decay)
+        {
+            a_envelope->decay--;
+        }
+        else if (a_envelope->loop)
+        {
+            a_envelope->decay = 15;
+        }
+    }
+}
+
+static uint16_t apu_pulse_sweep_target(struct apu_pulse_data *a_pulse)
+{
+    uint16_t change = a_pulse->timer_period >> a_pulse->sweep_shift;
+
+    if (a_pulse->sweep_negate)
+    {
+        return a_pulse->timer_period - change - a_pulse->ones_complement;
+    }
+
+    return a_pulse->timer_period + change;
+}
+
+static bool apu_pulse_muted(struct apu_pulse_data *a_pulse)
+{
+    return (a_pulse->timer_period < 8) || (!a_pulse->sweep_negate && apu_pulse_sweep_target(a_pulse) > 0x7FF);
+}
+
+static void apu_pulse_sweep_clock(struct apu_pulse_data *a_pulse)
+{
+    if (a_pulse->sweep_divider == 0 && a_pulse->sweep_enabled && a_pulse->sweep_shift && !apu_pulse_muted(a_pulse))
+    {
+        a_pulse->timer_period = apu_pulse_sweep_target(a_pulse);
+    }
+
+    if (a_pulse->sweep_divider == 0 || a_pulse->sweep_reload)
+    {
+        a_pulse->sweep_divider = a_pulse->sweep_period;
+        a_pulse->sweep_reload = 0;
+    }
+    else
+    {
+        a_pulse->sweep_divider--;
+    }
+}
+
+static void apu_pulse_run(apu_device_t a_apu, struct apu_pulse_data *a_pulse, uint32_t a_start, uint32_t a_end)
+{
+    uint8_t volume = apu_envelope_volume(&a_pulse->envelope);
+    bool silent = (a_pulse->length == 0) || (volume == 0) || apu_pulse_muted(a_pulse);
+
+    uint8_t duty = s_pulse_duty_table[a_pulse->duty];
+
+    int32_t amp = silent ? 0 : ((duty >> a_pulse->duty_pos) & 1) * volume * APU_PULSE_WEIGHT;
+    apu_output(a_apu, a_start, &a_pulse->amp, amp);
+
+    uint32_t time = a_start + a_pulse->delay;
+
+    if (time < a_end)
+    {
+        uint32_t period = (a_pulse->timer_period + 1) * 2;
+
+        if (silent)
+        {
+            // Keep the sequencer in phase without generating output
+            uint32_t steps = (a_end - time + period - 1) / period;
+            a_pulse->duty_pos = (a_pulse->duty_pos + steps) & 7;
+            time += steps * period;
+        }
+        else
+        {
+            int32_t level = volume * APU_PULSE_WEIGHT;
+
+            do
+            {
+                a_pulse->duty_pos = (a_pulse->duty_pos + 1) & 7;
+                apu_output(a_apu, time, &a_pulse->amp, ((duty >> a_pulse->duty_pos) & 1) * level);
+                time += period;
+            } while (time < a_end);
+        }
+    }
+
+    a_pulse->delay = time - a_end;
+}
+
+static void apu_triangle_run(apu_device_t a_apu, struct apu_triangle_data *a_triangle, uint32_t a_start, uint32_t a_end)
+{
+    // The triangle holds its level when silenced instead of dropping to 0
+    apu_output(a_apu, a_start, &a_triangle->amp, s_triangle_table[a_triangle->pos] * APU_TRIANGLE_WEIGHT);
+
+    uint32_t time = a_start + a_triangle->delay;
+
+    if (time < a_end)
+    {
+        uint32_t period = a_triangle->timer_period + 1;
+
+        // Ultrasonic periods are held as well, they would only alias
+        if ((a_triangle->length == 0) || (a_triangle->linear_counter == 0) || (a_triangle->timer_period < 2))
+        {
+            time += ((a_end - time + period - 1) / period) * period;
+        }
+        else
+        {
+            do
+            {
+                a_triangle->pos = (a_triangle->pos + 1) & 31;
+                apu_output(a_apu, time, &a_triangle->amp, s_triangle_table[a_triangle->pos] * APU_TRIANGLE_WEIGHT);
+                time += period;
+            } while (time < a_end);
+        }
+    }
+
+    a_triangle->delay = time - a_end;
+}
+
+static void apu_noise_run(apu_device_t a_apu, struct apu_noise_data *a_noise, uint32_t a_start, uint32_t a_end)
+{
+    uint8_t volume = apu_envelope_volume(&a_noise->envelope);
+    bool silent = (a_noise->length == 0) || (volume == 0);
+    int32_t level = silent ? 0 : volume * APU_NOISE_WEIGHT;
+
+    apu_output(a_apu, a_start, &a_noise->amp, (a_noise->shift & 1) ? 0 : level);
+
+    uint32_t time = a_start + a_noise->delay;
+    uint8_t tap = a_noise->mode ? 6 : 1;
+
+    // The shift register keeps running while silent, it is cheap enough to not special case
+    while (time < a_end)
+    {
+        uint16_t feedback = (a_noise->shift ^ (a_noise->shift >> tap)) & 1;
+        a_noise->shift = (a_noise->shift >> 1) | (feedback << 14);
+
+        apu_output(a_apu, time, &a_noise->amp, (a_noise->shift & 1) ? 0 : level);
+        time += a_noise->period;
+    }
+
+    a_noise->delay = time - a_end;
+}
+
+static void apu_dmc_fill_buffer(apu_device_t a_apu, struct apu_dmc_data *a_dmc)
+{
+    if (a_dmc->buffer_full || a_dmc->bytes_remaining == 0 || !a_apu->m_cpu_bus)
+    {
+        return;
+    }
+
+    // The fetch halts the CPU for 4 cycles, 3 if it falls on a CPU write, which is not told apart here, and 2 during
+    // OAM DMA, which has halted the CPU already
+    a_dmc->stall = a_apu->m_oam_dma_addr ? 2 : 4;
+    a_dmc->buffer = a_apu->m_cpu_bus->read8(a_dmc->addr);
+    a_dmc->buffer_full = 1;
+    a_dmc->addr = (a_dmc->addr == 0xFFFF) ? 0x8000 : (a_dmc->addr + 1);
+
+    if (--a_dmc->bytes_remaining == 0)
+    {
+        if (a_dmc->loop)
+        {
+            a_dmc->addr = a_dmc->sample_addr;
+            a_dmc->bytes_remaining = a_dmc->sample_length;
+        }
+        else if (a_dmc->irq_enabled)
+        {
+            a_dmc->irq = 1;
+        }
+    }
+}
+
+static void apu_dmc_run(apu_device_t a_apu, struct apu_dmc_data *a_dmc, uint32_t a_start, uint32_t a_end)
+{
+    apu_output(a_apu, a_start, &a_dmc->amp, a_dmc->level * APU_DMC_WEIGHT);
+
+    uint32_t time = a_start + a_dmc->delay;
+
+    while (time < a_end)
+    {
+        if (!a_dmc->silence)
+        {
+            if (a_dmc->shift & 1)
+            {
+                if (a_dmc->level <= 125)
+                {
+                    a_dmc->level += 2;
+                }
+            }
+            else if (a_dmc->level >= 2)
+            {
+                a_dmc->level -= 2;
+            }
+
+            apu_output(a_apu, time, &a_dmc->amp, a_dmc->level * APU_DMC_WEIGHT);
+        }
+
+        a_dmc->shift >>= 1;
+
+        if (--a_dmc->bits_remaining == 0)
+        {
+            a_dmc->bits_remaining = 8;
+            a_dmc->silence = !a_dmc->buffer_full;
+
+            if (a_dmc->buffer_full)
+            {
+                a_dmc->shift = a_dmc->buffer;
+                a_dmc->buffer_full = 0;
+                apu_dmc_fill_buffer(a_apu, a_dmc);
+            }
+        }
+
+        time += a_dmc->period;
+    }
+
+    a_dmc->delay = time - a_end;
+}
+
+static void apu_run_channels(apu_device_t a_apu, uint32_t a_start, uint32_t a_end)
+{
+    apu_pulse_run(a_apu, &a_apu->m_pulse[0], a_start, a_end);
+    apu_pulse_run(a_apu, &a_apu->m_pulse[1], a_start, a_end);
+    apu_triangle_run(a_apu, &a_apu->m_triangle, a_start, a_end);
+    apu_noise_run(a_apu, &a_apu->m_noise, a_start, a_end);
+    apu_dmc_run(a_apu, &a_apu->m_dmc, a_start, a_end);
+}
+
+static void apu_quarter_frame(apu_device_t a_apu)
+{
+    apu_envelope_clock(&a_apu->m_pulse[0].envelope);
+    apu_envelope_clock(&a_apu->m_pulse[1].envelope);
+    apu_envelope_clock(&a_apu->m_noise.envelope);
+
+    struct apu_triangle_data *triangle = &a_apu->m_triangle;
+
+    if (triangle->linear_reload)
+    {
+        triangle->linear_counter = triangle->linear_reload_value;
+    }
+    else if (triangle->linear_counter)
+    {
+        triangle->linear_counter--;
+    }
+
+    if (!triangle->control)
+    {
+        triangle->linear_reload = 0;
+    }
+}
+
+static void apu_half_frame(apu_device_t a_apu)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (a_apu->m_pulse[i].length && !a_apu->m_pulse[i].envelope.loop)
+        {
+            a_apu->m_pulse[i].length--;
+        }
+
+        apu_pulse_sweep_clock(&a_apu->m_pulse[i]);
+    }
+
+    if (a_apu->m_triangle.length && !a_apu->m_triangle.control)
+    {
+        a_apu->m_triangle.length--;
+    }
+
+    if (a_apu->m_noise.length && !a_apu->m_noise.envelope.loop)
+    {
+        a_apu->m_noise.length--;
+    }
+}
+
+static void apu_frame_counter_clock(apu_device_t a_apu)
+{
+    uint8_t step = a_apu->m_frame_step;
+    uint8_t last_step = a_apu->m_frame_mode ? 4 : 3;
+
+    // Step 3 of the 5-step sequence does nothing
+    if (!(a_apu->m_frame_mode && step == 3))
+    {
+        apu_quarter_frame(a_apu);
+
+        if (step == 1 || step == last_step)
+        {
+            apu_half_frame(a_apu);
+        }
+    }
+
+    if (step == last_step)
+    {
+        if (!a_apu->m_frame_mode && !a_apu->m_frame_irq_inhibit)
+        {
+            a_apu->m_frame_irq = 1;
+        }
+
+        a_apu->m_frame_step = 0;
+        a_apu->m_frame_delay = s_frame_step_cycles[a_apu->m_frame_mode][0] + 1;
+    }
+    else
+    {
+        a_apu->m_frame_step = step + 1;
+        a_apu->m_frame_delay = s_frame_step_cycles[a_apu->m_frame_mode][step + 1];
+    }
+}
+
+// Run the channels and the frame counter up to a_end. Between frame counter steps the channels run in one batch,
+// they only generate work when their output changes.
+static void apu_run_until(apu_device_t a_apu, uint32_t a_end)
+{
+    while (a_apu->m_last_time < a_end)
+    {
+        uint32_t end = a_end;
+
+        if (a_apu->m_last_time + a_apu->m_frame_delay <= end)
+        {
+            end = a_apu->m_last_time + a_apu->m_frame_delay;
+        }
+
+        apu_run_channels(a_apu, a_apu->m_last_time, end);
+
+        a_apu->m_frame_delay -= end - a_apu->m_last_time;
+        a_apu->m_last_time = end;
+
+        if (a_apu->m_frame_delay == 0)
+        {
+            apu_frame_counter_clock(a_apu);
+        }
+    }
+}
+
+static void apu_end_frame(apu_device_t a_apu)
+{
+    apu_run_until(a_apu, a_apu->m_time);
+
+    // Muted time is left out of the output altogether
+    if (!a_apu->m_muted)
+    {
+        blip_end_frame(&a_apu->m_blip, a_apu->m_time);
+    }
+
+    // The channels keep relative delays, so only the frame time base needs to be reset
+    a_apu->m_time = 0;
+    a_apu->m_last_time = 0;
+}
+
+// Post a_event for the tick at a_time, the next one if that has passed. The owner hands it back after the CPU has run
+// the cycle of the tick.
+static void apu_post(apu_device_t a_apu, scheduler_event_t a_event, uint32_t a_time)
+{
+    if (!a_apu->m_cpu_bus || !a_apu->m_cpu_bus->m_scheduler)
+    {
+        return;
+    }
+
+    uint64_t cycle = a_apu->m_clock + ((a_time > a_apu->m_time) ? a_time - a_apu->m_time : 1);
+
+    a_apu->m_cpu_bus->m_scheduler->post(a_event, cycle + 1);
+}
+
+static void apu_cancel(apu_device_t a_apu, scheduler_event_t a_event)
+{
+    if (a_apu->m_cpu_bus && a_apu->m_cpu_bus->m_scheduler)
+    {
+        a_apu->m_cpu_bus->m_scheduler->cancel(a_event);
+    }
+}
+
+// Find the next time the tick has to catch up and post the events up to it. Between events the channels are left
+// alone, register accesses catch them up on their own and the output does not depend on when the batches are run.
+static void apu_schedule(apu_device_t a_apu)
+{
+    // The synthesizer frame has to be ended before its buffer overflows
+    uint32_t next = APU_MAX_FRAME_CYCLES;
+
+    apu_post(a_apu, SCHEDULER_EVENT_APU_SYNTH_FRAME, next);
+
+    // A frame counter step can raise the frame interrupt
+    uint32_t frame_step = a_apu->m_last_time + a_apu->m_frame_delay;
+
+    if (frame_step < next)
+    {
+        next = frame_step;
+    }
+
+    apu_post(a_apu, SCHEDULER_EVENT_APU_FRAME_COUNTER, frame_step);
+
+    // While a sample plays, the DMC fetches bytes and raises its interrupt at the end on its output clock
+    if (a_apu->m_dmc.bytes_remaining)
+    {
+        uint32_t dmc = a_apu->m_last_time + a_apu->m_dmc.delay;
+
+        if (dmc < next)
+        {
+            next = dmc;
+        }
+
+        apu_post(a_apu, SCHEDULER_EVENT_APU_DMC, dmc);
+    }
+    else
+    {
+        apu_cancel(a_apu, SCHEDULER_EVENT_APU_DMC);
+    }
+
+    // OAM DMA copies a byte every cycle
+    if (a_apu->m_oam_dma_addr)
+    {
+        next = a_apu->m_time + 1;
+
+        apu_post(a_apu, SCHEDULER_EVENT_APU_OAM_DMA, next);
+    }
+    else
+    {
+        apu_cancel(a_apu, SCHEDULER_EVENT_APU_OAM_DMA);
+    }
+
+    a_apu->m_next_event = next;
+}
+
+// Count the cycles the CPU ran ahead without the APU. It never runs past the APU's next event, they do nothing else.
+static void apu_catch_up(apu_device_t a_apu)
+{
+    // The APU runs after the CPU in a cycle, during a CPU access it is at the cycle before. Its own DMA reads come
+    // with the APU at the cycle already.
+    if (!a_apu->m_cpu_bus || a_apu->m_cpu_bus->m_clock <= a_apu->m_clock + 1)
+    {
+        return;
+    }
+
+    uint32_t behind = (uint32_t)(a_apu->m_cpu_bus->m_clock - 1 - a_apu->m_clock);
+
+    a_apu->m_time += behind;
+    a_apu->m_clock += behind;
+}
+
+// Have the APU run the cycle of the CPU access in progress, to pick up a changed IRQ line, joypad strobe or DMA
+static void apu_sync_next_cycle(apu_device_t a_apu)
+{
+    a_apu->m_next_event = 0;
+
+    apu_post(a_apu, SCHEDULER_EVENT_APU_ACCESS, 0);
+}
+
+static uint8_t apu_status_read(apu_device_t a_apu)
+{
+    apu_run_until(a_apu, a_apu->m_time);
+
+    uint8_t status = (a_apu->m_pulse[0].length ? 0x01 : 0) |
+                     (a_apu->m_pulse[1].length ? 0x02 : 0) |
+                     (a_apu->m_triangle.length ? 0x04 : 0) |
+                     (a_apu->m_noise.length ? 0x08 : 0) |
+                     (a_apu->m_dmc.bytes_remaining ? 0x10 : 0) |
+                     (a_apu->m_frame_irq ? 0x40 : 0) |
+                     (a_apu->m_dmc.irq ? 0x80 : 0);
+
+    // Reading the status acknowledges the frame interrupt, the next tick lowers the IRQ line
+    a_apu->m_frame_irq = 0;
+    apu_sync_next_cycle(a_apu);
+
+    return status;
+}
+
+static void apu_status_write(apu_device_t a_apu, uint8_t a_value)
+{
+    a_apu->m_channel_enabled = a_value & 0x0F;
+
+    // Disabling a channel silences it by clearing its length counter
+    if (!(a_value & 0x01)) a_apu->m_pulse[0].length = 0;
+    if (!(a_value & 0x02)) a_apu->m_pulse[1].length = 0;
+    if (!(a_value & 0x04)) a_apu->m_triangle.length = 0;
+    if (!(a_value & 0x08)) a_apu->m_noise.length = 0;
+
+    struct apu_dmc_data *dmc = &a_apu->m_dmc;
+
+    dmc->irq = 0;
+
+    if (!(a_value & 0x10))
+    {
+        dmc->bytes_remaining = 0;
+    }
+    else if (dmc->bytes_remaining == 0)
+    {
+        // Restart the sample
+        dmc->addr = dmc->sample_addr;
+        dmc->bytes_remaining = dmc->sample_length;
+        apu_dmc_fill_buffer(a_apu, dmc);
+    }
+}
+
+static void apu_frame_counter_write(apu_device_t a_apu, uint8_t a_value)
+{
+    a_apu->m_frame_mode = a_value >> 7;
+    a_apu->m_frame_irq_inhibit = (a_value >> 6) & 1;
+
+    if (a_apu->m_frame_irq_inhibit)
+    {
+        a_apu->m_frame_irq = 0;
+    }
+
+    // The sequencer restarts, in 5-step mode the quarter and half frame units are clocked right away
+    a_apu->m_frame_step = 0;
+    a_apu->m_frame_delay = s_frame_step_cycles[a_apu->m_frame_mode][0];
+
+    if (a_apu->m_frame_mode)
+    {
+        apu_quarter_frame(a_apu);
+        apu_half_frame(a_apu);
+    }
+}
+
+static void apu_pulse_write(apu_device_t a_apu, struct apu_pulse_data *a_pulse, uint8_t a_reg, uint8_t a_value, uint8_t a_enabled)
+{
+    switch (a_reg & 3)
+    {
+    case 0: // Duty and envelope
+        a_pulse->duty = a_value >> 6;
+        a_pulse->envelope.loop = (a_value >> 5) & 1;
+        a_pulse->envelope.constant = (a_value >> 4) & 1;
+        a_pulse->envelope.period = a_value & 0x0F;
+        break;
+    case 1: // Sweep
+        a_pulse->sweep_enabled = a_value >> 7;
+        a_pulse->sweep_period = (a_value >> 4) & 7;
+        a_pulse->sweep_negate = (a_value >> 3) & 1;
+        a_pulse->sweep_shift = a_value & 7;
+        a_pulse->sweep_reload = 1;
+        break;
+    case 2: // Timer low
+        a_pulse->timer_period = (a_pulse->timer_period & 0x700) | a_value;
+        break;
+    case 3: // Timer high and length counter load
+        a_pulse->timer_period = (a_pulse->timer_period & 0xFF) | ((a_value & 7) << 8);
+
+        if (a_enabled)
+        {
+            a_pulse->length = s_length_table[a_value >> 3];
+        }
+
+        a_pulse->duty_pos = 0;
+        a_pulse->envelope.start = 1;
+        break;
+    }
+}
+
 static uint8_t apu_read8(bus_device_t a_dev, uint16_t a_addr)
 {
     apu_device_t apu = DEVICE_TO_APU(a_dev);
 
+    apu_catch_up(apu);
+
     uint8_t retval = 0xFF;
 
     switch (a_addr & 0x1F)
     {
+    case REG_APU_STATUS:
+        retval = apu_status_read(apu);
+        break;
     case REG_JOY1: // Read controller 1
         //printf("APU read controller 1\n");
         retval = apu->m_joypad[0].raw >> 7;
@@ -67,12 +799,10 @@ static uint8_t apu_read8(bus_device_t a_dev, uint16_t a_addr)
         apu->m_joypad[1].raw <<= 1;
         break;
     
-    default:
-        printf("APU read: %04X\n", a_addr);
+    default: // Write only registers, open bus
         break;
     }
 
-    // TODO: Implement APU read
     return retval;
 }
 
@@ -80,8 +810,83 @@ static void apu_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
 {
     apu_device_t apu = DEVICE_TO_APU(a_dev);
 
-    switch (a_addr & 0x1F)
+    uint8_t reg = a_addr & 0x1F;
+
+    apu_catch_up(apu);
+
+    // Bring the channels up to date, the write takes effect from now on
+    if (reg <= REG_DMC_LEN || reg == REG_APU_STATUS || reg == REG_JOY2)
     {
+        apu_run_until(apu, apu->m_time);
+    }
+
+    switch (reg)
+    {
+    case REG_SQ1_VOL:
+    case REG_SQ1_SWEEP:
+    case REG_SQ1_LO:
+    case REG_SQ1_HI:
+        apu_pulse_write(apu, &apu->m_pulse[0], reg, a_value, apu->m_channel_enabled & 0x01);
+        break;
+    case REG_SQ2_VOL:
+    case REG_SQ2_SWEEP:
+    case REG_SQ2_LO:
+    case REG_SQ2_HI:
+        apu_pulse_write(apu, &apu->m_pulse[1], reg, a_value, apu->m_channel_enabled & 0x02);
+        break;
+    case REG_TRI_LINEAR:
+        apu->m_triangle.control = a_value >> 7;
+        apu->m_triangle.linear_reload_value = a_value & 0x7F;
+        break;
+    case REG_TRI_LO:
+        apu->m_triangle.timer_period = (apu->m_triangle.timer_period & 0x700) | a_value;
+        break;
+    case REG_TRI_HI:
+        apu->m_triangle.timer_period = (apu->m_triangle.timer_period & 0xFF) | ((a_value & 7) << 8);
+
+        if (apu->m_channel_enabled & 0x04)
+        {
+            apu->m_triangle.length = s_length_table[a_value >> 3];
+        }
+
+        apu->m_triangle.linear_reload = 1;
+        break;
+    case REG_NOISE_VOL:
+        apu->m_noise.envelope.loop = (a_value >> 5) & 1;
+        apu->m_noise.envelope.constant = (a_value >> 4) & 1;
+        apu->m_noise.envelope.period = a_value & 0x0F;
+        break;
+    case REG_NOISE_LO:
+        apu->m_noise.mode = a_value >> 7;
+        apu->m_noise.period = s_noise_period_table[a_value & 0x0F];
+        break;
+    case REG_NOISE_HI:
+        if (apu->m_channel_enabled & 0x08)
+        {
+            apu->m_noise.length = s_length_table[a_value >> 3];
+        }
+
+        apu->m_noise.envelope.start = 1;
+        break;
+    case REG_DMC_CTRL:
+        apu->m_dmc.irq_enabled = a_value >> 7;
+        apu->m_dmc.loop = (a_value >> 6) & 1;
+        apu->m_dmc.period = s_dmc_period_table[a_value & 0x0F];
+
+        if (!apu->m_dmc.irq_enabled)
+        {
+            apu->m_dmc.irq = 0;
+        }
+        break;
+    case REG_DMC_DAC:
+        apu->m_dmc.level = a_value & 0x7F;
+        break;
+    case REG_DMC_ADDR:
+        apu->m_dmc.sample_addr = 0xC000 | ((uint16_t)a_value << 6);
+        break;
+    case REG_DMC_LEN:
+        apu->m_dmc.sample_length = ((uint16_t)a_value << 4) + 1;
+        break;
     case REG_JOY1:
         if (a_value & 7)
         {
@@ -99,30 +904,102 @@ static void apu_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
         apu->m_oam_dma_addr = ((uint16_t)a_value) << 8;
         break;
     case REG_APU_STATUS:
-        if (a_value != 0) // 0 disables all APU channels
-        {
-            printf("APU status: %02X\n", a_value);
-        }
+        apu_status_write(apu, a_value);
+        break;
+    case REG_JOY2:
+        apu_frame_counter_write(apu, a_value);
         break;
         
-    default:
-        printf("APU write: %04X = %02X\n", a_addr, a_value);
+    default: // Test mode registers
         break;
     }
 
+    apu_sync_next_cycle(apu);
+
     return;
 }
 
+static size_t apu_state_size(bus_device_t a_dev)
+{
+    return APU_STATE_SIZE;
+}
+
+static void apu_state_save(bus_device_t a_dev, uint8_t *a_buffer)
+{
+    apu_device_t apu = DEVICE_TO_APU(a_dev);
+
+    // The channel timers are relative to m_last_time, with the channels caught up that is now
+    apu_run_until(apu, apu->m_time);
+
+    memcpy(a_buffer, (uint8_t *)apu + APU_STATE_OFFSET, APU_STATE_SIZE);
+}
+
+static void apu_state_load(bus_device_t a_dev, const uint8_t *a_buffer)
+{
+    apu_device_t apu = DEVICE_TO_APU(a_dev);
+
+    // Continue from the current synthesizer time, the output jumps to the loaded levels
+    apu_run_until(apu, apu->m_time);
+
+    memcpy((uint8_t *)apu + APU_STATE_OFFSET, a_buffer, APU_STATE_SIZE);
+
+    // Let the next tick refresh the IRQ line and the joypad handshake
+    apu_sync_next_cycle(apu);
+}
+
 static struct bus_device_ops_data g_apu_ops =
 {
         .read8 = apu_read8,
-        .write8 = apu_write8
+        .write8 = apu_write8,
+        .sync = nullptr,
+        .state_size = apu_state_size,
+        .state_save = apu_state_save,
+        .state_load = apu_state_load,
+        .destroy = apu_device_destroy
 };
 
-void apu_device_tick(bus_device_t a_dev, bus_t a_cpu_bus, apu_device_tick_state_t a_state)
+uint32_t apu_device_run(bus_device_t a_dev, bus_t a_cpu_bus, apu_device_tick_state_t a_state, uint32_t a_cycles)
 {
     apu_device_t apu = DEVICE_TO_APU(a_dev);
 
+    apu->m_cpu_bus = a_cpu_bus;
+
+    uint32_t cycles = (uint32_t)(a_cpu_bus->m_clock - apu->m_clock);
+
+    if (cycles > a_cycles)
+    {
+        cycles = a_cycles;
+    }
+
+    // Nothing observable happens before the next event, the channels catch up later in one batch
+    uint32_t idle = (apu->m_next_event > apu->m_time) ? apu->m_next_event - apu->m_time - 1 : 0;
+
+    if (__builtin_expect(cycles <= idle, 1))
+    {
+        apu->m_time += cycles;
+        apu->m_clock += cycles;
+
+        return cycles;
+    }
+
+    apu->m_time += idle + 1;
+    apu->m_clock += idle + 1;
+
+    apu_run_until(apu, apu->m_time);
+
+    if (apu->m_time >= APU_MAX_FRAME_CYCLES)
+    {
+        apu_end_frame(apu);
+    }
+
+    a_state->out.irq = apu->m_frame_irq || apu->m_dmc.irq;
+
+    if (apu->m_dmc.stall)
+    {
+        a_state->out.dmc_stall = apu->m_dmc.stall; // Will be set to 0 when the CPU is stalled
+        apu->m_dmc.stall = 0;
+    }
+
     if (apu->m_poll_joypad)
     {
         if (a_state->out.poll_joypad == 0)
@@ -160,18 +1037,92 @@ void apu_device_tick(bus_device_t a_dev, bus_t a_cpu_bus, apu_device_tick_state_
             apu->m_oam_dma_addr = 0;
         }
     }
+
+    apu_schedule(apu);
+
+    return idle + 1;
+}
+
+void apu_device_tick(bus_device_t a_dev, bus_t a_cpu_bus, apu_device_tick_state_t a_state)
+{
+    apu_device_run(a_dev, a_cpu_bus, a_state, 1);
+}
+
+void apu_device_set_cpu_bus(bus_device_t a_dev, bus_t a_cpu_bus)
+{
+    apu_device_t apu = DEVICE_TO_APU(a_dev);
+
+    apu->m_cpu_bus = a_cpu_bus;
+
+    // The events posted so far went nowhere, the first tick posts them again
+    apu_sync_next_cycle(apu);
+}
+
+void apu_device_reset(bus_device_t a_dev)
+{
+    apu_device_t apu = DEVICE_TO_APU(a_dev);
+
+    // Reset silences the channels as a write of 0 to $4015 does and restarts the frame counter in the mode it was
+    // in, as if $4017 was written again
+    apu_write8(a_dev, 0x4000 | REG_APU_STATUS, 0);
+    apu_write8(a_dev, 0x4000 | REG_JOY2, (uint8_t)((apu->m_frame_mode << 7) | (apu->m_frame_irq_inhibit << 6)));
+}
+
+void apu_device_set_sample_rate(bus_device_t a_apu_device, uint32_t a_sample_rate)
+{
+    apu_device_t apu = DEVICE_TO_APU(a_apu_device);
+
+    apu->m_sample_rate = a_sample_rate;
+
+    blip_set_rates(&apu->m_blip, APU_CLOCK_RATE, a_sample_rate);
+}
+
+void apu_device_set_muted(bus_device_t a_apu_device, bool a_muted)
+{
+    apu_device_t apu = DEVICE_TO_APU(a_apu_device);
+
+    // Close the synthesizer frame so the switch happens exactly now
+    apu_end_frame(apu);
+
+    apu->m_muted = a_muted;
+
+    apu_schedule(apu);
+}
+
+size_t apu_device_read_samples(bus_device_t a_apu_device, int16_t *a_samples, size_t a_count)
+{
+    apu_device_t apu = DEVICE_TO_APU(a_apu_device);
+
+    apu_end_frame(apu);
+    apu_schedule(apu);
+
+    return blip_read_samples(&apu->m_blip, a_samples, a_count);
 }
 
 bus_device_t apu_device_create()
 {
-    apu_device_t apu = (apu_device_t)malloc(sizeof(struct apu_device_data));
-    *apu = {};
+    // Zeroed including the padding, states are compared byte for byte
+    apu_device_t apu = (apu_device_t)calloc(1, sizeof(struct apu_device_data));
     apu->m_device.m_ops = &g_apu_ops;
 
+    apu->m_pulse[0].ones_complement = 1;
+
+    apu->m_noise.shift = 1;
+    apu->m_noise.period = s_noise_period_table[0];
+
+    apu->m_dmc.period = s_dmc_period_table[0];
+    apu->m_dmc.bits_remaining = 8;
+    apu->m_dmc.silence = 1;
+
+    apu->m_frame_delay = s_frame_step_cycles[0][0];
+
+    apu->m_sample_rate = APU_DEFAULT_SAMPLE_RATE;
+    blip_init(&apu->m_blip, APU_CLOCK_RATE, apu->m_sample_rate);
+
     return &apu->m_device;
 }
 
 void apu_device_destroy(bus_device_t a_apu_device)
 {
     free(a_apu_device);
-}
\ No newline at end of file
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "hw_types.h"
 
 typedef union apu_joypad_data
@@ -30,6 +32,8 @@ typedef struct apu_device_tick_state_data
     {
         uint8_t poll_joypad : 1;
         uint8_t oam_dma : 1;
+        uint8_t irq : 1; // Frame counter or DMC interrupt pending, level triggered
+        uint8_t dmc_stall : 3; // CPU cycles a DMC sample fetch halts the CPU for
     } out;
 } *apu_device_tick_state_t;
 
@@ -37,4 +41,31 @@ bus_device_t apu_device_create();
 
 void apu_device_destroy(bus_device_t a_apu_device);
 
-void apu_device_tick(bus_device_t a_apu_device, bus_t a_cpu_bus, apu_device_tick_state_t a_state);
\ No newline at end of file
+// Run the APU after the CPU in the cycles up to bus_data::m_clock of a_cpu_bus, at most a_cycles of them. Stops after
+// the first cycle in which it does more than count, which may change a_state. Returns the cycles run.
+//
+// In between the CPU may run ahead up to the next SCHEDULER_EVENT_APU_* the APU posted on the scheduler of a_cpu_bus,
+// it counts those cycles itself when the CPU accesses it. An access that has to be seen in the cycle it happens in
+// posts SCHEDULER_EVENT_APU_ACCESS for the cycle after. The owner runs the APU whenever one of them is due.
+uint32_t apu_device_run(bus_device_t a_apu_device, bus_t a_cpu_bus, apu_device_tick_state_t a_state, uint32_t a_cycles);
+
+// apu_device_run for one cycle
+void apu_device_tick(bus_device_t a_apu_device, bus_t a_cpu_bus, apu_device_tick_state_t a_state);
+
+// The bus apu_device_run will be given, to post events on before the first run (after power on or a state load)
+void apu_device_set_cpu_bus(bus_device_t a_apu_device, bus_t a_cpu_bus);
+
+// The reset button, between CPU cycles
+void apu_device_reset(bus_device_t a_apu_device);
+
+// Output sample rate of the synthesizer, 44100 Hz by default. Can be changed at any time, buffered samples are kept
+void apu_device_set_sample_rate(bus_device_t a_apu_device, uint32_t a_sample_rate);
+
+// While muted the channels run as usual but feed nothing to the synthesizer and no samples are generated, the
+// output levels stay where they were. Emulating frames muted and then loading a state taken before continues the
+// sound without a click, for emulation that is thrown away again.
+void apu_device_set_muted(bus_device_t a_apu_device, bool a_muted);
+
+// Pull up to a_count samples of 16-bit mono PCM generated since the last call
+// Returns the number of samples written to a_samples
+size_t apu_device_read_samples(bus_device_t a_apu_device, int16_t *a_samples, size_t a_count);
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+
+#include "audio_ring.h"
+
+#define AUDIO_RING_CACHE_LINE 64
+
+// The indices run freely and are masked on access, head - tail is the fill level even after they wrap
+typedef struct audio_ring_data
+{
+    // Written by the producer only
+    alignas(AUDIO_RING_CACHE_LINE) std::atomic<uint32_t> m_head;
+    std::atomic<uint32_t> m_overruns;
+
+    // Written by the consumer only
+    alignas(AUDIO_RING_CACHE_LINE) std::atomic<uint32_t> m_tail;
+    std::atomic<uint32_t> m_underruns;
+    int16_t m_last_sample;
+
+    // Constant after creation
+    alignas(AUDIO_RING_CACHE_LINE) uint32_t m_mask;
+    int16_t *m_samples;
+} *audio_ring_t;
+
+audio_ring_t audio_ring_create(size_t a_capacity)
+{
+    uint32_t capacity = 64;
+
+    while (capacity < a_capacity && capacity < (1u << 24))
+    {
+        capacity <<= 1;
+    }
+
+    size_t size = sizeof(struct audio_ring_data) + (capacity * sizeof(int16_t));
+
+    // aligned_alloc wants a multiple of the alignment
+    size = (size + AUDIO_RING_CACHE_LINE - 1) & ~(size_t)(AUDIO_RING_CACHE_LINE - 1);
+
+    void *memory = aligned_alloc(AUDIO_RING_CACHE_LINE, size);
+
+    if (!memory)
+    {
+        return nullptr;
+    }
+
+    // Constructed in place for the atomics, the counters and indices start at zero. The samples follow it.
+    audio_ring_t ring = new (memory) audio_ring_data();
+
+    ring->m_mask = capacity - 1;
+    ring->m_samples = (int16_t *)(ring + 1);
+
+    return ring;
+}
+
+void audio_ring_destroy(audio_ring_t a_ring)
+{
+    a_ring->~audio_ring_data();
+    free(a_ring);
+}
+
+size_t audio_ring_capacity(audio_ring_t a_ring)
+{
+    return a_ring->m_mask + 1;
+}
+
+size_t audio_ring_fill(audio_ring_t a_ring)
+{
+    uint32_t tail = a_ring->m_tail.load(std::memory_order_acquire);
+    uint32_t head = a_ring->m_head.load(std::memory_order_acquire);
+
+    return head - tail;
+}
+
+size_t audio_ring_write(audio_ring_t a_ring, const int16_t *a_samples, size_t a_count)
+{
+    uint32_t head = a_ring->m_head.load(std::memory_order_relaxed);
+    // Acquire pairs with the consumer's release, its reads of the freed slots are done before they are reused
+    uint32_t tail = a_ring->m_tail.load(std::memory_order_acquire);
+    size_t free_count = (a_ring->m_mask + 1) - (head - tail);
+
+    if (a_count > free_count)
+    {
+        a_count = free_count;
+        a_ring->m_overruns.store(a_ring->m_overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Copy in at most two pieces, up to the end of the buffer and from the start
+    uint32_t start = head & a_ring->m_mask;
+    size_t first = a_ring->m_mask + 1 - start;
+
+    if (first > a_count)
+    {
+        first = a_count;
+    }
+
+    memcpy(&a_ring->m_samples[start], a_samples, first * sizeof(int16_t));
+    memcpy(&a_ring->m_samples[0], a_samples + first, (a_count - first) * sizeof(int16_t));
+
+    // Release publishes the samples together with the new head
+    a_ring->m_head.store(head + (uint32_t)a_count, std::memory_order_release);
+
+    return a_count;
+}
+
+size_t audio_ring_read(audio_ring_t a_ring, int16_t *a_samples, size_t a_count)
+{
+    uint32_t tail = a_ring->m_tail.load(std::memory_order_relaxed);
+    uint32_t head = a_ring->m_head.load(std::memory_order_acquire);
+    size_t count = head - tail;
+
+    if (count > a_count)
+    {
+        count = a_count;
+    }
+
+    uint32_t start = tail & a_ring->m_mask;
+    size_t first = a_ring->m_mask + 1 - start;
+
+    if (first > count)
+    {
+        first = count;
+    }
+
+    memcpy(a_samples, &a_ring->m_samples[start], first * sizeof(int16_t));
+    memcpy(a_samples + first, &a_ring->m_samples[0], (count - first) * sizeof(int16_t));
+
+    a_ring->m_tail.store(tail + (uint32_t)count, std::memory_order_release);
+
+    if (count)
+    {
+        a_ring->m_last_sample = a_samples[count - 1];
+    }
+
+    if (count < a_count)
+    {
+        for (size_t i = count; i < a_count; i++)
+        {
+            a_samples[i] = a_ring->m_last_sample;
+        }
+
+        a_ring->m_underruns.store(a_ring->m_underruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    return count;
+}
+
+uint32_t audio_ring_underruns(audio_ring_t a_ring)
+{
+    return a_ring->m_underruns.load(std::memory_order_relaxed);
+}
+
+uint32_t audio_ring_overruns(audio_ring_t a_ring)
+{
+    return a_ring->m_overruns.load(std::memory_order_relaxed);
+}
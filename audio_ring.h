@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Single-producer/single-consumer ring of 16-bit mono samples. The emulation thread writes, the audio callback
+// reads, neither side ever takes a lock or blocks. Each side owns one index and only reads the other, so the only
+// shared traffic is the two indices which live on separate cache lines.
+
+typedef struct audio_ring_data *audio_ring_t;
+
+// a_capacity is rounded up to a power of two, it bounds the latency the ring can add
+audio_ring_t audio_ring_create(size_t a_capacity);
+
+void audio_ring_destroy(audio_ring_t a_ring);
+
+size_t audio_ring_capacity(audio_ring_t a_ring);
+
+// Number of samples waiting to be read, exact on the consumer side and a lower bound on the producer side
+size_t audio_ring_fill(audio_ring_t a_ring);
+
+// Producer side. Samples that do not fit are dropped and counted as an overrun.
+// Returns the number of samples written
+size_t audio_ring_write(audio_ring_t a_ring, const int16_t *a_samples, size_t a_count);
+
+// Consumer side. If fewer than a_count samples are available the rest of a_samples is padded with the last sample
+// played, which avoids a click, and the shortfall is counted as an underrun.
+// Returns the number of samples read from the ring
+size_t audio_ring_read(audio_ring_t a_ring, int16_t *a_samples, size_t a_count);
+
+// Number of times the consumer found the ring short of samples
+uint32_t audio_ring_underruns(audio_ring_t a_ring);
+
+// Number of times the producer found the ring full
+uint32_t audio_ring_overruns(audio_ring_t a_ring);
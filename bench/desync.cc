@@ -0,0 +1,163 @@
+// Desync hunting: plays an input movie (see nes_movie.h) headless and writes the state hash after every frame to a
+// hash log, or finds the first frame two hash logs disagree on. Run the same movie on two builds, or on a build
+// before and after a change to the CPU or PPU, and diff the logs. The frontend writes one next to every movie it
+// records, for the run as it was played: it records without the save file, from the same empty battery RAM as here.
+//
+// Usage, from the top of the tree:
+//   desync rom movie out.hashes   Play the movie from power on and write its hash log
+//   desync -d a.hashes b.hashes   Print the first frame the logs differ in, exit status 1 if there is one
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "nes_movie.h"
+#include "nes_host.h"
+
+static int desync_record(const char *a_rom_path, const char *a_movie_path, const char *a_log_path)
+{
+    size_t rom_size;
+    uint8_t *rom = nes_host_read_file(a_rom_path, &rom_size);
+
+    if (!rom)
+    {
+        fprintf(stderr, "Failed to read %s\n", a_rom_path);
+        return 1;
+    }
+
+    nes_movie_t movie = nes_movie_open(a_movie_path);
+
+    if (!movie)
+    {
+        fprintf(stderr, "Failed to load the movie %s\n", a_movie_path);
+        return 1;
+    }
+
+    uint64_t rom_hash = nes_movie_hash_rom(rom, rom_size);
+
+    if (nes_movie_rom_hash(movie) && nes_movie_rom_hash(movie) != rom_hash)
+    {
+        fprintf(stderr, "The movie was recorded on another cartridge\n");
+        return 1;
+    }
+
+    nes_system_t system = nes_system_create();
+
+    nes_system_set_muted(system, true);
+    nes_system_set_output(system, NES_SYSTEM_OUTPUT_NONE);
+
+    if (nes_system_load_rom(system, rom, rom_size, nullptr) != NES_SYSTEM_OK)
+    {
+        fprintf(stderr, "Unsupported cartridge\n");
+        return 1;
+    }
+
+    uint32_t count = nes_movie_frame_count(movie);
+    uint64_t *hashes = (uint64_t *)malloc(((size_t)count * sizeof(uint64_t)) + 1);
+    uint64_t start = nes_host_now_ns();
+    uint32_t frames = nes_movie_play_hashed(movie, system, 0, count, hashes);
+    uint64_t ns = nes_host_now_ns() - start;
+
+    if (!nes_movie_save_hash_log(a_log_path, rom_hash, hashes, frames))
+    {
+        fprintf(stderr, "Failed to save %s\n", a_log_path);
+        return 1;
+    }
+
+    printf("%s: %u frames in %.1f ms, %.1f frames/s\n", a_log_path, frames, ns / 1e6, ns ? frames * 1e9 / ns : 0.0);
+
+    free(hashes);
+    nes_system_destroy(system);
+    nes_movie_destroy(movie);
+    free(rom);
+
+    return 0;
+}
+
+static int desync_diff(const char *a_path_a, const char *a_path_b)
+{
+    uint64_t rom_hash_a;
+    uint64_t rom_hash_b;
+    uint32_t count_a;
+    uint32_t count_b;
+    uint64_t *a = nes_movie_load_hash_log(a_path_a, &rom_hash_a, &count_a);
+    uint64_t *b = nes_movie_load_hash_log(a_path_b, &rom_hash_b, &count_b);
+
+    if (!a || !b)
+    {
+        fprintf(stderr, "Failed to read %s\n", a ? a_path_b : a_path_a);
+        return 2;
+    }
+
+    if (rom_hash_a != rom_hash_b)
+    {
+        fprintf(stderr, "The logs are of different cartridges\n");
+        return 2;
+    }
+
+    uint32_t count = count_a < count_b ? count_a : count_b;
+    uint32_t frame = 0;
+
+    while (frame < count && a[frame] == b[frame])
+    {
+        frame++;
+    }
+
+    int status = 0;
+
+    if (frame < count)
+    {
+        printf("First difference after frame %u: %016llx %016llx\n", frame, (unsigned long long)a[frame], (unsigned long long)b[frame]);
+        status = 1;
+    }
+    else
+    {
+        printf("The same for %u frames", count);
+        printf(count_a != count_b ? ", %s goes on for %u more\n" : "\n", count_a > count_b ? a_path_a : a_path_b,
+               (count_a > count_b ? count_a : count_b) - count);
+    }
+
+    free(a);
+    free(b);
+
+    return status;
+}
+
+static void usage(const char *a_program)
+{
+    fprintf(stderr, "Usage: %s rom movie out.hashes\n", a_program);
+    fprintf(stderr, "       %s -d a.hashes b.hashes\n", a_program);
+    fprintf(stderr, "  -d  Print the first frame the hash logs differ in\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bool diff = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            diff = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (argc - optind != (diff ? 2 : 3))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (diff)
+    {
+        return desync_diff(argv[optind], argv[optind + 1]);
+    }
+
+    return desync_record(argv[optind], argv[optind + 1], argv[optind + 2]);
+}
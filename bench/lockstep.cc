@@ -0,0 +1,394 @@
+// Lockstep experiment: how much could a CPU core that runs 8 or 16 machines in SIMD lanes gain?
+//
+// Such a core keeps the registers of all lanes in struct-of-arrays form and executes one opcode for all lanes
+// that are about to run it, the others masked off. Its speedup is bounded by two numbers this measures:
+//
+//  - The share of the emulation time spent in the CPU. The PPU and APU keep running per lane and memory accesses
+//    still go through each lane's bus devices, so only the CPU part can get faster.
+//  - How many lanes share an opcode (or a PC) when every lane runs one instruction per round. With K lanes and G
+//    distinct opcodes per round, a masked vector step does the work of K / G scalar ones at best.
+//
+// The lanes run the same cartridge with different pseudo-random joypad input, as a batch of agents would. The
+// scalar reference is the thread-pool runner (nes_runner.h) on one thread.
+//
+// Usage: lockstep [frames] [rom...], from the top of the tree.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LOCKSTEP_HAVE_TSC 1
+#endif
+
+#include "cpu.h"
+#include "bus.h"
+#include "apu.h"
+#include "ppu.h"
+#include "ram_device.h"
+#include "mapper.h"
+#include "nes_runner.h"
+#include "nes_host.h"
+
+#define LOCKSTEP_MAX_LANES 16
+#define LOCKSTEP_DEFAULT_FRAMES 1200
+#define LOCKSTEP_INPUT_INTERVAL_FRAMES 8
+#define LOCKSTEP_START_FRAME 320
+#define LOCKSTEP_START_FRAMES 80
+
+typedef struct lockstep_lane_data
+{
+    struct cpu_data m_cpu;
+    struct bus_data m_bus;
+    bus_device_t m_ppu;
+    bus_device_t m_apu;
+    struct apu_device_tick_state_data m_apu_tick_state;
+    uint32_t m_nmi;
+    uint32_t m_frames;
+} *lockstep_lane_t;
+
+typedef struct lockstep_rom_data
+{
+    const char *m_path;
+    uint8_t *m_image;
+    size_t m_size;
+} *lockstep_rom_t;
+
+static uint32_t lockstep_random(uint32_t *a_state)
+{
+    // xorshift32
+    uint32_t x = *a_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *a_state = x;
+}
+
+// The buttons lane a_lane holds in frame a_frame, the same sequence the scalar jobs get as input scripts
+static uint8_t lockstep_buttons(uint32_t a_lane, uint32_t a_frame)
+{
+    // Start the game from the title screen, the same for all lanes. Pac-Man only takes Start once its title is
+    // up, a bit over 5 seconds in.
+    if (a_frame < LOCKSTEP_START_FRAME)
+    {
+        return 0;
+    }
+
+    if (a_frame < LOCKSTEP_START_FRAME + LOCKSTEP_START_FRAMES)
+    {
+        return NES_BUTTON_START;
+    }
+
+    uint32_t state = ((a_lane + 1) * 0x9E3779B9u) ^ ((a_frame / LOCKSTEP_INPUT_INTERVAL_FRAMES) * 0x85EBCA6Bu);
+
+    state = state ? state : 1;
+    lockstep_random(&state);
+
+    // Mostly right and A, the way a run and jump agent explores
+    return (uint8_t)(lockstep_random(&state) & (NES_BUTTON_RIGHT | NES_BUTTON_A | NES_BUTTON_B | NES_BUTTON_LEFT));
+}
+
+static void lockstep_frame_done(ppu_rgb_color_t a_frame, void *a_context)
+{
+    ((lockstep_lane_t)a_context)->m_frames++;
+}
+
+static bool lockstep_lane_create(lockstep_lane_t a_lane, lockstep_rom_t a_rom)
+{
+    memset(a_lane, 0, sizeof(*a_lane));
+
+    a_lane->m_bus.initialize();
+    a_lane->m_bus.attach(ram_device_create(0x800), 0, 0x2000);
+    a_lane->m_ppu = ppu_device_create();
+    a_lane->m_bus.attach(a_lane->m_ppu, 0x2000, 0x2000);
+    a_lane->m_apu = apu_device_create();
+    a_lane->m_bus.attach(a_lane->m_apu, 0x4000, 0x100);
+
+    if (mapper_map_ines((ines_header_t)a_rom->m_image, &a_lane->m_bus, a_lane->m_ppu, nullptr) != MAPPER_OK)
+    {
+        return false;
+    }
+
+    // Nobody looks at the pictures or listens, like the batch workloads
+    ppu_device_set_output(a_lane->m_ppu, PPU_OUTPUT_NONE);
+    apu_device_set_muted(a_lane->m_apu, true);
+
+    a_lane->m_cpu.power_on(&a_lane->m_bus);
+
+    return true;
+}
+
+// One CPU cycle, the PPU ticks at master clock 0, 4 and 8 and the CPU at 0. With a_times the PPU and CPU parts
+// are timed with the TSC.
+static void lockstep_lane_cycle(lockstep_lane_t a_lane, uint32_t a_index, uint64_t *a_times)
+{
+#if LOCKSTEP_HAVE_TSC
+    uint64_t t0 = a_times ? __rdtsc() : 0;
+#endif
+
+    ppu_device_tick(a_lane->m_ppu, lockstep_frame_done, a_lane, &a_lane->m_nmi);
+
+#if LOCKSTEP_HAVE_TSC
+    uint64_t t1 = a_times ? __rdtsc() : 0;
+#endif
+
+    if (a_lane->m_nmi)
+    {
+        a_lane->m_cpu.nmi();
+        a_lane->m_nmi = 0;
+    }
+
+    a_lane->m_bus.m_clock++;
+    a_lane->m_cpu.tick(&a_lane->m_bus);
+    apu_device_tick(a_lane->m_apu, &a_lane->m_bus, &a_lane->m_apu_tick_state);
+    a_lane->m_cpu.irq(a_lane->m_apu_tick_state.out.irq);
+
+    if (a_lane->m_apu_tick_state.out.poll_joypad)
+    {
+        a_lane->m_apu_tick_state.in.joypad1.raw = lockstep_buttons(a_index, a_lane->m_frames);
+    }
+
+    if (a_lane->m_apu_tick_state.out.oam_dma)
+    {
+        a_lane->m_apu_tick_state.out.oam_dma = 0;
+        a_lane->m_cpu.stall(a_lane->m_cpu.m_tickcount & 1 ? 513 : 514);
+    }
+
+    if (a_lane->m_apu_tick_state.out.dmc_stall)
+    {
+        a_lane->m_cpu.stall(a_lane->m_apu_tick_state.out.dmc_stall);
+        a_lane->m_apu_tick_state.out.dmc_stall = 0;
+    }
+
+#if LOCKSTEP_HAVE_TSC
+    uint64_t t2 = a_times ? __rdtsc() : 0;
+#endif
+
+    ppu_device_tick(a_lane->m_ppu, lockstep_frame_done, a_lane, &a_lane->m_nmi);
+    ppu_device_tick(a_lane->m_ppu, lockstep_frame_done, a_lane, &a_lane->m_nmi);
+
+#if LOCKSTEP_HAVE_TSC
+    if (a_times)
+    {
+        uint64_t t3 = __rdtsc();
+        a_times[0] += (t1 - t0) + (t3 - t2);
+        a_times[1] += t2 - t1;
+    }
+#endif
+}
+
+static void lockstep_lane_destroy(lockstep_lane_t a_lane)
+{
+    bus_device_t devices[64];
+
+    size_t count = a_lane->m_bus.devices(devices, 0, 64);
+
+    count = ppu_device_bus(a_lane->m_ppu)->devices(devices, count, 64);
+
+    while (count--)
+    {
+        if (devices[count]->m_ops->destroy)
+        {
+            devices[count]->m_ops->destroy(devices[count]);
+        }
+    }
+}
+
+// Share of the emulation time spent in the CPU and the APU, which runs in the CPU's cycle
+static double lockstep_cpu_share(lockstep_rom_t a_rom, uint32_t a_frames)
+{
+#if LOCKSTEP_HAVE_TSC
+    struct lockstep_lane_data lane;
+    uint64_t times[2] = { 0, 0 };
+
+    if (!lockstep_lane_create(&lane, a_rom))
+    {
+        return 0.0;
+    }
+
+    while (lane.m_frames < a_frames)
+    {
+        lockstep_lane_cycle(&lane, 0, times);
+    }
+
+    lockstep_lane_destroy(&lane);
+
+    return (double)times[1] / (double)(times[0] + times[1]);
+#else
+    return 0.0;
+#endif
+}
+
+// Run a_lanes lanes one instruction per round until each has a_frames frames. Returns the average number of lanes
+// that share the opcode and the PC they are about to run.
+static void lockstep_convergence(lockstep_rom_t a_rom, uint32_t a_lanes, uint32_t a_frames, double *a_per_opcode, double *a_per_pc)
+{
+    static struct lockstep_lane_data lanes[LOCKSTEP_MAX_LANES];
+    uint64_t instructions = 0;
+    uint64_t opcode_groups = 0;
+    uint64_t pc_groups = 0;
+
+    for (uint32_t i = 0; i < a_lanes; i++)
+    {
+        lockstep_lane_create(&lanes[i], a_rom);
+    }
+
+    for (;;)
+    {
+        bool done = true;
+        uint16_t pcs[LOCKSTEP_MAX_LANES];
+        uint8_t opcodes[LOCKSTEP_MAX_LANES];
+        uint32_t active = 0;
+
+        for (uint32_t i = 0; i < a_lanes; i++)
+        {
+            lockstep_lane_t lane = &lanes[i];
+
+            if (lane->m_frames >= a_frames)
+            {
+                continue;
+            }
+
+            done = false;
+
+            // Run up to the cycle the next instruction starts in. An interrupt taken there counts as the
+            // instruction it comes before, there are one or two per frame.
+            while (lane->m_cpu.m_remaining_cycles)
+            {
+                lockstep_lane_cycle(lane, i, nullptr);
+            }
+
+            pcs[active] = lane->m_cpu.m_registers.pc;
+            opcodes[active] = lane->m_bus.read8(lane->m_cpu.m_registers.pc);
+            active++;
+
+            lockstep_lane_cycle(lane, i, nullptr);
+        }
+
+        if (done)
+        {
+            break;
+        }
+
+        uint8_t seen_opcode[256] = {};
+
+        for (uint32_t i = 0; i < active; i++)
+        {
+            opcode_groups += !seen_opcode[opcodes[i]];
+            seen_opcode[opcodes[i]] = 1;
+
+            bool new_pc = true;
+
+            for (uint32_t j = 0; j < i && new_pc; j++)
+            {
+                new_pc = pcs[j] != pcs[i];
+            }
+
+            pc_groups += new_pc;
+        }
+
+        instructions += active;
+    }
+
+    for (uint32_t i = 0; i < a_lanes; i++)
+    {
+        lockstep_lane_destroy(&lanes[i]);
+    }
+
+    *a_per_opcode = (double)instructions / (double)opcode_groups;
+    *a_per_pc = (double)instructions / (double)pc_groups;
+}
+
+// Frames per second of a_lanes machines on one thread of the scalar runner
+static double lockstep_scalar_fps(lockstep_rom_t a_rom, uint32_t a_lanes, uint32_t a_frames)
+{
+    static struct nes_runner_input_data inputs[LOCKSTEP_MAX_LANES][4096];
+    struct nes_runner_job_data jobs[LOCKSTEP_MAX_LANES];
+    uint32_t input_count = (a_frames + LOCKSTEP_INPUT_INTERVAL_FRAMES - 1) / LOCKSTEP_INPUT_INTERVAL_FRAMES;
+
+    if (input_count > 4096)
+    {
+        input_count = 4096;
+    }
+
+    memset(jobs, 0, sizeof(jobs));
+
+    for (uint32_t i = 0; i < a_lanes; i++)
+    {
+        for (uint32_t j = 0; j < input_count; j++)
+        {
+            inputs[i][j].m_frame = j * LOCKSTEP_INPUT_INTERVAL_FRAMES;
+            inputs[i][j].m_joypad[0] = lockstep_buttons(i, inputs[i][j].m_frame);
+            inputs[i][j].m_joypad[1] = 0;
+        }
+
+        jobs[i].m_ines_image = a_rom->m_image;
+        jobs[i].m_ines_size = a_rom->m_size;
+        jobs[i].m_inputs = inputs[i];
+        jobs[i].m_input_count = input_count;
+        jobs[i].m_frames = a_frames;
+    }
+
+    struct nes_runner_config_data config = { 1, false };
+
+    uint64_t ns = nes_runner_run(jobs, a_lanes, &config);
+
+    return (double)a_lanes * a_frames * 1e9 / (double)ns;
+}
+
+static bool lockstep_rom_load(lockstep_rom_t a_rom, const char *a_path)
+{
+    a_rom->m_path = a_path;
+    a_rom->m_image = nes_host_read_file(a_path, &a_rom->m_size);
+
+    return a_rom->m_image && mapper_ines_size(a_rom->m_image, a_rom->m_size) != 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *const s_default_roms[] = { "test_roms/smb.nes", "test_roms/pacman.nes" };
+    static const uint32_t s_lane_counts[] = { 8, 16 };
+
+    uint32_t frames = (argc > 1) ? (uint32_t)atoi(argv[1]) : LOCKSTEP_DEFAULT_FRAMES;
+    const char *const *roms = (argc > 2) ? (const char *const *)&argv[2] : s_default_roms;
+    int rom_count = (argc > 2) ? argc - 2 : 2;
+
+    for (int r = 0; r < rom_count; r++)
+    {
+        struct lockstep_rom_data rom;
+
+        if (!lockstep_rom_load(&rom, roms[r]))
+        {
+            fprintf(stderr, "Failed to load %s\n", roms[r]);
+            return 1;
+        }
+
+        double cpu_share = lockstep_cpu_share(&rom, frames);
+
+        printf("%s, %u frames per lane\n", rom.m_path, frames);
+        printf("  CPU and APU share of the emulation time: %.1f%%\n", cpu_share * 100.0);
+
+        for (uint32_t l = 0; l < sizeof(s_lane_counts) / sizeof(s_lane_counts[0]); l++)
+        {
+            uint32_t lanes = s_lane_counts[l];
+            double per_opcode, per_pc;
+
+            uint64_t start = nes_host_now_ns();
+            lockstep_convergence(&rom, lanes, frames, &per_opcode, &per_pc);
+            double lockstep_fps = (double)lanes * frames * 1e9 / (double)(nes_host_now_ns() - start);
+
+            double scalar_fps = lockstep_scalar_fps(&rom, lanes, frames);
+
+            // Amdahl, with each masked vector step costing what one scalar instruction costs
+            double bound = 1.0 / ((1.0 - cpu_share) + (cpu_share / per_opcode));
+
+            printf("  %2u lanes: %.2f lanes per opcode, %.2f per PC, speedup bound %.2fx\n", lanes, per_opcode, per_pc, bound);
+            printf("            scalar runner %.1f frames/s, lockstep rounds %.1f frames/s (one thread)\n", scalar_fps, lockstep_fps);
+        }
+
+        free(rom.m_image);
+    }
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+// Headless movie playback: runs an input movie (see nes_movie.h) on its cartridge as fast as it goes, for benchmarks
+// of real gameplay that are the same run on every build. Nothing is composed or mixed, as in the batch workloads.
+//
+// Usage: movie [-o out.nmv] [-k frames] [-n runs] [-s frame] [-v threads] rom movie, from the top of the tree. FM2
+// movies (.fm2) are imported, -o saves the import as a binary movie for the cartridge, with keyframes with -k. -s
+// times seeking to a frame and -v verifying the keyframes instead of playing.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "nes_movie.h"
+#include "nes_host.h"
+
+static void usage(const char *a_program)
+{
+    fprintf(stderr, "Usage: %s [-o out.nmv] [-k frames] [-n runs] [-s frame] [-v threads] rom movie\n", a_program);
+    fprintf(stderr, "  -o path    Save the movie as a binary movie for the cartridge\n");
+    fprintf(stderr, "  -k frames  Take a keyframe every this many frames first\n");
+    fprintf(stderr, "  -n runs    Play the movie this many times (default 1)\n");
+    fprintf(stderr, "  -s frame   Seek to the start of this frame instead of playing\n");
+    fprintf(stderr, "  -v threads Verify the keyframes on this many threads instead of playing (0 for one per CPU)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *out_path = nullptr;
+    int keyframe_interval = 0;
+    int runs = 1;
+    int seek_frame = -1;
+    int verify_threads = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:k:n:s:v:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'k':
+            keyframe_interval = atoi(optarg);
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        case 's':
+            seek_frame = atoi(optarg);
+            break;
+        case 'v':
+            verify_threads = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2 || runs <= 0 || keyframe_interval < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t rom_size;
+    uint8_t *rom = nes_host_read_file(argv[optind], &rom_size);
+
+    if (!rom)
+    {
+        fprintf(stderr, "Failed to read %s\n", argv[optind]);
+        return 1;
+    }
+
+    nes_movie_t movie = nes_movie_open(argv[optind + 1]);
+
+    if (!movie)
+    {
+        fprintf(stderr, "Failed to load the movie %s\n", argv[optind + 1]);
+        return 1;
+    }
+
+    uint64_t rom_hash = nes_movie_hash_rom(rom, rom_size);
+
+    if (nes_movie_rom_hash(movie) && nes_movie_rom_hash(movie) != rom_hash)
+    {
+        fprintf(stderr, "The movie was recorded on another cartridge\n");
+        return 1;
+    }
+
+    nes_movie_set_rom_hash(movie, rom_hash);
+
+    if (keyframe_interval && !nes_movie_add_keyframes(movie, rom, rom_size, keyframe_interval))
+    {
+        fprintf(stderr, "Unsupported cartridge\n");
+        return 1;
+    }
+
+    if (out_path && !nes_movie_save(movie, out_path))
+    {
+        fprintf(stderr, "Failed to save %s\n", out_path);
+        return 1;
+    }
+
+    nes_system_t system = nes_system_create();
+
+    nes_system_set_muted(system, true);
+    nes_system_set_output(system, NES_SYSTEM_OUTPUT_NONE);
+
+    printf("%s, %u frames, %u keyframes\n", argv[optind + 1], nes_movie_frame_count(movie), nes_movie_keyframe_count(movie));
+
+    for (int run = 0; run < runs; run++)
+    {
+        // Movies start from power on
+        if (nes_system_load_rom(system, rom, rom_size, nullptr) != NES_SYSTEM_OK)
+        {
+            fprintf(stderr, "Unsupported cartridge\n");
+            return 1;
+        }
+
+        uint64_t start = nes_host_now_ns();
+
+        if (verify_threads >= 0)
+        {
+            uint32_t segment;
+            nes_movie_verify_result_t result = nes_movie_verify(movie, rom, rom_size, (uint32_t)verify_threads, &segment);
+            uint64_t ns = nes_host_now_ns() - start;
+
+            if (result == NES_MOVIE_VERIFY_INVALID)
+            {
+                fprintf(stderr, "No keyframes of this build for the cartridge\n");
+                return 1;
+            }
+
+            if (result == NES_MOVIE_VERIFY_DIVERGED)
+            {
+                uint32_t end;
+                const void *state;
+                size_t size;
+
+                nes_movie_keyframe(movie, segment, &end, &state, &size);
+                printf("  run %d: diverged in segment %u, before frame %u, in %.1f ms\n", run + 1, segment, end, ns / 1e6);
+                return 1;
+            }
+
+            printf("  run %d: verified %u segments in %.1f ms, %.1f frames/s\n", run + 1, nes_movie_keyframe_count(movie), ns / 1e6,
+                   ns ? nes_movie_frame_count(movie) * 1e9 / ns : 0.0);
+            continue;
+        }
+
+        if (seek_frame >= 0)
+        {
+            if (!nes_movie_seek(movie, system, (uint32_t)seek_frame))
+            {
+                fprintf(stderr, "Failed to seek to frame %d\n", seek_frame);
+                return 1;
+            }
+
+            printf("  run %d: seek to frame %d in %.1f ms\n", run + 1, seek_frame, (nes_host_now_ns() - start) / 1e6);
+            continue;
+        }
+
+        uint32_t frames = nes_movie_play(movie, system, 0, nes_movie_frame_count(movie));
+        uint64_t ns = nes_host_now_ns() - start;
+
+        printf("  run %d: %.1f ms, %.1f frames/s\n", run + 1, ns / 1e6, ns ? frames * 1e9 / ns : 0.0);
+    }
+
+    nes_system_destroy(system);
+    nes_movie_destroy(movie);
+    free(rom);
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <math.h>
+#include <string.h>
+
+#include "blip.h"
+
+#define BLIP_FRAC_BITS 32
+#define BLIP_KERNEL_BITS 15 // Kernel taps of a phase sum to 1 << BLIP_KERNEL_BITS
+#define BLIP_BASS_SHIFT 9   // High-pass corner, roughly 14 Hz at 44.1 kHz
+#define BLIP_FRAME_HEADROOM 1024 // Samples kept free for the next frame when nobody is reading
+
+typedef struct blip_kernel_data
+{
+    int16_t m_taps[BLIP_PHASES][BLIP_WIDTH];
+} *blip_kernel_t;
+
+// Windowed sinc impulse, one row per sub-sample phase. Every row is normalized so that a step always ends at
+// exactly the delta that was added, otherwise the output would drift.
+static struct blip_kernel_data blip_kernel_build()
+{
+    struct blip_kernel_data kernel = {};
+
+    const double cutoff = 0.92; // Fraction of the output Nyquist frequency that is passed
+    const double half = BLIP_WIDTH / 2;
+
+    for (int phase = 0; phase < BLIP_PHASES; phase++)
+    {
+        double taps[BLIP_WIDTH];
+        double sum = 0;
+
+        for (int i = 0; i < BLIP_WIDTH; i++)
+        {
+            double x = (i - (half - 1)) - ((double)phase / BLIP_PHASES);
+            double sinc = (x == 0) ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            double window = 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2 * M_PI * x / half); // Blackman
+
+            taps[i] = (fabs(x) < half) ? sinc * window : 0;
+            sum += taps[i];
+        }
+
+        int32_t total = 0;
+        int largest = 0;
+
+        for (int i = 0; i < BLIP_WIDTH; i++)
+        {
+            kernel.m_taps[phase][i] = (int16_t)lround(taps[i] / sum * (1 << BLIP_KERNEL_BITS));
+            total += kernel.m_taps[phase][i];
+
+            if (kernel.m_taps[phase][i] > kernel.m_taps[phase][largest])
+            {
+                largest = i;
+            }
+        }
+
+        // Put the rounding error on the center tap
+        kernel.m_taps[phase][largest] += (1 << BLIP_KERNEL_BITS) - total;
+    }
+
+    return kernel;
+}
+
+static int16_t const (*blip_kernel())[BLIP_WIDTH]
+{
+    // Built once on first use, the initialization of a function static is thread-safe
+    static const struct blip_kernel_data s_kernel = blip_kernel_build();
+
+    return s_kernel.m_taps;
+}
+
+void blip_init(blip_t a_blip, double a_clock_rate, double a_sample_rate)
+{
+    a_blip->m_kernel = blip_kernel();
+    blip_set_rates(a_blip, a_clock_rate, a_sample_rate);
+    blip_clear(a_blip);
+}
+
+void blip_set_rates(blip_t a_blip, double a_clock_rate, double a_sample_rate)
+{
+    a_blip->m_factor = (uint64_t)ceil(a_sample_rate / a_clock_rate * (double)(1ULL << BLIP_FRAC_BITS));
+}
+
+void blip_clear(blip_t a_blip)
+{
+    a_blip->m_offset = 0;
+    a_blip->m_integrator = 0;
+    memset(a_blip->m_buffer, 0, sizeof(a_blip->m_buffer));
+}
+
+void blip_add_delta(blip_t a_blip, uint32_t a_time, int32_t a_delta)
+{
+    uint64_t position = a_blip->m_offset + (a_time * a_blip->m_factor);
+
+    size_t index = position >> BLIP_FRAC_BITS;
+    uint32_t phase = (position >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+
+    if (index > BLIP_MAX_SAMPLES)
+    {
+        // Frame was not ended in time, drop the change rather than writing out of bounds
+        return;
+    }
+
+    int32_t *out = &a_blip->m_buffer[index];
+    int16_t const *taps = a_blip->m_kernel[phase];
+
+    for (int i = 0; i < BLIP_WIDTH; i++)
+    {
+        out[i] += taps[i] * a_delta;
+    }
+}
+
+void blip_end_frame(blip_t a_blip, uint32_t a_time)
+{
+    a_blip->m_offset += a_time * a_blip->m_factor;
+
+    size_t avail = blip_samples_avail(a_blip);
+
+    if (avail > BLIP_MAX_SAMPLES - BLIP_FRAME_HEADROOM)
+    {
+        // Nobody is reading, drop the oldest samples to keep room for the next frame
+        blip_read_samples(a_blip, nullptr, avail - (BLIP_MAX_SAMPLES - BLIP_FRAME_HEADROOM));
+    }
+}
+
+size_t blip_samples_avail(blip_t a_blip)
+{
+    return a_blip->m_offset >> BLIP_FRAC_BITS;
+}
+
+size_t blip_read_samples(blip_t a_blip, int16_t *a_samples, size_t a_count)
+{
+    size_t avail = blip_samples_avail(a_blip);
+
+    if (a_count > avail)
+    {
+        a_count = avail;
+    }
+
+    int32_t sum = a_blip->m_integrator;
+
+    for (size_t i = 0; i < a_count; i++)
+    {
+        int32_t sample = sum >> BLIP_KERNEL_BITS;
+
+        sum += a_blip->m_buffer[i];
+
+        if (sample < INT16_MIN)
+        {
+            sample = INT16_MIN;
+        }
+        else if (sample > INT16_MAX)
+        {
+            sample = INT16_MAX;
+        }
+
+        if (a_samples)
+        {
+            a_samples[i] = (int16_t)sample;
+        }
+
+        // Leak a little of the sum every sample, removes the DC offset of the channels
+        sum -= sample << (BLIP_KERNEL_BITS - BLIP_BASS_SHIFT);
+    }
+
+    a_blip->m_integrator = sum;
+
+    // Move everything behind the samples read to the front, that includes the tails of the last impulses
+    size_t remaining = (BLIP_MAX_SAMPLES + BLIP_WIDTH) - a_count;
+    memmove(a_blip->m_buffer, &a_blip->m_buffer[a_count], remaining * sizeof(a_blip->m_buffer[0]));
+    memset(&a_blip->m_buffer[remaining], 0, a_count * sizeof(a_blip->m_buffer[0]));
+
+    a_blip->m_offset -= (uint64_t)a_count << BLIP_FRAC_BITS;
+
+    return a_count;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Band-limited step synthesis. Instead of generating a sample for every clock, the sound source only reports
+// amplitude changes with blip_add_delta. Each change is spread over the output samples with a band-limited impulse
+// which the reader integrates into a band-limited step. The cost is proportional to the number of amplitude
+// changes, not to the clock rate.
+
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_WIDTH 16          // Taps per impulse
+#define BLIP_MAX_SAMPLES 4096  // Samples that can be buffered between reads
+
+typedef struct blip_data *blip_t;
+
+struct blip_data
+{
+    int16_t const (*m_kernel)[BLIP_WIDTH]; // [BLIP_PHASES][BLIP_WIDTH], shared and read-only
+    uint64_t m_factor;      // Output samples per clock, 32.32 fixed point
+    uint64_t m_offset;      // Position of the frame start in output samples, 32.32 fixed point
+    int32_t m_integrator;   // Running sum of the deltas, also acts as a high-pass filter
+    int32_t m_buffer[BLIP_MAX_SAMPLES + BLIP_WIDTH];
+};
+
+void blip_init(blip_t a_blip, double a_clock_rate, double a_sample_rate);
+
+// Change the resampling ratio, samples already buffered are kept
+void blip_set_rates(blip_t a_blip, double a_clock_rate, double a_sample_rate);
+
+void blip_clear(blip_t a_blip);
+
+// Add an amplitude change at a_time clocks from the start of the current frame
+void blip_add_delta(blip_t a_blip, uint32_t a_time, int32_t a_delta);
+
+// End the current frame after a_time clocks, the samples up to that point become readable. A frame can't be longer
+// than about 1000 output samples. If nobody reads the samples the oldest are dropped.
+void blip_end_frame(blip_t a_blip, uint32_t a_time);
+
+size_t blip_samples_avail(blip_t a_blip);
+
+// Read and remove up to a_count samples, a_samples can be nullptr to discard them
+// Returns the number of samples read
+size_t blip_read_samples(blip_t a_blip, int16_t *a_samples, size_t a_count);
@@ -6,6 +6,9 @@ void bus_data::initialize()
     {
         m_device_map[i] = nullptr;
     }
+
+    m_clock = 0;
+    m_scheduler = nullptr;
 }
             
 void bus_data::attach(bus_device_t a_device, uint16_t a_base, uint32_t a_size)
@@ -74,3 +77,54 @@ void bus_data::write16(uint16_t a_addr, uint16_t a_value)
         dev->m_ops->write8(dev, a_addr, a_value & 0xFF);
     }
 }
+
+void bus_data::sync()
+{
+    bus_device_t prev = nullptr;
+
+    for (int i = 0; i < BUS_PAGES; i++)
+    {
+        bus_device_t dev = m_device_map[i];
+
+        // Devices span several pages, only sync them once per run of pages
+        if (dev && dev != prev && dev->m_ops->sync)
+        {
+            dev->m_ops->sync(dev);
+        }
+
+        prev = dev;
+    }
+}
+
+size_t bus_data::devices(bus_device_t *a_devices, size_t a_count, size_t a_max)
+{
+    bus_device_t prev = nullptr;
+
+    for (int i = 0; i < BUS_PAGES; i++)
+    {
+        bus_device_t dev = m_device_map[i];
+
+        // Devices span several pages, only look at them once per run of pages
+        if (!dev || dev == prev)
+        {
+            prev = dev;
+            continue;
+        }
+
+        prev = dev;
+
+        size_t j = 0;
+
+        while (j < a_count && a_devices[j] != dev)
+        {
+            j++;
+        }
+
+        if (j == a_count && a_count < a_max)
+        {
+            a_devices[a_count++] = dev;
+        }
+    }
+
+    return a_count;
+}
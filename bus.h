@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include "hw_types.h"
 
@@ -8,6 +9,14 @@ struct bus_data
 {
     bus_device_t m_device_map[BUS_PAGES];
 
+    // The CPU cycle in progress, counted from power on. Whoever runs the CPU advances it before each tick,
+    // cpu_data::run does for the cycles it runs. Devices that run behind the CPU catch up to it when accessed.
+    uint64_t m_clock;
+
+    // Where the devices post their events (see scheduler.h), cpu_data::run stops before the next one. nullptr when
+    // the CPU is ticked in lockstep with the devices.
+    scheduler_t m_scheduler;
+
     void initialize();
 
     void attach(bus_device_t a_device, uint16_t a_base, uint32_t a_size);
@@ -16,6 +25,13 @@ struct bus_data
     uint16_t read16(uint16_t a_addr);
     void write8(uint16_t a_addr, uint8_t a_value);
     void write16(uint16_t a_addr, uint16_t a_value);
+
+    // Ask every attached device that has a backing store to flush it (see bus_device_ops_data::sync)
+    void sync();
+
+    // Append the attached devices that are not in a_devices[0, a_count) yet, in address order and each once even if
+    // it is attached at several places. Stops at a_max, returns the new count.
+    size_t devices(bus_device_t *a_devices, size_t a_count, size_t a_max);
 };
 
 struct bus_device_data 
@@ -30,4 +46,15 @@ struct bus_device_ops_data
 {
     uint8_t (*read8)(bus_device_t a_dev, uint16_t a_addr);
     void (*write8)(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value);
+    void (*sync)(bus_device_t a_dev); // Optional, flush the device to its backing store(battery RAM)
+
+    // Optional, the device state for save states (see nes_state.h). ROM contents, host resources and derived
+    // values are not part of it. state_save writes and state_load reads exactly state_size bytes.
+    size_t (*state_size)(bus_device_t a_dev);
+    void (*state_save)(bus_device_t a_dev, uint8_t *a_buffer);
+    void (*state_load)(bus_device_t a_dev, const uint8_t *a_buffer);
+
+    // Optional, free the device when the machine is torn down. Devices that share one allocation (a mapper attached
+    // as several devices) set it on one of them only.
+    void (*destroy)(bus_device_t a_dev);
 };
\ No newline at end of file
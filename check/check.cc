@@ -0,0 +1,462 @@
+// Test ROM regression check, run by make check: every cartridge in a directory runs headless without input for a
+// fixed number of frames, on the thread-pool runner (nes_runner.h), and its outcome is compared with the one listed
+// for it. The list is a text file with one line per ROM, # starts a comment:
+//
+//   path frames blargg code   The ROM reports through PRG RAM, the way of blargg's newer tests: $DE $B0 $61 at
+//                             $6001, the status at $6000 ($80 running, $81 reset wanted) and text from $6004. It
+//                             has to finish within the frames with the result code.
+//   path frames frame hash    The FNV-1a hash of the RGB frame after the frames, for ROMs that only show their
+//                             results and for games
+//   path frames xfail hash    A ROM the emulator is known to fail, with the hash of the wrong frame it shows. Reported
+//                             as XFAIL while the frame stays that, as a failed XPASS once it changes: see whether the
+//                             ROM passes now and give it a frame line.
+//   path 0 unsupported -      Loading fails with NES_SYSTEM_UNSUPPORTED, the mapper is not implemented
+//
+// A ROM in the directory without a line fails. After an intended change to the output, check -u prints the list
+// with the frame hashes there are now. Before the ROMs, the runner itself is checked: jobs of very different length
+// on several workers, which makes them steal from each other, must all run.
+//
+// Usage: check [-u] list directory, from the top of the tree.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "nes_runner.h"
+#include "nes_host.h"
+
+#define CHECK_MAX_ROMS 256
+#define CHECK_MAX_PATH 256
+#define CHECK_MAX_TEXT 256
+#define CHECK_FNV_OFFSET 0xCBF29CE484222325ull
+#define CHECK_FNV_PRIME 0x100000001B3ull
+
+// Runner check: the first half of the jobs is short, the worker that has them steals from the other
+#define CHECK_RUNNER_JOBS 16
+#define CHECK_RUNNER_THREADS 2
+#define CHECK_RUNNER_SHORT_FRAMES 1
+#define CHECK_RUNNER_LONG_FRAMES 40
+
+#define CHECK_BLARGG_STATUS 0x6000
+#define CHECK_BLARGG_SIGNATURE 0x6001
+#define CHECK_BLARGG_TEXT 0x6004
+#define CHECK_BLARGG_RUNNING 0x80
+#define CHECK_BLARGG_RESET 0x81
+#define CHECK_BLARGG_RESET_FRAMES 6 // The reset button is pressed at least 100 ms after the ROM asks for it
+
+typedef enum check_kind
+{
+    CHECK_BLARGG,
+    CHECK_FRAME,
+    CHECK_XFAIL,
+    CHECK_UNSUPPORTED
+} check_kind_t;
+
+typedef struct check_rom_data
+{
+    // From the list
+    char m_path[CHECK_MAX_PATH];
+    uint32_t m_frames;
+    check_kind_t m_kind;
+    uint64_t m_expected; // Result code or frame hash, the wrong one for CHECK_XFAIL
+
+    // Set on the worker thread
+    uint32_t m_reset_frame; // Press reset after this frame, 0 for no reset wanted
+    bool m_finished;        // A blargg ROM reported its result
+    uint8_t m_result;
+    char m_text[CHECK_MAX_TEXT];
+    uint64_t m_hash;
+} *check_rom_t;
+
+static const char *const g_check_kinds[] = { "blargg", "frame", "xfail", "unsupported" };
+
+static size_t check_read_list(const char *a_path, check_rom_t a_roms, size_t a_max)
+{
+    FILE *file = fopen(a_path, "r");
+
+    if (!file)
+    {
+        return 0;
+    }
+
+    char line[512];
+    size_t count = 0;
+
+    while (fgets(line, sizeof(line), file) && count < a_max)
+    {
+        check_rom_t rom = &a_roms[count];
+        char kind[16];
+        char expected[32];
+
+        if (line[0] == '#' || sscanf(line, "%255s %u %15s %31s", rom->m_path, &rom->m_frames, kind, expected) != 4)
+        {
+            continue;
+        }
+
+        if (strcmp(kind, "blargg") == 0)
+        {
+            rom->m_kind = CHECK_BLARGG;
+            rom->m_expected = strtoull(expected, nullptr, 0);
+        }
+        else if (strcmp(kind, "frame") == 0)
+        {
+            rom->m_kind = CHECK_FRAME;
+            rom->m_expected = strtoull(expected, nullptr, 16);
+        }
+        else if (strcmp(kind, "xfail") == 0)
+        {
+            rom->m_kind = CHECK_XFAIL;
+            rom->m_expected = strtoull(expected, nullptr, 16);
+        }
+        else if (strcmp(kind, "unsupported") == 0)
+        {
+            rom->m_kind = CHECK_UNSUPPORTED;
+            rom->m_frames = 0;
+        }
+        else
+        {
+            fprintf(stderr, "%s: unknown check %s for %s\n", a_path, kind, rom->m_path);
+            continue;
+        }
+
+        count++;
+    }
+
+    fclose(file);
+
+    return count;
+}
+
+static uint64_t check_hash_frame(nes_system_t a_system)
+{
+    const uint8_t *frame = nes_system_frame_buffer(a_system);
+    uint64_t hash = CHECK_FNV_OFFSET;
+
+    for (size_t i = 0; i < NES_SYSTEM_FRAME_WIDTH * NES_SYSTEM_FRAME_HEIGHT * 3; i++)
+    {
+        hash = (hash ^ frame[i]) * CHECK_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static bool check_blargg_signature(nes_system_t a_system)
+{
+    return nes_system_peek(a_system, CHECK_BLARGG_SIGNATURE) == 0xDE &&
+           nes_system_peek(a_system, CHECK_BLARGG_SIGNATURE + 1) == 0xB0 &&
+           nes_system_peek(a_system, CHECK_BLARGG_SIGNATURE + 2) == 0x61;
+}
+
+static bool check_frame(size_t a_job, nes_system_t a_system, uint32_t a_frame, void *a_context)
+{
+    check_rom_t rom = (check_rom_t)a_context;
+
+    if (rom->m_kind == CHECK_FRAME || rom->m_kind == CHECK_XFAIL)
+    {
+        if (a_frame + 1 == rom->m_frames)
+        {
+            rom->m_hash = check_hash_frame(a_system);
+        }
+
+        return true;
+    }
+
+    if (!check_blargg_signature(a_system))
+    {
+        return true;
+    }
+
+    uint8_t status = nes_system_peek(a_system, CHECK_BLARGG_STATUS);
+
+    if (status == CHECK_BLARGG_RUNNING)
+    {
+        return true;
+    }
+
+    if (status == CHECK_BLARGG_RESET)
+    {
+        if (!rom->m_reset_frame)
+        {
+            rom->m_reset_frame = a_frame + CHECK_BLARGG_RESET_FRAMES;
+        }
+        else if (a_frame >= rom->m_reset_frame)
+        {
+            nes_system_reset(a_system);
+            rom->m_reset_frame = 0;
+        }
+
+        return true;
+    }
+
+    size_t length = 0;
+
+    while (length < CHECK_MAX_TEXT - 1)
+    {
+        char c = (char)nes_system_peek(a_system, (uint16_t)(CHECK_BLARGG_TEXT + length));
+
+        if (!c)
+        {
+            break;
+        }
+
+        rom->m_text[length++] = (c == '\n') ? ' ' : c;
+    }
+
+    // The text ends with a line break or two
+    while (length && rom->m_text[length - 1] == ' ')
+    {
+        length--;
+    }
+
+    rom->m_text[length] = '\0';
+    rom->m_result = status;
+    rom->m_finished = true;
+
+    return false;
+}
+
+// Print the outcome of a_rom, returns whether it is the expected one, for CHECK_XFAIL the known failure
+static bool check_report(check_rom_t a_rom, nes_runner_job_t a_job)
+{
+    char outcome[CHECK_MAX_TEXT + 64];
+    bool pass;
+    const char *verdict = nullptr;
+
+    if (a_rom->m_kind == CHECK_UNSUPPORTED)
+    {
+        pass = a_job->m_result == NES_SYSTEM_UNSUPPORTED;
+        snprintf(outcome, sizeof(outcome), pass ? "unsupported mapper" : "loads, expected an unsupported mapper");
+    }
+    else if (a_job->m_result != NES_SYSTEM_OK)
+    {
+        pass = false;
+        snprintf(outcome, sizeof(outcome), a_job->m_result == NES_SYSTEM_UNSUPPORTED ? "unsupported mapper" : "not an iNES image");
+    }
+    else if (a_job->m_frames_run == 0)
+    {
+        // The job keeps its zeroed result when the runner loses it, fail as that and not as a wrong frame
+        pass = false;
+        snprintf(outcome, sizeof(outcome), "never ran");
+    }
+    else if (a_rom->m_kind == CHECK_BLARGG)
+    {
+        pass = a_rom->m_finished && a_rom->m_result == a_rom->m_expected;
+
+        if (a_rom->m_finished)
+        {
+            snprintf(outcome, sizeof(outcome), "result %u, \"%s\"", a_rom->m_result, a_rom->m_text);
+        }
+        else
+        {
+            snprintf(outcome, sizeof(outcome), "no result after %u frames", a_rom->m_frames);
+        }
+    }
+    else if (a_rom->m_kind == CHECK_XFAIL)
+    {
+        pass = a_rom->m_hash == a_rom->m_expected;
+        verdict = pass ? "XFAIL" : "XPASS";
+        snprintf(outcome, sizeof(outcome), pass ? "frame %u is the known failure" : "frame %u is %016llx, not the known failure %016llx",
+                 a_rom->m_frames, (unsigned long long)a_rom->m_hash, (unsigned long long)a_rom->m_expected);
+    }
+    else
+    {
+        pass = a_rom->m_hash == a_rom->m_expected;
+        snprintf(outcome, sizeof(outcome), pass ? "frame %u as expected" : "frame %u is %016llx, expected %016llx", a_rom->m_frames,
+                 (unsigned long long)a_rom->m_hash, (unsigned long long)a_rom->m_expected);
+    }
+
+    printf("%s %s: %s\n", verdict ? verdict : (pass ? "PASS" : "FAIL"), a_rom->m_path, outcome);
+
+    return pass;
+}
+
+// Run a_image as jobs of uneven length on several workers, returns whether every job ran to the end
+static bool check_runner(const uint8_t *a_image, size_t a_size)
+{
+    struct nes_runner_job_data jobs[CHECK_RUNNER_JOBS] = {};
+    struct nes_runner_config_data config = {};
+    uint32_t missed = 0;
+
+    config.m_threads = CHECK_RUNNER_THREADS;
+
+    for (uint32_t i = 0; i < CHECK_RUNNER_JOBS; i++)
+    {
+        jobs[i].m_ines_image = a_image;
+        jobs[i].m_ines_size = a_size;
+        jobs[i].m_frames = (i < CHECK_RUNNER_JOBS / 2) ? CHECK_RUNNER_SHORT_FRAMES : CHECK_RUNNER_LONG_FRAMES;
+    }
+
+    nes_runner_run(jobs, CHECK_RUNNER_JOBS, &config);
+
+    for (uint32_t i = 0; i < CHECK_RUNNER_JOBS; i++)
+    {
+        if (jobs[i].m_result != NES_SYSTEM_OK || jobs[i].m_frames_run != jobs[i].m_frames)
+        {
+            missed++;
+        }
+    }
+
+    printf("%s runner: %u jobs of %u and %u frames on %u threads, %u did not run\n", missed ? "FAIL" : "PASS", CHECK_RUNNER_JOBS,
+           CHECK_RUNNER_SHORT_FRAMES, CHECK_RUNNER_LONG_FRAMES, CHECK_RUNNER_THREADS, missed);
+
+    return missed == 0;
+}
+
+static void usage(const char *a_program)
+{
+    fprintf(stderr, "Usage: %s [-u] list directory\n", a_program);
+    fprintf(stderr, "  -u  Print the list with the frame hashes of this build instead of checking them\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bool update = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "u")) != -1)
+    {
+        switch (opt)
+        {
+        case 'u':
+            update = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (argc - optind != 2)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    const char *list_path = argv[optind];
+    const char *directory = argv[optind + 1];
+    check_rom_t roms = (check_rom_t)calloc(CHECK_MAX_ROMS, sizeof(struct check_rom_data));
+    size_t count = check_read_list(list_path, roms, CHECK_MAX_ROMS);
+
+    if (count == 0)
+    {
+        fprintf(stderr, "No ROMs in %s\n", list_path);
+        return 2;
+    }
+
+    nes_runner_job_t jobs = (nes_runner_job_t)calloc(count, sizeof(struct nes_runner_job_data));
+    uint8_t **images = (uint8_t **)calloc(count, sizeof(uint8_t *));
+    int failed = 0;
+    int known_failures = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        images[i] = nes_host_read_file(roms[i].m_path, &jobs[i].m_ines_size);
+
+        if (!images[i])
+        {
+            fprintf(stderr, "Failed to read %s\n", roms[i].m_path);
+            return 2;
+        }
+
+        jobs[i].m_ines_image = images[i];
+        jobs[i].m_frames = roms[i].m_frames;
+        jobs[i].m_frame_callback = check_frame;
+        jobs[i].m_context = &roms[i];
+    }
+
+    // Any cartridge that loads does for the runner
+    for (size_t i = 0; i < count && !update; i++)
+    {
+        if (roms[i].m_kind != CHECK_UNSUPPORTED)
+        {
+            failed += check_runner(images[i], jobs[i].m_ines_size) ? 0 : 1;
+            break;
+        }
+    }
+
+    struct nes_runner_config_data config = {};
+    uint64_t ns = nes_runner_run(jobs, count, &config);
+
+    if (update)
+    {
+        printf("# ROM                           Frames Check        Expected\n");
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (update)
+        {
+            char expected[32] = "-";
+
+            if (roms[i].m_kind == CHECK_FRAME || roms[i].m_kind == CHECK_XFAIL)
+            {
+                snprintf(expected, sizeof(expected), "%016llx", (unsigned long long)roms[i].m_hash);
+            }
+            else if (roms[i].m_kind == CHECK_BLARGG)
+            {
+                snprintf(expected, sizeof(expected), "%llu", (unsigned long long)roms[i].m_expected);
+            }
+
+            printf("%-32s %5u %-12s %s\n", roms[i].m_path, roms[i].m_frames, g_check_kinds[roms[i].m_kind], expected);
+        }
+        else if (!check_report(&roms[i], &jobs[i]))
+        {
+            failed++;
+        }
+        else if (roms[i].m_kind == CHECK_XFAIL)
+        {
+            known_failures++;
+        }
+    }
+
+    // ROMs added to the directory without saying what they should do
+    DIR *dir = opendir(directory);
+    struct dirent *entry;
+
+    while (dir && (entry = readdir(dir)))
+    {
+        size_t length = strlen(entry->d_name);
+        bool listed = false;
+
+        if (length < 4 || strcmp(entry->d_name + length - 4, ".nes") != 0)
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < count && !listed; i++)
+        {
+            const char *name = strrchr(roms[i].m_path, '/');
+
+            listed = strcmp(name ? name + 1 : roms[i].m_path, entry->d_name) == 0;
+        }
+
+        if (!listed)
+        {
+            fprintf(update ? stderr : stdout, "FAIL %s/%s: not in %s\n", directory, entry->d_name, list_path);
+            failed++;
+        }
+    }
+
+    if (dir)
+    {
+        closedir(dir);
+    }
+
+    if (!update)
+    {
+        printf("%zu ROMs, %d failed, %d known to fail, %.1f s\n", count, failed, known_failures, ns / 1e9);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        free(images[i]);
+    }
+
+    free(images);
+    free(jobs);
+    free(roms);
+
+    return failed ? 1 : 0;
+}
@@ -1,5 +1,6 @@
 #include "cpu.h"
 #include "bus.h"
+#include "scheduler.h"
 
 #define CPU_FLAG_CARRY 0x01
 #define CPU_FLAG_ZERO 0x02
@@ -1410,16 +1411,36 @@ void cpu_data::power_on(bus_t a_bus)
 
     m_nmi = 0;
 
+    m_irq = 0;
+
     m_remaining_cycles = 0;
 
     m_tickcount = 0;
 }
 
+void cpu_data::reset(bus_t a_bus)
+{
+    // The reset sequence pushes nothing but still moves the stack pointer, as BRK would
+    m_registers.s -= 3;
+
+    m_registers.pc = a_bus->read16(0xFFFC);
+    m_registers.status.raw |= CPU_FLAG_INTERRUPT_DISABLE;
+
+    m_nmi = 0;
+
+    m_remaining_cycles = 0;
+}
+
 void cpu_data::nmi()
 {
     m_nmi = 1;
 }
 
+void cpu_data::irq(bool a_level)
+{
+    m_irq = a_level;
+}
+
 void cpu_data::stall(uint32_t a_cycles)
 {
     m_remaining_cycles += a_cycles;
@@ -1456,6 +1477,19 @@ void cpu_data::tick(bus_t a_bus)
         return;
     }
 
+    if (m_irq && !m_registers.status.flag.i)
+    {
+        opcode_push_stack16(this, a_bus, m_registers.pc);
+        opcode_push_stack8(this, a_bus, (m_registers.status.raw & ~CPU_FLAG_BREAK) | CPU_FLAG_UNUSED);
+
+        m_registers.status.flag.i = 1;
+        m_registers.pc = a_bus->read16(0xFFFE);
+
+        m_remaining_cycles += 7 - 1;
+
+        return;
+    }
+
     // Print the address and opcode for debugging
     
     uint8_t opcode_number = a_bus->read8(m_registers.pc);
@@ -1479,4 +1513,49 @@ void cpu_data::tick(bus_t a_bus)
     m_registers.pc += opcode->length;
 
     m_remaining_cycles += (opcode->cycles - 1);
-}
\ No newline at end of file
+}
+
+uint32_t cpu_data::run(bus_t a_bus, uint32_t a_cycles)
+{
+    uint64_t start = a_bus->m_clock;
+    uint64_t end = start + a_cycles;
+
+    for (;;)
+    {
+        // Up to the cycle before the next event, it can be posted on the way
+        uint64_t stop = end;
+
+        if (a_bus->m_scheduler && a_bus->m_scheduler->m_next - 1 < stop)
+        {
+            stop = a_bus->m_scheduler->m_next - 1;
+        }
+
+        if (a_bus->m_clock >= stop)
+        {
+            break;
+        }
+
+        if (m_remaining_cycles)
+        {
+            // The instruction did all its work on its first cycle, the rest only count
+            uint64_t count = stop - a_bus->m_clock;
+
+            if (count > m_remaining_cycles)
+            {
+                count = m_remaining_cycles;
+            }
+
+            m_remaining_cycles -= (uint32_t)count;
+            m_tickcount += (uint32_t)count;
+            a_bus->m_clock += count;
+
+            continue;
+        }
+
+        a_bus->m_clock++;
+
+        tick(a_bus);
+    }
+
+    return (uint32_t)(a_bus->m_clock - start);
+}
@@ -28,7 +28,7 @@ struct cpu_data
         } status;
     } m_registers;
 
-    uint8_t m_nmi : 1, __unused : 7;
+    uint8_t m_nmi : 1, m_irq : 1, __unused : 6;
 
     uint32_t m_remaining_cycles;
 
@@ -36,9 +36,21 @@ struct cpu_data
 
     void power_on(bus_t a_bus);
 
+    // The reset button, the registers but the stack pointer and the I flag are kept
+    void reset(bus_t a_bus);
+
     void nmi();
 
+    // Set the level of the IRQ line, the interrupt is taken while it is high and the I flag is clear
+    void irq(bool a_level);
+
     void stall(uint32_t a_cycles);
     
+    // One cycle, bus_data::m_clock has to be advanced to it before
     void tick(bus_t a_bus);
+
+    // Run up to a_cycles cycles and advance bus_data::m_clock with them. Stops early before the cycle of the next
+    // event on the bus' scheduler, which the devices may post while it runs. NMI and IRQ are only sampled at the
+    // instruction boundaries inside, as with tick. Returns the cycles run.
+    uint32_t run(bus_t a_bus, uint32_t a_cycles);
 };
\ No newline at end of file
@@ -13,4 +13,6 @@ typedef struct bus_data *bus_t;
 
 typedef struct bus_device_data *bus_device_t;
 
-typedef struct bus_device_ops_data *bus_device_ops_t;
\ No newline at end of file
+typedef struct bus_device_ops_data *bus_device_ops_t;
+
+typedef struct scheduler_data *scheduler_t;
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include <utime.h>
 #include <time.h>
 
@@ -8,13 +10,11 @@
 #include <SDL2/SDL.h>
 #endif
 
-#include "apu.h"
-#include "cpu.h"
-#include "bus.h"
-#include "ppu.h"
-#include "ram_device.h"
-#include "mapper.h"
-#include <sched.h>
+#include "audio_ring.h"
+#include "nes_system.h"
+#include "nes_movie.h"
+#include "rewind_buffer.h"
+#include "nes_host.h"
 
 // NES Memory Map
 /*
@@ -36,7 +36,7 @@ static char const  * const s_test_rom_files[] = {
     "test_roms/palette_ram.nes", //OK
     "test_roms/af.nes", // ?
     "test_roms/Castlevania.nes", // unsupported mapper
-    "test_roms/punchout.nes", // unsupported mapper
+    "test_roms/punchout.nes", // MMC2
     "test_roms/t2.nes", // unsupported mapper
     "test_roms/paperboy.nes", // unsupported mapper
     "test_roms/solstice.nes", // unsupported mapper
@@ -52,17 +52,172 @@ static char const  * const s_test_rom_files[] = {
     "test_roms/all_instrs.nes", // Passes all tests
 };
 
-#define NES_FRAME_WIDTH 256
-#define NES_FRAME_HEIGHT 240
+#define NES_FRAME_WIDTH NES_SYSTEM_FRAME_WIDTH
+#define NES_FRAME_HEIGHT NES_SYSTEM_FRAME_HEIGHT
 #define NES_FRAME_BORDER 3
 #define NES_SCALE_FACTOR 3
 
-static void ppu_frame_render(ppu_rgb_color_t a_frame, void *a_context)
+// Battery RAM lives in a shared file mapping and is written back by the kernel on its own. This additionally
+// schedules a write back every few seconds to bound what a power loss can take, 0 disables it.
+#define NES_BATTERY_SYNC_INTERVAL_FRAMES 300 // 5 seconds
+
+#define NES_AUDIO_SAMPLE_RATE 44100
+#define NES_AUDIO_DEVICE_SAMPLES 512 // Samples per audio callback, about 12 ms
+#define NES_AUDIO_RING_SAMPLES 2048  // Samples the emulation may run ahead of the audio device, about 46 ms
+#define NES_AUDIO_REPORT_INTERVAL_FRAMES 300
+
+// With audio sync the emulation is paced by the audio device clock instead of the wall clock. The ring is kept near
+// the target fill by waiting for the device to drain it, and the resampling ratio is nudged by up to the maximum
+// deviation so the APU produces what the device actually consumes. The pitch change stays inaudible.
+#define NES_AUDIO_TARGET_FILL_SAMPLES 1024 // About 23 ms
+#define NES_AUDIO_FRAME_SAMPLES_MAX 1024   // Room needed above the target for the samples of one frame
+#define NES_AUDIO_MAX_RATE_DEVIATION 0.005
+
+// Rewind history, held Backspace steps back one snapshot per frame
+#define NES_REWIND_BUDGET_MIB 16 // Several minutes at one snapshot per frame
+#define NES_REWIND_INTERVAL_FRAMES 1
+#define NES_REWIND_REPORT_INTERVAL_FRAMES 600
+
+// Run-ahead shows the frame a few frames after the real one, emulated with the current input and thrown away. Most
+// games react to input a frame or two late, showing their future takes that lag out at the cost of emulating the
+// extra frames on top of every real one.
+#define NES_RUNAHEAD_MAX_FRAMES 8
+#define NES_RUNAHEAD_REPORT_INTERVAL_FRAMES 600
+
+typedef struct frontend_data
 {
 #ifndef __emerixx__
+    SDL_Renderer *renderer;
+#endif
+    nes_system_t system;
+    audio_ring_t audio_ring; // nullptr when audio is off
+    uint32_t audio_underruns;
+    uint32_t audio_overruns;
+    bool audio_sync;
+    uint32_t audio_sample_rate;     // Rate of the audio device
+    uint32_t audio_resample_rate;   // Rate the APU currently generates, the device rate adjusted for the fill level
+    uint32_t audio_target_fill;     // Fill level the emulation waits for
+    uint32_t audio_reference_fill;  // Fill level the rate control steers to
+    uint64_t audio_fill_sum;        // Fill levels and rates seen since the last report
+    uint64_t audio_resample_rate_sum;
+    rewind_buffer_t rewind;  // nullptr when rewind is off
+    uint8_t *rewind_state;
+    size_t rewind_state_size;
+    uint32_t runahead_frames; // 0 when run-ahead is off
+    uint8_t *runahead_state;
+    size_t runahead_state_size;
+    uint64_t runahead_ns;     // Time spent on run-ahead since the last report
+    nes_movie_t movie;        // nullptr when not recording
+    uint64_t *movie_hashes;   // nes_system_state_hash after each frame of the movie, for its hash log
+    uint32_t movie_hash_capacity;
+    uint32_t frame_count;
+    bool quit;                // The window was closed
+} *frontend_t;
+
+// Build the save file path by replacing the extension of the ROM path with .sav
+static void save_path_from_rom_path(char *a_save_path, size_t a_size, const char *a_rom_path)
+{
+    const char *ext = strrchr(a_rom_path, '.');
+    const char *slash = strrchr(a_rom_path, '/');
+    int stem_length = (ext && (!slash || ext > slash)) ? (int)(ext - a_rom_path) : (int)strlen(a_rom_path);
+
+    snprintf(a_save_path, a_size, "%.*s.sav", stem_length, a_rom_path);
+}
+
+#ifndef __emerixx__
+// Runs on the SDL audio thread
+static void audio_callback(void *a_context, Uint8 *a_stream, int a_length)
+{
+    audio_ring_read((audio_ring_t)a_context, (int16_t *)a_stream, a_length / sizeof(int16_t));
+}
+#endif
+
+// Adjust the resampling ratio to the fill level. Below the target the APU generates a bit more per frame than the
+// device plays in the same time and the ring fills up, above the target a bit less.
+static void frontend_audio_rate_control(frontend_t a_frontend, size_t a_fill)
+{
+    double deviation = ((double)a_frontend->audio_reference_fill - (double)a_fill) / a_frontend->audio_reference_fill;
+
+    if (deviation > 1.0)
+    {
+        deviation = 1.0;
+    }
+    else if (deviation < -1.0)
+    {
+        deviation = -1.0;
+    }
+
+    uint32_t rate = (uint32_t)lround(a_frontend->audio_sample_rate * (1.0 + NES_AUDIO_MAX_RATE_DEVIATION * deviation));
+
+    if (rate != a_frontend->audio_resample_rate)
+    {
+        nes_system_set_sample_rate(a_frontend->system, rate);
+        a_frontend->audio_resample_rate = rate;
+    }
+
+    a_frontend->audio_fill_sum += a_fill;
+    a_frontend->audio_resample_rate_sum += rate;
+}
+
+// Move the samples of the last frame from the APU to the audio ring
+static void frontend_audio_push(frontend_t a_frontend)
+{
+    int16_t samples[1024];
+    size_t count;
+
+    if (a_frontend->audio_sync)
+    {
+        // The level just before the push, after the device drained the ring while the frame was emulated
+        frontend_audio_rate_control(a_frontend, audio_ring_fill(a_frontend->audio_ring));
+    }
+
+    while ((count = nes_system_read_samples(a_frontend->system, samples, sizeof(samples) / sizeof(samples[0]))) > 0)
+    {
+        if (a_frontend->audio_ring)
+        {
+            audio_ring_write(a_frontend->audio_ring, samples, count);
+        }
+    }
+
+    if (a_frontend->audio_ring && (a_frontend->frame_count % NES_AUDIO_REPORT_INTERVAL_FRAMES) == 0)
+    {
+        uint32_t underruns = audio_ring_underruns(a_frontend->audio_ring);
+        uint32_t overruns = audio_ring_overruns(a_frontend->audio_ring);
+
+        if (underruns != a_frontend->audio_underruns || overruns != a_frontend->audio_overruns)
+        {
+            fprintf(stderr, "Audio: %u underruns, %u overruns\n", underruns, overruns);
+            a_frontend->audio_underruns = underruns;
+            a_frontend->audio_overruns = overruns;
+        }
+
+        if (a_frontend->audio_sync)
+        {
+            fprintf(stderr, "Audio: average fill %u samples (target %u), ratio %.4f\n",
+                    (uint32_t)(a_frontend->audio_fill_sum / NES_AUDIO_REPORT_INTERVAL_FRAMES),
+                    a_frontend->audio_target_fill,
+                    (double)a_frontend->audio_resample_rate_sum / NES_AUDIO_REPORT_INTERVAL_FRAMES / a_frontend->audio_sample_rate);
+            a_frontend->audio_fill_sum = 0;
+            a_frontend->audio_resample_rate_sum = 0;
+        }
+    }
+
+    if (a_frontend->audio_sync)
+    {
+        // Wait for the device to drain the ring back to the target, this is what paces the emulation
+        while (audio_ring_fill(a_frontend->audio_ring) > a_frontend->audio_target_fill)
+        {
+            struct timespec ts_sleep = { .tv_sec = 0, .tv_nsec = 1000000 };
+            nanosleep(&ts_sleep, NULL);
+        }
+    }
+}
 
-    // Cast the context to SDL_Renderer
-    SDL_Renderer *renderer = (SDL_Renderer *)a_context;
+#ifndef __emerixx__
+// Draw a composed frame, NES_FRAME_WIDTH x NES_FRAME_HEIGHT pixels of 8-bit R, G and B
+static void frontend_render(frontend_t a_frontend, const uint8_t *a_frame)
+{
+    SDL_Renderer *renderer = a_frontend->renderer;
 
     // Draw a red rectangle around the NES frame with a thickness of 3 pixels
     SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255); // Set color to red
@@ -80,8 +235,8 @@ static void ppu_frame_render(ppu_rgb_color_t a_frame, void *a_context)
         for (int x = 0; x < NES_FRAME_WIDTH; x++)
         {
             // Set the color for this pixel
-            ppu_rgb_color_t pixel = &a_frame[(y * NES_FRAME_WIDTH) + x];
-            SDL_SetRenderDrawColor(renderer, pixel->r, pixel->g, pixel->b, 255);
+            const uint8_t *pixel = &a_frame[((y * NES_FRAME_WIDTH) + x) * 3];
+            SDL_SetRenderDrawColor(renderer, pixel[0], pixel[1], pixel[2], 255);
             // Draw a scaled rectangle for each pixel
             SDL_Rect rect = {(x * NES_SCALE_FACTOR) + (NES_FRAME_BORDER * NES_SCALE_FACTOR),
                              (y * NES_SCALE_FACTOR) + (NES_FRAME_BORDER * NES_SCALE_FACTOR),
@@ -102,18 +257,224 @@ static void ppu_frame_render(ppu_rgb_color_t a_frame, void *a_context)
     {
         if (event.type == SDL_QUIT)
         {
-            // Handle quit event if needed
-            // You could set a flag to signal the emulator to shut down
+            a_frontend->quit = true;
         }
     }
+}
+
+// Joypad 1 from the keyboard
+static uint8_t frontend_joypad()
+{
+    const Uint8 *state = SDL_GetKeyboardState(NULL);
+    uint8_t buttons = 0;
+
+    buttons |= state[SDL_SCANCODE_S] ? NES_BUTTON_SELECT : 0;
+    buttons |= state[SDL_SCANCODE_RETURN] ? NES_BUTTON_START : 0;
+    buttons |= state[SDL_SCANCODE_UP] ? NES_BUTTON_UP : 0;
+    buttons |= state[SDL_SCANCODE_DOWN] ? NES_BUTTON_DOWN : 0;
+    buttons |= state[SDL_SCANCODE_LEFT] ? NES_BUTTON_LEFT : 0;
+    buttons |= state[SDL_SCANCODE_RIGHT] ? NES_BUTTON_RIGHT : 0;
+    buttons |= state[SDL_SCANCODE_Z] ? NES_BUTTON_A : 0;
+    buttons |= state[SDL_SCANCODE_X] ? NES_BUTTON_B : 0;
+
+    return buttons;
+}
+
+// Runs after a real frame, which was not composed. Emulates the frames ahead muted with the input as it is now and
+// goes back to the real frame. The frame buffer is not part of the state, it keeps the last frame run ahead.
+static void frontend_run_ahead(frontend_t a_frontend)
+{
+    nes_system_t system = a_frontend->system;
+    uint64_t start = nes_host_now_ns();
+
+    nes_system_state_save(system, a_frontend->runahead_state, a_frontend->runahead_state_size);
+
+    nes_system_set_muted(system, true);
+
+    for (uint32_t i = 1; i <= a_frontend->runahead_frames; i++)
+    {
+        nes_system_set_output(system, i == a_frontend->runahead_frames ? NES_SYSTEM_OUTPUT_RGB : NES_SYSTEM_OUTPUT_NONE);
+        nes_system_step_frame(system);
+    }
+
+    nes_system_state_load(system, a_frontend->runahead_state, a_frontend->runahead_state_size);
+
+    nes_system_set_output(system, NES_SYSTEM_OUTPUT_NONE);
+    nes_system_set_muted(system, false);
+
+    a_frontend->runahead_ns += nes_host_now_ns() - start;
+
+    if ((a_frontend->frame_count % NES_RUNAHEAD_REPORT_INTERVAL_FRAMES) == 0)
+    {
+        fprintf(stderr, "Run-ahead: %u frames, %.2f ms extra per frame\n",
+                a_frontend->runahead_frames,
+                (double)a_frontend->runahead_ns / NES_RUNAHEAD_REPORT_INTERVAL_FRAMES / 1000000.0);
+        a_frontend->runahead_ns = 0;
+    }
+}
+
+// Runs between frames, states can only be taken and loaded there
+static void frontend_rewind(frontend_t a_frontend)
+{
+    const Uint8 *keys = SDL_GetKeyboardState(NULL);
+
+    if (keys[SDL_SCANCODE_BACKSPACE])
+    {
+        if (rewind_buffer_step_back(a_frontend->rewind, a_frontend->rewind_state))
+        {
+            nes_system_state_load(a_frontend->system, a_frontend->rewind_state, a_frontend->rewind_state_size);
+        }
+    }
+    else
+    {
+        nes_system_state_save(a_frontend->system, a_frontend->rewind_state, a_frontend->rewind_state_size);
+        rewind_buffer_push(a_frontend->rewind, a_frontend->rewind_state);
+    }
+
+    if ((a_frontend->frame_count % NES_REWIND_REPORT_INTERVAL_FRAMES) == 0)
+    {
+        struct rewind_buffer_stats_data stats;
+        rewind_buffer_stats(a_frontend->rewind, &stats);
+
+        fprintf(stderr, "Rewind: %u snapshots, %zu KiB, %.1f:1 compression, %.2f us per snapshot\n",
+                stats.m_snapshots,
+                stats.m_bytes_used / 1024,
+                stats.m_bytes_used ? (double)stats.m_bytes_raw / stats.m_bytes_used : 0.0,
+                stats.m_push_count ? (double)stats.m_push_ns / stats.m_push_count / 1000.0 : 0.0);
+    }
+}
+
+// Runs after every real frame
+static void frontend_frame(frontend_t a_frontend)
+{
+    a_frontend->frame_count++;
+
+    frontend_audio_push(a_frontend);
+
+#if NES_BATTERY_SYNC_INTERVAL_FRAMES
+    if ((a_frontend->frame_count % NES_BATTERY_SYNC_INTERVAL_FRAMES) == 0)
+    {
+        nes_system_sync(a_frontend->system);
+    }
+#endif
+
+    if (a_frontend->rewind)
+    {
+        frontend_rewind(a_frontend);
+    }
+
+    // Only the frames run ahead are shown
+    if (a_frontend->runahead_frames)
+    {
+        frontend_run_ahead(a_frontend);
+    }
+
+    frontend_render(a_frontend, nes_system_frame_buffer(a_frontend->system));
+}
 #endif
+
+static void usage(const char *a_program)
+{
+    fprintf(stderr, "Usage: %s [-n] [-s] [-b samples] [-l samples] [-t samples] [-r MiB] [-w frames] [-a frames] [-m movie]\n", a_program);
+    fprintf(stderr, "  -n          Disable audio output\n");
+    fprintf(stderr, "  -b samples  Audio device buffer size (default %d)\n", NES_AUDIO_DEVICE_SAMPLES);
+    fprintf(stderr, "  -l samples  Audio ring size, bounds the added latency (default %d)\n", NES_AUDIO_RING_SAMPLES);
+    fprintf(stderr, "  -s          Pace the emulation by the audio device instead of the wall clock and vsync\n");
+    fprintf(stderr, "  -t samples  Audio ring fill kept by -s (default %d)\n", NES_AUDIO_TARGET_FILL_SAMPLES);
+    fprintf(stderr, "  -r MiB      Rewind history budget, 0 disables rewind (default %d)\n", NES_REWIND_BUDGET_MIB);
+    fprintf(stderr, "  -w frames   Frames between rewind snapshots (default %d)\n", NES_REWIND_INTERVAL_FRAMES);
+    fprintf(stderr, "  -a frames   Run ahead this many frames to hide input lag, up to %d (default 0)\n", NES_RUNAHEAD_MAX_FRAMES);
+    fprintf(stderr, "  -m movie    Record the input to this movie file, saved when the window is closed with a hash log\n");
+    fprintf(stderr, "              next to it (movie.hashes). Turns rewind off and starts without the save file.\n");
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     setvbuf(stdout, NULL, _IONBF, 0); // Disable buffering for stdout
+
+    bool audio_enabled = true;
+    bool audio_sync = false;
+    int audio_device_samples = NES_AUDIO_DEVICE_SAMPLES;
+    int audio_ring_samples = NES_AUDIO_RING_SAMPLES;
+    int audio_target_samples = NES_AUDIO_TARGET_FILL_SAMPLES;
+    int rewind_budget_mib = NES_REWIND_BUDGET_MIB;
+    int rewind_interval = NES_REWIND_INTERVAL_FRAMES;
+    int runahead_frames = 0;
+    const char *movie_path = nullptr;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "nsb:l:t:r:w:a:m:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            audio_enabled = false;
+            break;
+        case 'b':
+            audio_device_samples = atoi(optarg);
+            break;
+        case 'l':
+            audio_ring_samples = atoi(optarg);
+            break;
+        case 's':
+            audio_sync = true;
+            break;
+        case 't':
+            audio_target_samples = atoi(optarg);
+            break;
+        case 'r':
+            rewind_budget_mib = atoi(optarg);
+            break;
+        case 'w':
+            rewind_interval = atoi(optarg);
+            break;
+        case 'a':
+            runahead_frames = atoi(optarg);
+            break;
+        case 'm':
+            movie_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (audio_device_samples <= 0 || audio_device_samples > 0x8000 || audio_ring_samples < audio_device_samples)
+    {
+        fprintf(stderr, "The audio ring must be at least as large as the device buffer\n");
+        return 1;
+    }
+
+    if (audio_sync && (audio_target_samples < audio_device_samples ||
+                       audio_target_samples + NES_AUDIO_FRAME_SAMPLES_MAX > audio_ring_samples))
+    {
+        fprintf(stderr, "The audio sync target must hold a device buffer and leave room for a frame in the ring\n");
+        return 1;
+    }
+
+    if (rewind_budget_mib < 0 || rewind_interval <= 0)
+    {
+        fprintf(stderr, "Invalid rewind settings\n");
+        return 1;
+    }
+
+    if (runahead_frames < 0 || runahead_frames > NES_RUNAHEAD_MAX_FRAMES)
+    {
+        fprintf(stderr, "Run-ahead must be between 0 and %d frames\n", NES_RUNAHEAD_MAX_FRAMES);
+        return 1;
+    }
+
+    audio_sync = audio_sync && audio_enabled;
+
+    // A movie only goes forward
+    if (movie_path)
+    {
+        rewind_budget_mib = 0;
+    }
+
 #ifndef __emerixx__
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) // Initialize SDL
+    if (SDL_Init(SDL_INIT_VIDEO | (audio_enabled ? SDL_INIT_AUDIO : 0)) != 0) // Initialize SDL
     {
         fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
         return 1;
@@ -138,7 +499,8 @@ int main()
     }
 
     // Create SDL renderer
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
+    // Audio sync paces by the audio device, waiting for vsync on top of that would stall it
+    renderer = SDL_CreateRenderer(window, -1, audio_sync ? 0 : SDL_RENDERER_PRESENTVSYNC);
     if (!renderer)
     {
         fprintf(stderr, "SDL_CreateRenderer Error: %s\n", SDL_GetError());
@@ -147,32 +509,55 @@ int main()
         return 1;
     }
 
-    struct cpu_data cpu;
-    
-    struct bus_data bus;
-        
-    bus.initialize();
-    
-    // Create a 2KB RAM device
-    bus_device_t internal_ram = ram_device_create(0x800);
-    
-    // Attach the internal RAM to the bus at address 0. The first 0x800 will be mirrored at 0x0800, 0x1000, 0x1800
-    bus.attach(internal_ram, 0, 0x2000); 
+    struct frontend_data frontend = {};
+    frontend.renderer = renderer;
+    frontend.system = nes_system_create();
 
-    // Create a PPU device
-    bus_device_t ppu = ppu_device_create();
-    
-    // Attach the PPU to the bus at address 0x2000.
-    // The PPU registers are mirrored every 8 bytes from 0x2000 to 0x3FFF 
-    bus.attach(ppu, 0x2000, 0x2000);
+    SDL_AudioDeviceID audio_device = 0;
 
-    // Attach the APU to the bus at address 0x4000.
-    // The APU registers are mirrored every 8 bytes from 0x4000 to 0x4017. 
-    // We mirror the APU registers to 0x4018-0x4100.
-    bus_device_t apu = apu_device_create();
-    bus.attach(apu, 0x4000, 0x100);
+    if (audio_enabled)
+    {
+        frontend.audio_ring = audio_ring_create(audio_ring_samples);
+
+        SDL_AudioSpec want = {};
+        SDL_AudioSpec have = {};
+        want.freq = NES_AUDIO_SAMPLE_RATE;
+        want.format = AUDIO_S16SYS;
+        want.channels = 1;
+        want.samples = (Uint16)audio_device_samples;
+        want.callback = audio_callback;
+        want.userdata = frontend.audio_ring;
+
+        audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+
+        if (audio_device)
+        {
+            nes_system_set_sample_rate(frontend.system, have.freq);
+            frontend.audio_sync = audio_sync;
+            frontend.audio_sample_rate = have.freq;
+            frontend.audio_resample_rate = have.freq;
+            frontend.audio_target_fill = audio_target_samples;
+            // The device drains the ring a buffer at a time, so just before a push the ring is on average half a
+            // buffer below the level the emulation waited for. Steering to that keeps the ratio centered on 1.
+            int half_buffer = (have.samples < audio_target_samples ? have.samples : audio_target_samples) / 2;
+            frontend.audio_reference_fill = audio_target_samples - half_buffer;
+            // Start the callback, it plays the last sample until the emulation catches up
+            SDL_PauseAudioDevice(audio_device, 0);
+        }
+        else
+        {
+            fprintf(stderr, "SDL_OpenAudioDevice Error: %s, continuing without audio\n", SDL_GetError());
+            audio_ring_destroy(frontend.audio_ring);
+            frontend.audio_ring = nullptr;
+        }
+    }
 
-    struct apu_device_tick_state_data apu_tick_state = {};
+    // Only the frames run ahead are shown
+    if (runahead_frames)
+    {
+        frontend.runahead_frames = runahead_frames;
+        nes_system_set_output(frontend.system, NES_SYSTEM_OUTPUT_NONE);
+    }
     
     // Load the test ROM file
     for (size_t test_idx = 0; test_idx < sizeof(s_test_rom_files) / sizeof(s_test_rom_files[0]); test_idx++)
@@ -193,7 +578,7 @@ int main()
 
         fseek(file, 0, SEEK_SET);
         
-        ines_header_t ines_file = (ines_header_t)malloc(file_size);
+        uint8_t *ines_file = (uint8_t *)malloc(file_size);
 
         if (!ines_file)
         {
@@ -206,91 +591,114 @@ int main()
         
         fclose(file);
 
-        mapper_return_t mapper_ret = mapper_map_ines(ines_file, &bus, ppu);
+        char save_path[256];
+        save_path_from_rom_path(save_path, sizeof(save_path), s_test_rom_files[test_idx]);
 
-        free(ines_file);
+        // The system keeps a copy of the image. A movie is played back from power on with empty battery RAM, record it
+        // the same way and leave the save file alone.
+        nes_system_result_t result = nes_system_load_rom(frontend.system, ines_file, file_size, movie_path ? nullptr : save_path);
 
-        if (mapper_ret != MAPPER_OK)
+        if (movie_path)
         {
-            fprintf(stderr, "Unsupported mapper\n");
-            return 1;
+            frontend.movie = nes_movie_create(nes_movie_hash_rom(ines_file, file_size));
         }
 
-        const uint64_t tick_duration_ns = 1000000000 / 21441960; // Adjusted frequency
+        free(ines_file);
 
-        struct timespec ts_start, ts_end;
+        if (result != NES_SYSTEM_OK)
+        {
+            fprintf(stderr, result == NES_SYSTEM_UNSUPPORTED ? "Unsupported mapper\n" : "Invalid iNES image\n");
+            return 1;
+        }
 
-        cpu.power_on(&bus);
+        if (rewind_budget_mib)
+        {
+            // The state layout is fixed once the cartridge is loaded
+            frontend.rewind_state_size = nes_system_state_size(frontend.system);
+            frontend.rewind_state = (uint8_t *)malloc(frontend.rewind_state_size);
+            frontend.rewind = rewind_buffer_create(frontend.rewind_state_size, (size_t)rewind_budget_mib << 20, rewind_interval);
+        }
 
-        uint32_t nmi = 0;
+        if (runahead_frames)
+        {
+            frontend.runahead_state_size = nes_system_state_size(frontend.system);
+            frontend.runahead_state = (uint8_t *)malloc(frontend.runahead_state_size);
+        }
 
-        // Run the CPU
-        for (unsigned tickcount = 0;; tickcount++)
+        // Paced by vsync or, with audio sync, by the audio device
+        while (!frontend.quit)
         {
-            clock_gettime(CLOCK_MONOTONIC, &ts_start);
-            
-            // PPU divides the master clock by 4
-            if ((tickcount % 4) == 0)
+            struct nes_movie_frame_data input = { { frontend_joypad(), 0 }, 0 };
+
+            if (frontend.movie)
             {
-                ppu_device_tick(ppu, ppu_frame_render, renderer, &nmi);
+                nes_movie_record(frontend.movie, &input);
             }
 
-            
-            // CPU divides the master clock by 12
-            if ((tickcount % 12) == 0)
+            nes_system_set_joypad(frontend.system, 0, input.m_joypad[0]);
+
+            nes_system_step_frame(frontend.system);
+
+            if (frontend.movie)
             {
-                if (nmi)
-                {
-                    cpu.nmi();
-                    nmi = 0;
-                }
-                
-                cpu.tick(&bus);
-                
-                apu_device_tick(apu, &bus, &apu_tick_state);
-                
-                if (apu_tick_state.out.poll_joypad)
-                {
-                    const Uint8 *state = SDL_GetKeyboardState(NULL);
-                    apu_tick_state.in.joypad1.button.select = state[SDL_SCANCODE_S]; // Set joypad 1 to all buttons released
-                    apu_tick_state.in.joypad1.button.start = state[SDL_SCANCODE_RETURN];
-                    apu_tick_state.in.joypad1.button.up = state[SDL_SCANCODE_UP];
-                    apu_tick_state.in.joypad1.button.down = state[SDL_SCANCODE_DOWN];
-                    apu_tick_state.in.joypad1.button.left = state[SDL_SCANCODE_LEFT];
-                    apu_tick_state.in.joypad1.button.right = state[SDL_SCANCODE_RIGHT];
-                    apu_tick_state.in.joypad1.button.a = state[SDL_SCANCODE_Z];
-                    apu_tick_state.in.joypad1.button.b = state[SDL_SCANCODE_X];
-                }
+                uint32_t frame = nes_movie_frame_count(frontend.movie) - 1;
 
-                if (apu_tick_state.out.oam_dma)
+                if (frame == frontend.movie_hash_capacity)
                 {
-                    // Handle OAM DMA transfer
-                    apu_tick_state.out.oam_dma = 0;
-                    // Stall the CPU for 513/514 cycles, the actual "DMA" transfer will be performed in the APU
-                    cpu.stall(cpu.m_tickcount & 1 ? 513 : 514); 
+                    frontend.movie_hash_capacity = frontend.movie_hash_capacity ? frontend.movie_hash_capacity * 2 : 1024;
+                    frontend.movie_hashes = (uint64_t *)realloc(frontend.movie_hashes, frontend.movie_hash_capacity * sizeof(uint64_t));
                 }
 
+                frontend.movie_hashes[frame] = nes_system_state_hash(frontend.system);
             }
 
-            clock_gettime(CLOCK_MONOTONIC, &ts_end);
+            frontend_frame(&frontend);
+        }
 
-            // Simplified elapsed time calculation
-            uint64_t elapsed_ns =  (ts_end.tv_nsec - ts_start.tv_nsec);
+        // Closing the window ends the session
+        break;
+    }
 
-            // Sleep for the remaining time to maintain the tick duration
-            if (elapsed_ns < tick_duration_ns)
-            {
-                struct timespec ts_sleep = {
-                    .tv_sec = 0,
-                    .tv_nsec = (long)(tick_duration_ns - elapsed_ns)
-                };
-                // Sleep for the remaining time
-                // nanosleep(&ts_sleep, NULL);
-                sched_yield();
-            }
+    if (frontend.movie)
+    {
+        char hash_log_path[4096];
+
+        if (!nes_movie_save(frontend.movie, movie_path))
+        {
+            fprintf(stderr, "Failed to save the movie %s\n", movie_path);
         }
+
+        snprintf(hash_log_path, sizeof(hash_log_path), "%s.hashes", movie_path);
+
+        if (!nes_movie_save_hash_log(hash_log_path, nes_movie_rom_hash(frontend.movie), frontend.movie_hashes, nes_movie_frame_count(frontend.movie)))
+        {
+            fprintf(stderr, "Failed to save the hash log %s\n", hash_log_path);
+        }
+
+        free(frontend.movie_hashes);
+        nes_movie_destroy(frontend.movie);
     }
 
+    nes_system_destroy(frontend.system);
+
+    if (audio_device)
+    {
+        SDL_CloseAudioDevice(audio_device);
+    }
+
+    if (frontend.audio_ring)
+    {
+        audio_ring_destroy(frontend.audio_ring);
+    }
+
+    if (frontend.rewind)
+    {
+        rewind_buffer_destroy(frontend.rewind);
+        free(frontend.rewind_state);
+    }
+
+    free(frontend.runahead_state);
+
     if (renderer)
     {
         // Destroy SDL renderer
@@ -1,6 +1,10 @@
+#include <stdio.h>
+#include <string.h>
+
 #define MAPPER_IMPL
 #include "mapper.h"
 #include "hw_types.h"
+#include "ram_device.h"
 
 static mapper_return_t (*s_mapper_probe[])(ines_header_t) = 
 {
@@ -9,7 +13,7 @@ MAPPERS
 #undef X
 };
 
-static mapper_return_t (*s_mapper_map[])(ines_header_t, bus_t, bus_device_t) = 
+static mapper_return_t (*s_mapper_map[])(ines_header_t, bus_t, bus_device_t, const char *) = 
 {
 #define X(name, id) name##_map_ines,
 MAPPERS
@@ -30,7 +34,41 @@ MAPPERS
 #undef X
 };
 
-mapper_return_t mapper_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu)
+bus_device_t mapper_prg_ram_create(ines_header_t a_ines_hdr, const char *a_save_path)
+{
+    if ((a_ines_hdr->m_flags_6 & INES_FLAG_6_BATTERY_BACKED_RAM) && a_save_path)
+    {
+        bus_device_t prg_ram = ram_device_create_file_backed(0x2000, a_save_path);
+
+        if (prg_ram)
+        {
+            return prg_ram;
+        }
+
+        fprintf(stderr, "Failed to map save file %s, battery RAM will not be persisted\n", a_save_path);
+    }
+
+    return ram_device_create(0x2000);
+}
+
+size_t mapper_ines_size(const void *a_image, size_t a_size)
+{
+    ines_header_t hdr = (ines_header_t)a_image;
+
+    if (a_size < sizeof(struct ines_header_data) || memcmp(hdr->m_magic, "NES\x1A", 4) != 0)
+    {
+        return 0;
+    }
+
+    size_t size = sizeof(struct ines_header_data) +
+                  ((hdr->m_flags_6 & INES_FLAG_6_TRAINER) ? 512 : 0) +
+                  (hdr->m_prg_rom_size * 0x4000) +
+                  (hdr->m_chr_rom_size * 0x2000);
+
+    return (a_size < size) ? 0 : size;
+}
+
+mapper_return_t mapper_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu, const char *a_save_path)
 {
     if (a_ines_hdr->m_magic[0] != 'N' || a_ines_hdr->m_magic[1] != 'E' || a_ines_hdr->m_magic[2] != 'S' || a_ines_hdr->m_magic[3] != 0x1A)
     {
@@ -51,7 +89,7 @@ mapper_return_t mapper_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_devic
         // Check if the mapper is supported
         if (s_mapper_probe[i](a_ines_hdr) == MAPPER_OK)
         {
-            retval = s_mapper_map[i](a_ines_hdr, a_bus, a_ppu);
+            retval = s_mapper_map[i](a_ines_hdr, a_bus, a_ppu, a_save_path);
             break;
         }
     }
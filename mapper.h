@@ -1,4 +1,6 @@
 #pragma once
+#include <stddef.h>
+
 #include "hw_types.h"
 
 typedef struct ines_header_data *ines_header_t;
@@ -11,7 +13,12 @@ typedef enum mapper_return
         MAPPER_INES_VALUE_INVALID = -3,
 } mapper_return_t;
 
-mapper_return_t mapper_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu);
+// a_save_path is where battery-backed PRG RAM is persisted, nullptr keeps it in memory only. ROM is read from the
+// image in place, it has to stay unchanged and outlive the mapped devices.
+mapper_return_t mapper_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu, const char *a_save_path);
+
+// Size of the iNES image at a_image from its header, 0 if it is not an iNES image or a_size is too short to hold it
+size_t mapper_ines_size(const void *a_image, size_t a_size);
 
 #ifdef MAPPER_IMPL
 
@@ -42,13 +49,18 @@ struct ines_header_data
 #define MAPPERS    \
         X(NROM, 0) \
         X(MMC1, 1) \
+        X(MMC2, 9) \
+        X(MMC4, 10) \
 
 #define X(name, id) mapper_return_t name##_probe_ines(ines_header_t a_ines_hdr);
 MAPPERS
 #undef X
 
-#define X(name, id) mapper_return_t name##_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu);
+#define X(name, id) mapper_return_t name##_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu, const char *a_save_path);
 MAPPERS
 #undef X
 
+// Create the 8 KiB PRG RAM device, file backed when the header has the battery flag set and a save path is given
+bus_device_t mapper_prg_ram_create(ines_header_t a_ines_hdr, const char *a_save_path);
+
 #endif
@@ -10,7 +10,7 @@
 
 #define PRG_ROM_DEVICE_TO_MMC1(p) ((mmc1_t)(((char *)p) - offsetof(struct mmc1_data, m_prg_rom_device)))
 #define PPU_CHR_DEVICE_TO_MMC1(p) ((mmc1_t)(((char *)p) - offsetof(struct mmc1_data, m_ppu_chr_device)))
-#define MEMORY_BANK(sz) { uint8_t at[sz * 1024]; }
+#define MMC1_CHR_RAM_SIZE 0x2000
 
 /*
 +-------------------+-------------------------------+------------------------------------------------------------------------------------------------------------------+
@@ -54,12 +54,21 @@ typedef struct mmc1_data
     struct bus_device_data m_ppu_chr_device;
 
     bus_device_t m_prg_ram; // 8 KiB of PRG RAM
-    
-    struct MEMORY_BANK(16) m_prg_rom[16]; // 256 KiB of PRG ROM (16x16K)
-    struct MEMORY_BANK(4)  m_chr_ram[32]; // 128 KiB of CHR RAM (32x4K)
-    
+    bus_device_t m_ppu;     // Caught up before the CHR banks change, it may run behind the CPU
+
+    // ROM is read in place from the cartridge image, which is shared by every machine it is mapped into
+    const uint8_t *m_prg_rom;
+    const uint8_t *m_chr_rom;
+    uint8_t m_chr_ram[MMC1_CHR_RAM_SIZE];
+
+    const uint8_t *m_prg_window[2]; // 16 KiB windows at $8000 and $C000
+    const uint8_t *m_chr_window[2]; // 4 KiB windows at PPU $0000 and $1000
+
     uint8_t m_prg_rom_16k_banks;
+    uint16_t m_chr_4k_banks;
+    uint8_t m_chr_is_ram; // No CHR ROM, the pattern tables are m_chr_ram, which is part of the state
 
+    // The registers from here to m_prg_bank_register are saved as one block
     union 
     {
         struct 
@@ -97,42 +106,55 @@ typedef struct mmc1_data
 
 } *mmc1_t;
 
-static uint8_t mmc1_prg_rom_read8(bus_device_t a_dev, uint16_t a_addr)
+// 4 KiB CHR bank at PPU $0000 (a_table 0) or $1000 (a_table 1), before wrapping around the CHR size
+static uint8_t mmc1_chr_bank(mmc1_t a_mmc1, int a_table)
 {
-    mmc1_t mmc1 = PRG_ROM_DEVICE_TO_MMC1(a_dev);
+    if (a_mmc1->m_control_register.chr_rom_bank_mode == 0) // 8 KB mode, low bit ignored
+    {
+        return (a_mmc1->m_chr_bank0_register & ~0x01) + a_table;
+    }
 
-    uint8_t bank = 0;
-    uint16_t mask = 0x3FFF;
+    // 4 KB mode
+    return a_table ? a_mmc1->m_chr_bank1_register : a_mmc1->m_chr_bank0_register;
+}
+
+// Recompute the windows after a register change, banks past the end of the ROM wrap around
+static void mmc1_update_windows(mmc1_t a_mmc1)
+{
+    uint8_t bank = a_mmc1->m_prg_bank_register.prg_bank & 0xF;
+    uint8_t prg_bank[2];
 
-    switch (mmc1->m_control_register.prg_rom_bank_mode & 3)
+    switch (a_mmc1->m_control_register.prg_rom_bank_mode & 3)
     {
         case 0:
-        case 1: // switch 32 KB at $8000
-            bank = (mmc1->m_prg_bank_register.prg_bank & 0xF) & ~0x1;
-            mask = 0x7FFF;
+        case 1: // switch 32 KB at $8000, ignoring the low bit of the bank number
+            prg_bank[0] = bank & ~0x1;
+            prg_bank[1] = (bank & ~0x1) + 1;
         break;
-    
         case 2: // fix first bank at $8000 and switch 16 KB bank at $C000
-            // Switch bank at 0xC000, if below bank is already set to 0
-            if (a_addr >= 0x4000)
-            {
-                bank = mmc1->m_prg_bank_register.prg_bank & 0xF; 
-            }
+            prg_bank[0] = 0;
+            prg_bank[1] = bank;
+        break;
+        default: // fix last bank at $C000 and switch 16 KB bank at $8000
+            prg_bank[0] = bank;
+            prg_bank[1] = a_mmc1->m_prg_rom_16k_banks - 1;
         break;
-        case 3: // fix last bank at $C000 and switch 16 KB bank at $8000    
-            if (a_addr < 0x4000)
-            {
-                bank = mmc1->m_prg_bank_register.prg_bank & 0xF; 
-            }
-            else
-            {
-                bank = mmc1->m_prg_rom_16k_banks - 1;
-            }
     }
 
-    uint8_t retval = mmc1->m_prg_rom[bank].at[a_addr & mask];
+    for (int i = 0; i < 2; i++)
+    {
+        a_mmc1->m_prg_window[i] = a_mmc1->m_prg_rom + ((prg_bank[i] % a_mmc1->m_prg_rom_16k_banks) * 0x4000);
+
+        const uint8_t *chr = a_mmc1->m_chr_is_ram ? a_mmc1->m_chr_ram : a_mmc1->m_chr_rom;
+        a_mmc1->m_chr_window[i] = chr + ((mmc1_chr_bank(a_mmc1, i) % a_mmc1->m_chr_4k_banks) * 0x1000);
+    }
+}
+
+static uint8_t mmc1_prg_rom_read8(bus_device_t a_dev, uint16_t a_addr)
+{
+    mmc1_t mmc1 = PRG_ROM_DEVICE_TO_MMC1(a_dev);
 
-    return retval;
+    return mmc1->m_prg_window[(a_addr >> 14) & 1][a_addr & 0x3FFF];
 }
 
 static void mmc1_prg_rom_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
@@ -141,6 +163,8 @@ static void mmc1_prg_rom_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_v
 
     if (a_value >> 7)
     {
+        ppu_device_sync(mmc1->m_ppu);
+
         // Clear to initial state
         mmc1->m_load_register.raw = 0;
         
@@ -149,7 +173,9 @@ static void mmc1_prg_rom_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_v
 
         // Reset CHR bank registers too
         mmc1->m_chr_bank0_register = 0;
-        mmc1->m_chr_bank1_register = 0;        
+        mmc1->m_chr_bank1_register = 0;
+
+        mmc1_update_windows(mmc1);
         return;
     }
 
@@ -160,6 +186,8 @@ static void mmc1_prg_rom_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_v
         return;
     }
 
+    ppu_device_sync(mmc1->m_ppu);
+
     switch ((a_addr >> 13) & 3)
     {
         case 0: // 0x8000 - 0x9FFF -- Control register
@@ -177,66 +205,94 @@ static void mmc1_prg_rom_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_v
     }
 
     mmc1->m_load_register.raw = 0;
+
+    mmc1_update_windows(mmc1);
 }
 
-static struct bus_device_ops_data s_prg_rom_ops =
+// The mapper state hangs off the PRG ROM device, it is the one on the CPU bus
+static size_t mmc1_registers_size(mmc1_t a_mmc1)
 {
-    .read8 = mmc1_prg_rom_read8,
-    .write8 = mmc1_prg_rom_write8
-};
+    return offsetof(struct mmc1_data, m_prg_bank_register) + sizeof(a_mmc1->m_prg_bank_register) - offsetof(struct mmc1_data, m_load_register);
+}
 
-static uint8_t mmc1_ppu_pt0_read8(bus_device_t a_dev, uint16_t a_addr)
+static size_t mmc1_state_size(bus_device_t a_dev)
 {
-    mmc1_t mmc1 = PPU_CHR_DEVICE_TO_MMC1(a_dev);
+    mmc1_t mmc1 = PRG_ROM_DEVICE_TO_MMC1(a_dev);
 
-    uint8_t retval = 0;
+    return mmc1_registers_size(mmc1) + (mmc1->m_chr_is_ram ? MMC1_CHR_RAM_SIZE : 0);
+}
 
-    if (mmc1->m_control_register.chr_rom_bank_mode == 0) // 8 KB mode
+static void mmc1_state_save(bus_device_t a_dev, uint8_t *a_buffer)
+{
+    mmc1_t mmc1 = PRG_ROM_DEVICE_TO_MMC1(a_dev);
+
+    memcpy(a_buffer, &mmc1->m_load_register, mmc1_registers_size(mmc1));
+
+    if (mmc1->m_chr_is_ram)
     {
-        retval = mmc1->m_chr_ram[mmc1->m_chr_bank0_register & ~0x01].at[a_addr & 0x1FFF];
+        memcpy(a_buffer + mmc1_registers_size(mmc1), mmc1->m_chr_ram, MMC1_CHR_RAM_SIZE);
     }
-    else
+}
+
+static void mmc1_state_load(bus_device_t a_dev, const uint8_t *a_buffer)
+{
+    mmc1_t mmc1 = PRG_ROM_DEVICE_TO_MMC1(a_dev);
+
+    memcpy(&mmc1->m_load_register, a_buffer, mmc1_registers_size(mmc1));
+
+    if (mmc1->m_chr_is_ram)
     {
-        // 4 KB mode
-        if (a_addr < 0x1000)
-        {
-            retval = mmc1->m_chr_ram[mmc1->m_chr_bank0_register].at[a_addr & 0xFFF];
-        }
-        else
-        {
-            retval = mmc1->m_chr_ram[mmc1->m_chr_bank1_register].at[a_addr & 0xFFF];
-        }        
+        memcpy(mmc1->m_chr_ram, a_buffer + mmc1_registers_size(mmc1), MMC1_CHR_RAM_SIZE);
     }
 
-    return retval;
+    mmc1_update_windows(mmc1);
+}
+
+static void mmc1_destroy(bus_device_t a_dev)
+{
+    free(PRG_ROM_DEVICE_TO_MMC1(a_dev));
+}
+
+static struct bus_device_ops_data s_prg_rom_ops =
+{
+    .read8 = mmc1_prg_rom_read8,
+    .write8 = mmc1_prg_rom_write8,
+    .sync = nullptr,
+    .state_size = mmc1_state_size,
+    .state_save = mmc1_state_save,
+    .state_load = mmc1_state_load,
+    .destroy = mmc1_destroy
+};
+
+static uint8_t mmc1_ppu_pt0_read8(bus_device_t a_dev, uint16_t a_addr)
+{
+    mmc1_t mmc1 = PPU_CHR_DEVICE_TO_MMC1(a_dev);
+
+    return mmc1->m_chr_window[(a_addr >> 12) & 1][a_addr & 0xFFF];
 }
 
 static void mmc1_ppu_pt0_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
 {
     mmc1_t mmc1 = PPU_CHR_DEVICE_TO_MMC1(a_dev);
 
-    if (mmc1->m_control_register.chr_rom_bank_mode == 0) // 8 KB mode
+    // CHR ROM can not be written
+    if (mmc1->m_chr_is_ram)
     {
-        // Low bit ignored in 8 KB mode
-        mmc1->m_chr_ram[mmc1->m_chr_bank0_register & ~0x01].at[a_addr & 0x1FFF] = a_value;
+        int table = (a_addr >> 12) & 1;
+
+        mmc1->m_chr_ram[((mmc1_chr_bank(mmc1, table) % mmc1->m_chr_4k_banks) * 0x1000) + (a_addr & 0xFFF)] = a_value;
     }
-    else // 4 KB mode
-    {
-        if (a_addr < 0x1000)
-        {
-            mmc1->m_chr_ram[mmc1->m_chr_bank0_register].at[a_addr & 0xFFF] = a_value;
-        }
-        else
-        {
-            mmc1->m_chr_ram[mmc1->m_chr_bank1_register].at[a_addr & 0xFFF] = a_value;
-        }
-    }    
 }
 
 static struct bus_device_ops_data s_ppu_pt0_ops =
 {
     .read8 = mmc1_ppu_pt0_read8,
-    .write8 = mmc1_ppu_pt0_write8
+    .write8 = mmc1_ppu_pt0_write8,
+    .sync = nullptr,
+    .state_size = nullptr,
+    .state_save = nullptr,
+    .state_load = nullptr,
+    .destroy = nullptr
 };
 
 mapper_return_t MMC1_probe_ines(ines_header_t a_ines_hdr)
@@ -254,7 +310,7 @@ mapper_return_t MMC1_probe_ines(ines_header_t a_ines_hdr)
     return MAPPER_OK;
 }
 
-mapper_return_t MMC1_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu)
+mapper_return_t MMC1_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu, const char *a_save_path)
 {
     uint8_t *ines_file = (uint8_t *)&a_ines_hdr[1];
 
@@ -268,19 +324,20 @@ mapper_return_t MMC1_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_
 
     *mmc1 = {};
 
-    mmc1->m_control_register.prg_rom_bank_mode = 3; // Fix last bank at $C000 and switch 16 KB bank at $8000
+    mmc1->m_ppu = a_ppu;
 
-    memset(&mmc1->m_prg_rom, 0xF2, sizeof(mmc1->m_prg_rom)); // Fill with 0xF2, which is a JAM instruction(Good for debugging)
+    mmc1->m_control_register.prg_rom_bank_mode = 3; // Fix last bank at $C000 and switch 16 KB bank at $8000
 
     // Create a PRG RAM device, they are usually  2 or 4 KiB and are mirrored to fill the entire 8 KiB range. We just create a 8 KiB device, no mirroring
-    mmc1->m_prg_ram = ram_device_create(0x2000);
+    // With the battery flag set the RAM is backed by the save file
+    mmc1->m_prg_ram = mapper_prg_ram_create(a_ines_hdr, a_save_path);
     
     // Map the PRG RAM to the bus at 0x6000
     a_bus->attach(mmc1->m_prg_ram, 0x6000, 0x2000);
 
     mmc1->m_prg_rom_16k_banks = a_ines_hdr->m_prg_rom_size;
     size_t prg_rom_size_in_bytes = mmc1->m_prg_rom_16k_banks * 0x4000;
-    memcpy(&mmc1->m_prg_rom, ines_file, prg_rom_size_in_bytes);
+    mmc1->m_prg_rom = ines_file;
 
     // Create a PRG ROM device and map over the whole 32 KiB range
     mmc1->m_prg_rom_device = {};
@@ -289,8 +346,16 @@ mapper_return_t MMC1_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_
 
     if (a_ines_hdr->m_chr_rom_size > 0)
     {
-        memcpy(&mmc1->m_chr_ram, ines_file + prg_rom_size_in_bytes, (a_ines_hdr->m_chr_rom_size * 0x2000));
+        mmc1->m_chr_rom = ines_file + prg_rom_size_in_bytes;
+        mmc1->m_chr_4k_banks = a_ines_hdr->m_chr_rom_size * 2;
     }
+    else
+    {
+        mmc1->m_chr_is_ram = 1;
+        mmc1->m_chr_4k_banks = MMC1_CHR_RAM_SIZE / 0x1000;
+    }
+
+    mmc1_update_windows(mmc1);
 
     mmc1->m_ppu_chr_device = {};
     mmc1->m_ppu_chr_device.m_ops = &s_ppu_pt0_ops;
@@ -0,0 +1,362 @@
+#include <malloc.h>
+#include <string.h>
+#include <stddef.h>
+
+#define MAPPER_IMPL
+#include "ram_device.h"
+#include "bus.h"
+#include "ppu.h"
+#include "mapper.h"
+
+#define PRG_ROM_DEVICE_TO_MMC2(p) ((mmc2_t)(((char *)p) - offsetof(struct mmc2_data, m_prg_rom_device)))
+#define PPU_CHR_DEVICE_TO_MMC2(p) ((mmc2_t)(((char *)p) - offsetof(struct mmc2_data, m_ppu_chr_device)))
+#define PPU_NAMETABLE_DEVICE_TO_MMC2(p) ((mmc2_t)(((char *)p) - offsetof(struct mmc2_data, m_ppu_nametable_device)))
+
+#define MMC2_LATCH_FD 0
+#define MMC2_LATCH_FE 1
+
+/*
+MMC2 (mapper 9, Punch-Out!!) and MMC4 (mapper 10, Fire Emblem) only differ in the PRG ROM banking and in which
+pattern fetches flip the CHR latches, so they share this file.
+
++-------------------+-------------------------------+------------------------------------------------------------------------------------------------------------------+
+| Address Range     | Description                   | Notes                                                                                                            |
++-------------------+-------------------------------+------------------------------------------------------------------------------------------------------------------+
+| CPU $6000-$7FFF   | PRG RAM                       | MMC4 only, 8 KiB, usually battery-backed                                                                         |
++-------------------+-------------------------------+------------------------------------------------------------------------------------------------------------------+
+| CPU $8000-$FFFF   | PRG ROM                       | MMC2: 8 KiB switchable bank at $8000, the last three 8 KiB banks are fixed at $A000-$FFFF                        |
+|                   |                               | MMC4: 16 KiB switchable bank at $8000, the last 16 KiB bank is fixed at $C000-$FFFF                              |
++-------------------+-------------------------------+------------------------------------------------------------------------------------------------------------------+
+| CPU $A000-$AFFF   | PRG bank select               | Write only, selects the bank at $8000                                                                            |
+| CPU $B000-$BFFF   | CHR bank 0 FD                 | 4 KiB CHR bank at PPU $0000 when latch 0 = $FD                                                                   |
+| CPU $C000-$CFFF   | CHR bank 0 FE                 | 4 KiB CHR bank at PPU $0000 when latch 0 = $FE                                                                   |
+| CPU $D000-$DFFF   | CHR bank 1 FD                 | 4 KiB CHR bank at PPU $1000 when latch 1 = $FD                                                                   |
+| CPU $E000-$EFFF   | CHR bank 1 FE                 | 4 KiB CHR bank at PPU $1000 when latch 1 = $FE                                                                   |
+| CPU $F000-$FFFF   | Mirroring                     | 0: vertical, 1: horizontal                                                                                       |
++-------------------+-------------------------------+------------------------------------------------------------------------------------------------------------------+
+| PPU $0000-$0FFF   | CHR ROM                       | Latch 0 is set to $FD/$FE after the PPU fetches $0FD8/$0FE8 (MMC2) or $0FD8-$0FDF/$0FE8-$0FEF (MMC4)             |
+| PPU $1000-$1FFF   | CHR ROM                       | Latch 1 is set to $FD/$FE after the PPU fetches $1FD8-$1FDF/$1FE8-$1FEF                                          |
++-------------------+-------------------------------+------------------------------------------------------------------------------------------------------------------+
+| PPU $2000-$2FFF   | Nametables                    | 2 KiB of VRAM, mirroring selected by $F000                                                                       |
++-------------------+-------------------------------+------------------------------------------------------------------------------------------------------------------+
+
+The latches are driven by the PPU fetch hook. The PPU only calls it for tiles $FD-$FE, so the rendering loop does not
+pay for the latch logic. Reads go through the m_chr_window pointers which are recomputed whenever a latch or a CHR bank
+register changes.
+*/
+
+typedef struct mmc2_data
+{
+    struct bus_device_data m_prg_rom_device;
+    struct bus_device_data m_ppu_chr_device;
+    struct bus_device_data m_ppu_nametable_device;
+
+    bus_device_t m_prg_ram; // 8 KiB of PRG RAM (MMC4 only)
+    bus_device_t m_ppu;     // Caught up before the CHR banks or the mirroring change, it may run behind the CPU
+
+    // ROM is read in place from the cartridge image, which is shared by every machine it is mapped into
+    const uint8_t *m_prg_rom;
+    const uint8_t *m_chr_rom;
+    uint8_t m_vram[0x800]; // 2 KiB nametable RAM
+
+    const uint8_t *m_prg_window[4]; // 8 KiB windows at $8000, $A000, $C000 and $E000
+    const uint8_t *m_chr_window[2]; // 4 KiB windows at PPU $0000 and $1000
+
+    uint8_t m_is_mmc4;
+    uint8_t m_prg_rom_8k_banks;
+    uint8_t m_chr_rom_4k_banks;
+
+    // The registers from here to m_mirroring are saved as one block
+    uint8_t m_prg_bank_register; // $A000-$AFFF
+    uint8_t m_chr_bank_register[2][2]; // [pattern table][latch], $B000-$EFFF
+    uint8_t m_latch[2]; // MMC2_LATCH_FD or MMC2_LATCH_FE, one per pattern table
+    uint8_t m_mirroring; // $F000-$FFFF, 0: vertical, 1: horizontal
+} *mmc2_t;
+
+static void mmc2_update_prg_windows(mmc2_t a_mmc2)
+{
+    uint8_t last = a_mmc2->m_prg_rom_8k_banks - 1;
+
+    if (a_mmc2->m_is_mmc4)
+    {
+        uint8_t bank = (a_mmc2->m_prg_bank_register << 1) % a_mmc2->m_prg_rom_8k_banks;
+        a_mmc2->m_prg_window[0] = a_mmc2->m_prg_rom + (bank * 0x2000);
+        a_mmc2->m_prg_window[1] = a_mmc2->m_prg_rom + ((bank + 1) * 0x2000);
+        a_mmc2->m_prg_window[2] = a_mmc2->m_prg_rom + ((last - 1) * 0x2000);
+        a_mmc2->m_prg_window[3] = a_mmc2->m_prg_rom + (last * 0x2000);
+    }
+    else
+    {
+        a_mmc2->m_prg_window[0] = a_mmc2->m_prg_rom + ((a_mmc2->m_prg_bank_register % a_mmc2->m_prg_rom_8k_banks) * 0x2000);
+        a_mmc2->m_prg_window[1] = a_mmc2->m_prg_rom + ((last - 2) * 0x2000);
+        a_mmc2->m_prg_window[2] = a_mmc2->m_prg_rom + ((last - 1) * 0x2000);
+        a_mmc2->m_prg_window[3] = a_mmc2->m_prg_rom + (last * 0x2000);
+    }
+}
+
+static void mmc2_update_chr_windows(mmc2_t a_mmc2)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        uint8_t bank = a_mmc2->m_chr_bank_register[i][a_mmc2->m_latch[i]] % a_mmc2->m_chr_rom_4k_banks;
+        a_mmc2->m_chr_window[i] = a_mmc2->m_chr_rom + (bank * 0x1000);
+    }
+}
+
+static void mmc2_ppu_fetch_hook(void *a_context, uint16_t a_addr)
+{
+    mmc2_t mmc2 = (mmc2_t)a_context;
+
+    // The hook is only registered for tiles $FD-$FE, bit 4 of the address (tile bit 0) tells them apart
+    uint8_t table = (a_addr >> 12) & 1;
+    uint8_t latch = (a_addr & 0x0010) ? MMC2_LATCH_FD : MMC2_LATCH_FE;
+
+    // MMC2 latch 0 only reacts to the first row of the tile, $0FD8 and $0FE8
+    if (table == 0 && !mmc2->m_is_mmc4 && (a_addr & 0x7) != 0)
+    {
+        return;
+    }
+
+    if (mmc2->m_latch[table] != latch)
+    {
+        mmc2->m_latch[table] = latch;
+        mmc2_update_chr_windows(mmc2);
+    }
+}
+
+static uint8_t mmc2_prg_rom_read8(bus_device_t a_dev, uint16_t a_addr)
+{
+    mmc2_t mmc2 = PRG_ROM_DEVICE_TO_MMC2(a_dev);
+
+    return mmc2->m_prg_window[(a_addr >> 13) & 3][a_addr & 0x1FFF];
+}
+
+static void mmc2_prg_rom_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
+{
+    mmc2_t mmc2 = PRG_ROM_DEVICE_TO_MMC2(a_dev);
+
+    ppu_device_sync(mmc2->m_ppu);
+
+    switch ((a_addr >> 12) & 7)
+    {
+        case 2: // 0xA000 - 0xAFFF -- PRG bank select
+            mmc2->m_prg_bank_register = a_value & 0x0F;
+            mmc2_update_prg_windows(mmc2);
+        break;
+        case 3: // 0xB000 - 0xBFFF -- CHR bank 0, latch FD
+            mmc2->m_chr_bank_register[0][MMC2_LATCH_FD] = a_value & 0x1F;
+            mmc2_update_chr_windows(mmc2);
+        break;
+        case 4: // 0xC000 - 0xCFFF -- CHR bank 0, latch FE
+            mmc2->m_chr_bank_register[0][MMC2_LATCH_FE] = a_value & 0x1F;
+            mmc2_update_chr_windows(mmc2);
+        break;
+        case 5: // 0xD000 - 0xDFFF -- CHR bank 1, latch FD
+            mmc2->m_chr_bank_register[1][MMC2_LATCH_FD] = a_value & 0x1F;
+            mmc2_update_chr_windows(mmc2);
+        break;
+        case 6: // 0xE000 - 0xEFFF -- CHR bank 1, latch FE
+            mmc2->m_chr_bank_register[1][MMC2_LATCH_FE] = a_value & 0x1F;
+            mmc2_update_chr_windows(mmc2);
+        break;
+        case 7: // 0xF000 - 0xFFFF -- Mirroring
+            mmc2->m_mirroring = a_value & 0x01;
+        break;
+        default: // 0x8000 - 0x9FFF -- ROM, no register
+        break;
+    }
+}
+
+#define MMC2_REGISTERS_SIZE (offsetof(struct mmc2_data, m_mirroring) + 1 - offsetof(struct mmc2_data, m_prg_bank_register))
+
+// The mapper state hangs off the PRG ROM device, it is the one on the CPU bus
+static size_t mmc2_state_size(bus_device_t a_dev)
+{
+    return sizeof(((mmc2_t)nullptr)->m_vram) + MMC2_REGISTERS_SIZE;
+}
+
+static void mmc2_state_save(bus_device_t a_dev, uint8_t *a_buffer)
+{
+    mmc2_t mmc2 = PRG_ROM_DEVICE_TO_MMC2(a_dev);
+
+    memcpy(a_buffer, mmc2->m_vram, sizeof(mmc2->m_vram));
+    memcpy(a_buffer + sizeof(mmc2->m_vram), &mmc2->m_prg_bank_register, MMC2_REGISTERS_SIZE);
+}
+
+static void mmc2_state_load(bus_device_t a_dev, const uint8_t *a_buffer)
+{
+    mmc2_t mmc2 = PRG_ROM_DEVICE_TO_MMC2(a_dev);
+
+    memcpy(mmc2->m_vram, a_buffer, sizeof(mmc2->m_vram));
+    memcpy(&mmc2->m_prg_bank_register, a_buffer + sizeof(mmc2->m_vram), MMC2_REGISTERS_SIZE);
+
+    mmc2_update_prg_windows(mmc2);
+    mmc2_update_chr_windows(mmc2);
+}
+
+static void mmc2_destroy(bus_device_t a_dev)
+{
+    free(PRG_ROM_DEVICE_TO_MMC2(a_dev));
+}
+
+static struct bus_device_ops_data s_prg_rom_ops =
+{
+    .read8 = mmc2_prg_rom_read8,
+    .write8 = mmc2_prg_rom_write8,
+    .sync = nullptr,
+    .state_size = mmc2_state_size,
+    .state_save = mmc2_state_save,
+    .state_load = mmc2_state_load,
+    .destroy = mmc2_destroy
+};
+
+static uint8_t mmc2_ppu_chr_read8(bus_device_t a_dev, uint16_t a_addr)
+{
+    mmc2_t mmc2 = PPU_CHR_DEVICE_TO_MMC2(a_dev);
+
+    return mmc2->m_chr_window[(a_addr >> 12) & 1][a_addr & 0xFFF];
+}
+
+static void mmc2_ppu_chr_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
+{
+    // CHR ROM, writes are ignored
+}
+
+static struct bus_device_ops_data s_ppu_chr_ops =
+{
+    .read8 = mmc2_ppu_chr_read8,
+    .write8 = mmc2_ppu_chr_write8,
+    .sync = nullptr,
+    .state_size = nullptr,
+    .state_save = nullptr,
+    .state_load = nullptr,
+    .destroy = nullptr
+};
+
+static uint16_t mmc2_nametable_offset(mmc2_t a_mmc2, uint16_t a_addr)
+{
+    // Vertical mirroring uses PPU A10 to select the nametable, horizontal mirroring uses PPU A11
+    uint16_t nametable = a_mmc2->m_mirroring ? ((a_addr >> 11) & 1) : ((a_addr >> 10) & 1);
+
+    return (nametable << 10) | (a_addr & 0x3FF);
+}
+
+static uint8_t mmc2_ppu_nametable_read8(bus_device_t a_dev, uint16_t a_addr)
+{
+    mmc2_t mmc2 = PPU_NAMETABLE_DEVICE_TO_MMC2(a_dev);
+
+    return mmc2->m_vram[mmc2_nametable_offset(mmc2, a_addr)];
+}
+
+static void mmc2_ppu_nametable_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
+{
+    mmc2_t mmc2 = PPU_NAMETABLE_DEVICE_TO_MMC2(a_dev);
+
+    mmc2->m_vram[mmc2_nametable_offset(mmc2, a_addr)] = a_value;
+}
+
+static struct bus_device_ops_data s_ppu_nametable_ops =
+{
+    .read8 = mmc2_ppu_nametable_read8,
+    .write8 = mmc2_ppu_nametable_write8,
+    .sync = nullptr,
+    .state_size = nullptr,
+    .state_save = nullptr,
+    .state_load = nullptr,
+    .destroy = nullptr
+};
+
+static mapper_return_t mmc2_probe_ines(ines_header_t a_ines_hdr)
+{
+    // PRG ROM size is in 16 KiB units, MMC2/MMC4 can address at most 256 KiB
+    if ((a_ines_hdr->m_prg_rom_size < 2) || (a_ines_hdr->m_prg_rom_size > 16))
+    {
+        return MAPPER_INES_VALUE_INVALID;
+    }
+
+    // CHR ROM size is in 8 KiB units, at most 128 KiB. Both mappers need CHR ROM to bank switch
+    if ((a_ines_hdr->m_chr_rom_size == 0) || (a_ines_hdr->m_chr_rom_size > 16))
+    {
+        return MAPPER_INES_VALUE_INVALID;
+    }
+
+    return MAPPER_OK;
+}
+
+static mapper_return_t mmc2_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu, const char *a_save_path, uint8_t a_is_mmc4)
+{
+    uint8_t *ines_file = (uint8_t *)&a_ines_hdr[1];
+
+    // If there is a trainer, skip 512 bytes
+    if (a_ines_hdr->m_flags_6 & INES_FLAG_6_TRAINER)
+    {
+        ines_file += 512;
+    }
+
+    mmc2_t mmc2 = (mmc2_t)malloc(sizeof(struct mmc2_data));
+
+    *mmc2 = {};
+
+    mmc2->m_is_mmc4 = a_is_mmc4;
+    mmc2->m_ppu = a_ppu;
+
+    mmc2->m_prg_rom_8k_banks = a_ines_hdr->m_prg_rom_size * 2;
+    size_t prg_rom_size_in_bytes = a_ines_hdr->m_prg_rom_size * 0x4000;
+    mmc2->m_prg_rom = ines_file;
+
+    mmc2->m_chr_rom_4k_banks = a_ines_hdr->m_chr_rom_size * 2;
+    mmc2->m_chr_rom = ines_file + prg_rom_size_in_bytes;
+
+    // Both latches start at $FE
+    mmc2->m_latch[0] = MMC2_LATCH_FE;
+    mmc2->m_latch[1] = MMC2_LATCH_FE;
+
+    mmc2->m_mirroring = (a_ines_hdr->m_flags_6 & INES_FLAG_6_MIRRORING_VERTICAL) ? 0 : 1;
+
+    mmc2_update_prg_windows(mmc2);
+    mmc2_update_chr_windows(mmc2);
+
+    if (a_is_mmc4)
+    {
+        // Create a 8 KiB PRG RAM device and map it to the bus at 0x6000
+        mmc2->m_prg_ram = mapper_prg_ram_create(a_ines_hdr, a_save_path);
+        a_bus->attach(mmc2->m_prg_ram, 0x6000, 0x2000);
+    }
+
+    // Create a PRG ROM device and map over the whole 32 KiB range, the registers are write only
+    mmc2->m_prg_rom_device = {};
+    mmc2->m_prg_rom_device.m_ops = &s_prg_rom_ops;
+    a_bus->attach(&mmc2->m_prg_rom_device, 0x8000, 0x8000);
+
+    mmc2->m_ppu_chr_device = {};
+    mmc2->m_ppu_chr_device.m_ops = &s_ppu_chr_ops;
+    ppu_device_attach(a_ppu, &mmc2->m_ppu_chr_device, 0x0000, 0x2000);
+
+    mmc2->m_ppu_nametable_device = {};
+    mmc2->m_ppu_nametable_device.m_ops = &s_ppu_nametable_ops;
+    ppu_device_attach(a_ppu, &mmc2->m_ppu_nametable_device, 0x2000, 0x1000);
+
+    ppu_device_set_fetch_hook(a_ppu, 0xFD, 0xFE, mmc2_ppu_fetch_hook, mmc2);
+
+    return MAPPER_OK;
+}
+
+mapper_return_t MMC2_probe_ines(ines_header_t a_ines_hdr)
+{
+    return mmc2_probe_ines(a_ines_hdr);
+}
+
+mapper_return_t MMC2_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu, const char *a_save_path)
+{
+    return mmc2_map_ines(a_ines_hdr, a_bus, a_ppu, a_save_path, 0);
+}
+
+mapper_return_t MMC4_probe_ines(ines_header_t a_ines_hdr)
+{
+    return mmc2_probe_ines(a_ines_hdr);
+}
+
+mapper_return_t MMC4_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu, const char *a_save_path)
+{
+    return mmc2_map_ines(a_ines_hdr, a_bus, a_ppu, a_save_path, 1);
+}
@@ -47,7 +47,7 @@ mapper_return_t NROM_probe_ines(ines_header_t a_ines_hdr)
     return MAPPER_OK;
 }
 
-mapper_return_t NROM_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu)
+mapper_return_t NROM_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_t a_ppu, const char *a_save_path)
 {
     uint8_t *ines_file = (uint8_t *)&a_ines_hdr[1];
 
@@ -61,32 +61,26 @@ mapper_return_t NROM_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_
 
     // Create a PRG RAM device, they are usually  2 or 4 KiB and are mirrored to fill the entire 8 KiB range
     // We just create a 8 KiB device
-    bus_device_t prg_ram = ram_device_create(0x2000);
+    bus_device_t prg_ram = mapper_prg_ram_create(a_ines_hdr, a_save_path);
 
     // Map the PRG RAM to the bus at 0x6000
     a_bus->attach(prg_ram, 0x6000, 0x2000);
 
-    // Create a PRG ROM device for the first 16 KiB of the PRG ROM
-    bus_device_t prg_rom_0 = ram_device_create(0x4000);
+    // Create a PRG ROM device for the first 16 KiB of the PRG ROM, it reads the cartridge image in place
+    bus_device_t prg_rom_0 = ram_device_create_rom(ines_file, 0x4000);
 
     // Attach the PRG ROM to the bus at address 0x8000
     a_bus->attach(prg_rom_0, 0x8000, 0x4000);
 
-    // Copy the first 16 KiB of the PRG ROM to the PRG ROM device
-    ram_device_write_buffer(prg_rom_0, 0, ines_file, 0x4000);
-
     if (a_ines_hdr->m_prg_rom_size > 1)
     {
         // NROM-256
 
         // Create a PRG ROM device for the second 16 KiB of the PRG ROM
-        bus_device_t prg_rom_1 = ram_device_create(0x4000);
+        bus_device_t prg_rom_1 = ram_device_create_rom(ines_file + 0x4000, 0x4000);
 
         // Attach the PRG ROM to the bus at address 0xA000
         a_bus->attach(prg_rom_1, 0xC000, 0x4000);
-
-        // Copy the second 16 KiB of the PRG ROM to the PRG ROM device
-        ram_device_write_buffer(prg_rom_1, 0, ines_file + 0x4000, 0x4000);
     }
     else
     {
@@ -99,30 +93,16 @@ mapper_return_t NROM_map_ines(ines_header_t a_ines_hdr, bus_t a_bus, bus_device_
     size_t chr_rom_size_in_bytes = a_ines_hdr->m_chr_rom_size * 0x2000;
 
     uint8_t *chr_rom = ines_file + prg_rom_size_in_bytes;
-    
-    // Create a CHR ROM device for pattern table 0
-    bus_device_t chr_rom_pattern_table_0 = ram_device_create(0x1000);
 
-    // Attach the CHR ROM to the bus at address 0x0000
-    ppu_device_attach(a_ppu, chr_rom_pattern_table_0, 0x0000, 0x1000);
-
-    if (chr_rom_size_in_bytes > 0)
+    // One device per pattern table, CHR ROM or, without CHR ROM, 8 KiB of CHR RAM instead
+    for (int i = 0; i < 2; i++)
     {
-        // Copy the first 4 KiB of the CHR ROM to the CHR ROM device
-        ram_device_write_buffer(chr_rom_pattern_table_0, 0, chr_rom, 0x1000);
-    }
-
-    // Create a CHR ROM device for pattern table 1
-    bus_device_t chr_rom_pattern_table_1 = ram_device_create(0x1000);
-
-    // Attach the CHR ROM to the bus at address 0x1000
-    ppu_device_attach(a_ppu, chr_rom_pattern_table_1, 0x1000, 0x1000);
+        bus_device_t pattern_table = (chr_rom_size_in_bytes > 0) ? ram_device_create_rom(chr_rom + (i * 0x1000), 0x1000) : ram_device_create(0x1000);
 
-    if (chr_rom_size_in_bytes > 0)
-    {
-        // Copy the last 4 KiB of the CHR ROM to the CHR ROM device
-        ram_device_write_buffer(chr_rom_pattern_table_1, 0, chr_rom + 0x1000, 0x1000);
+        // Attach the pattern table to the bus at address 0x0000 or 0x1000
+        ppu_device_attach(a_ppu, pattern_table, i * 0x1000, 0x1000);
     }
+
     // Create the 2 nametable devices
     /*
           (0,0)     (256,0)     (511,0)
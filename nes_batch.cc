@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "nes_batch.h"
+#include "nes_runner.h"
+
+typedef struct nes_batch_data
+{
+    // Constant after creation
+    nes_system_t *m_instances;
+    size_t m_count;
+    nes_batch_observation_t m_observation;
+    size_t m_luma_size;
+    struct nes_batch_reward_data *m_rewards;
+    size_t m_reward_count;
+    uint8_t *m_reward_values; // m_reward_count values per instance, read at the start of a step
+    std::thread *m_threads;
+    uint32_t m_thread_count; // Started by the batch, the caller's thread works too
+
+    // The step in progress, written by the caller before the generation is bumped
+    const uint8_t *m_actions;
+    uint32_t m_frames;
+    uint8_t *m_observations;
+    float *m_rewards_out;
+
+    std::atomic<size_t> m_next;    // Next instance to step
+    std::atomic<size_t> m_pending; // Instances not finished yet
+
+    std::mutex m_mutex;
+    std::condition_variable m_start; // The generation changed or m_quit is set
+    std::condition_variable m_done;  // m_pending dropped to 0
+    uint64_t m_generation;
+    bool m_quit;
+} *nes_batch_t;
+
+size_t nes_batch_observation_size(nes_batch_t a_batch)
+{
+    switch (a_batch->m_observation)
+    {
+    case NES_BATCH_OBSERVATION_PIXELS:
+        return NES_SYSTEM_FRAME_WIDTH * NES_SYSTEM_FRAME_HEIGHT;
+    case NES_BATCH_OBSERVATION_RAM:
+        return NES_SYSTEM_RAM_SIZE;
+    case NES_BATCH_OBSERVATION_LUMA:
+        return a_batch->m_luma_size;
+    default:
+        return 0;
+    }
+}
+
+static void nes_batch_step_instance(nes_batch_t a_batch, size_t a_index)
+{
+    nes_system_t system = a_batch->m_instances[a_index];
+    uint8_t *observation = a_batch->m_observations ? a_batch->m_observations + (a_index * nes_batch_observation_size(a_batch)) : nullptr;
+    uint8_t *values = a_batch->m_reward_values + (a_index * a_batch->m_reward_count);
+    bool pixels = (a_batch->m_observation == NES_BATCH_OBSERVATION_PIXELS || a_batch->m_observation == NES_BATCH_OBSERVATION_LUMA) && observation;
+    nes_system_output_t output = (a_batch->m_observation == NES_BATCH_OBSERVATION_LUMA) ? NES_SYSTEM_OUTPUT_LUMA : NES_SYSTEM_OUTPUT_INDEX;
+
+    nes_system_set_joypad(system, 0, a_batch->m_actions ? a_batch->m_actions[a_index] : 0);
+
+    for (size_t i = 0; i < a_batch->m_reward_count; i++)
+    {
+        values[i] = nes_system_peek(system, a_batch->m_rewards[i].m_address);
+    }
+
+    // The PPU composes the last frame straight into the observation
+    nes_system_set_output_buffer(system, pixels ? observation : nullptr);
+
+    for (uint32_t frame = 1; frame <= a_batch->m_frames; frame++)
+    {
+        nes_system_set_output(system, (pixels && frame == a_batch->m_frames) ? output : NES_SYSTEM_OUTPUT_NONE);
+        nes_system_step_frame(system);
+    }
+
+    nes_system_set_output_buffer(system, nullptr);
+
+    if (a_batch->m_observation == NES_BATCH_OBSERVATION_RAM && observation)
+    {
+        nes_system_read_ram(system, observation);
+    }
+
+    if (a_batch->m_rewards_out)
+    {
+        float reward = 0.0f;
+
+        for (size_t i = 0; i < a_batch->m_reward_count; i++)
+        {
+            reward += a_batch->m_rewards[i].m_scale * ((int)nes_system_peek(system, a_batch->m_rewards[i].m_address) - (int)values[i]);
+        }
+
+        a_batch->m_rewards_out[a_index] = reward;
+    }
+}
+
+// Step instances until none are left. The step parameters are only read after an instance was taken, a worker that
+// wakes up late for a step takes part in the next one or finds nothing left.
+static void nes_batch_work(nes_batch_t a_batch)
+{
+    size_t index;
+
+    while ((index = a_batch->m_next.fetch_add(1, std::memory_order_acq_rel)) < a_batch->m_count)
+    {
+        nes_batch_step_instance(a_batch, index);
+
+        if (a_batch->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard<std::mutex> lock(a_batch->m_mutex);
+            a_batch->m_done.notify_one();
+        }
+    }
+}
+
+static void nes_batch_worker(nes_batch_t a_batch, int a_cpu)
+{
+    if (a_cpu >= 0)
+    {
+        nes_runner_pin_thread(a_cpu);
+    }
+
+    uint64_t generation = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(a_batch->m_mutex);
+            a_batch->m_start.wait(lock, [&] { return a_batch->m_quit || a_batch->m_generation != generation; });
+
+            if (a_batch->m_quit)
+            {
+                return;
+            }
+
+            generation = a_batch->m_generation;
+        }
+
+        nes_batch_work(a_batch);
+    }
+}
+
+nes_batch_t nes_batch_create(nes_system_t *a_instances, size_t a_count, const struct nes_batch_config_data *a_config)
+{
+    uint16_t luma_width = 0;
+    uint16_t luma_height = 0;
+
+    for (size_t i = 0; i < a_count && a_config->m_observation == NES_BATCH_OBSERVATION_LUMA; i++)
+    {
+        if (!nes_system_set_luma_format(a_instances[i], &a_config->m_luma, &luma_width, &luma_height))
+        {
+            return nullptr;
+        }
+    }
+
+    nes_batch_t batch = new nes_batch_data();
+
+    batch->m_luma_size = (size_t)luma_width * luma_height;
+    batch->m_instances = a_instances;
+    batch->m_count = a_count;
+    batch->m_observation = a_config->m_observation;
+    batch->m_reward_count = a_config->m_rewards ? a_config->m_reward_count : 0;
+    batch->m_rewards = (nes_batch_reward_t)malloc((batch->m_reward_count + 1) * sizeof(struct nes_batch_reward_data));
+    batch->m_reward_values = (uint8_t *)malloc((a_count * batch->m_reward_count) + 1);
+
+    if (batch->m_reward_count)
+    {
+        memcpy(batch->m_rewards, a_config->m_rewards, batch->m_reward_count * sizeof(struct nes_batch_reward_data));
+    }
+
+    for (size_t i = 0; i < a_count; i++)
+    {
+        nes_system_set_muted(a_instances[i], true);
+        nes_system_set_output(a_instances[i], NES_SYSTEM_OUTPUT_NONE);
+    }
+
+    int *cpus = (int *)malloc(NES_RUNNER_MAX_THREADS * sizeof(int));
+    uint32_t cpu_count = nes_runner_cpus(cpus, NES_RUNNER_MAX_THREADS);
+    uint32_t threads = nes_runner_thread_count(a_config->m_threads, a_count, cpu_count);
+
+    // The caller's thread is the first worker
+    batch->m_thread_count = threads - 1;
+    batch->m_threads = new std::thread[batch->m_thread_count];
+
+    for (uint32_t i = 0; i < batch->m_thread_count; i++)
+    {
+        int cpu = (a_config->m_pin_threads && cpu_count) ? cpus[(i + 1) % cpu_count] : -1;
+
+        batch->m_threads[i] = std::thread(nes_batch_worker, batch, cpu);
+    }
+
+    free(cpus);
+
+    return batch;
+}
+
+void nes_batch_destroy(nes_batch_t a_batch)
+{
+    {
+        std::lock_guard<std::mutex> lock(a_batch->m_mutex);
+        a_batch->m_quit = true;
+        a_batch->m_start.notify_all();
+    }
+
+    for (uint32_t i = 0; i < a_batch->m_thread_count; i++)
+    {
+        a_batch->m_threads[i].join();
+    }
+
+    delete[] a_batch->m_threads;
+    free(a_batch->m_rewards);
+    free(a_batch->m_reward_values);
+    delete a_batch;
+}
+
+void nes_batch_step(nes_batch_t a_batch, const uint8_t *a_actions, uint32_t a_frames_per_step, uint8_t *a_observations, float *a_rewards)
+{
+    if (a_batch->m_count == 0)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(a_batch->m_mutex);
+
+        a_batch->m_actions = a_actions;
+        a_batch->m_frames = a_frames_per_step;
+        a_batch->m_observations = a_observations;
+        a_batch->m_rewards_out = a_rewards;
+        a_batch->m_pending.store(a_batch->m_count, std::memory_order_relaxed);
+        a_batch->m_next.store(0, std::memory_order_release);
+        a_batch->m_generation++;
+        a_batch->m_start.notify_all();
+    }
+
+    nes_batch_work(a_batch);
+
+    std::unique_lock<std::mutex> lock(a_batch->m_mutex);
+    a_batch->m_done.wait(lock, [&] { return a_batch->m_pending.load(std::memory_order_acquire) == 0; });
+}
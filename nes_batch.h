@@ -0,0 +1,62 @@
+#pragma once
+
+// Steps K machines (see nes_system.h) in lockstep on a pool of worker threads, for reinforcement learning. Every
+// step takes one joypad action per machine, runs the same number of frames on all of them and returns once all are
+// done. Observations land in one contiguous caller buffer of K observations. Pixels are written there by the PPU
+// itself, the last frame of a step is the only one composed.
+//
+// Rewards are the change of RAM values over a step: the sum of m_scale * (value after - value before) over the
+// reward entries. Scores kept as one decimal digit per byte take one entry per digit, scaled 1, 10, 100...
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes_system.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct nes_batch_data *nes_batch_t;
+
+typedef enum nes_batch_observation
+{
+    NES_BATCH_OBSERVATION_NONE,
+    NES_BATCH_OBSERVATION_PIXELS, // [K, NES_SYSTEM_FRAME_HEIGHT, NES_SYSTEM_FRAME_WIDTH] palette indices (0-63)
+    NES_BATCH_OBSERVATION_RAM,    // [K, NES_SYSTEM_RAM_SIZE] bytes of internal RAM
+    NES_BATCH_OBSERVATION_LUMA    // [K, height, width] grayscale in the config's m_luma format
+} nes_batch_observation_t;
+
+typedef struct nes_batch_reward_data
+{
+    uint16_t m_address; // CPU address, see nes_system_peek
+    float m_scale;
+} *nes_batch_reward_t;
+
+typedef struct nes_batch_config_data
+{
+    uint32_t m_threads; // Including the caller's, 0 for one per CPU the process may run on
+    bool m_pin_threads; // Pin the workers the batch starts to those CPUs, the caller's thread is left alone
+    nes_batch_observation_t m_observation;
+    const struct nes_batch_reward_data *m_rewards; // Copied, NULL for no rewards
+    size_t m_reward_count;
+    struct nes_system_luma_format_data m_luma; // For NES_BATCH_OBSERVATION_LUMA, see nes_system_set_luma_format
+} *nes_batch_config_t;
+
+// The batch steps a_instances[0, a_count), which stay owned by the caller and must outlive the batch. It mutes them
+// and sets their output, they must only be used by one step at a time. Returns NULL if m_luma is invalid.
+nes_batch_t nes_batch_create(nes_system_t *a_instances, size_t a_count, const struct nes_batch_config_data *a_config);
+
+void nes_batch_destroy(nes_batch_t a_batch);
+
+// Bytes of one observation, 0 for NES_BATCH_OBSERVATION_NONE
+size_t nes_batch_observation_size(nes_batch_t a_batch);
+
+// Hold a_actions[k] (NES_BUTTON_*) on joypad 1 of instance k for a_frames_per_step frames. a_observations holds
+// K * nes_batch_observation_size bytes, a_rewards K values. Either may be NULL.
+void nes_batch_step(nes_batch_t a_batch, const uint8_t *a_actions, uint32_t a_frames_per_step, uint8_t *a_observations, float *a_rewards);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nes_host.h"
+
+uint64_t nes_host_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint8_t *nes_host_read_file(const char *a_path, size_t *a_size)
+{
+    FILE *file = fopen(a_path, "rb");
+
+    if (!file)
+    {
+        return nullptr;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = (size >= 0) ? (uint8_t *)malloc(size + 1) : nullptr;
+
+    if (!data || fread(data, 1, size, file) != (size_t)size)
+    {
+        free(data);
+        fclose(file);
+        return nullptr;
+    }
+
+    fclose(file);
+    data[size] = 0;
+    *a_size = size;
+
+    return data;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+// Host services the library and the tools share: a clock for timing and reading whole files
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Nanoseconds of CLOCK_MONOTONIC, only differences mean something
+uint64_t nes_host_now_ns(void);
+
+// Read the whole file into memory from malloc, with a zero byte after the contents so text can be parsed in place.
+// The size does not count the zero byte. NULL if the file cannot be read.
+uint8_t *nes_host_read_file(const char *a_path, size_t *a_size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,890 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <thread>
+
+#include "nes_movie.h"
+#include "nes_host.h"
+
+#define NES_MOVIE_HEADER_SIZE 24
+#define NES_MOVIE_FRAME_SIZE 3
+#define NES_MOVIE_KEYFRAME_ENTRY_SIZE 16
+#define NES_MOVIE_FOOTER_SIZE 24
+#define NES_MOVIE_HASH_LOG_HEADER_SIZE 16
+#define NES_MOVIE_MIN_CAPACITY 1024
+#define NES_MOVIE_FNV_OFFSET 0xCBF29CE484222325ull
+#define NES_MOVIE_FNV_PRIME 0x100000001B3ull
+
+// FM2 input log fields: the commands, then one per port
+#define NES_MOVIE_FM2_MAX_FIELDS 4
+#define NES_MOVIE_FM2_GAMEPAD 1 // SI_GAMEPAD in the port0 and port1 header keys
+
+static_assert(sizeof(struct nes_movie_frame_data) == NES_MOVIE_FRAME_SIZE, "Frames are stored as they are");
+
+typedef struct nes_movie_keyframe_data
+{
+    uint64_t m_offset; // Of the state in m_keyframe_data
+    uint32_t m_frame;
+    uint32_t m_size;
+} *nes_movie_keyframe_t;
+
+typedef struct nes_movie_data
+{
+    uint64_t m_rom_hash;
+    struct nes_movie_frame_data *m_frames; // Into m_map until the first frame is recorded
+    uint32_t m_count;
+    uint32_t m_capacity; // 0 while m_frames is in m_map
+
+    // Ordered by frame. The states are in the file mapping or, for keyframes taken by nes_movie_add_keyframes, in
+    // m_keyframe_buffer.
+    struct nes_movie_keyframe_data *m_keyframes;
+    uint32_t m_keyframe_count;
+    uint32_t m_keyframe_interval;
+    const uint8_t *m_keyframe_data;
+    uint8_t *m_keyframe_buffer;
+
+    void *m_map; // The file, nullptr for a movie made in memory
+    size_t m_map_size;
+} *nes_movie_t;
+
+// A nes_movie_verify in progress. Segments are taken in order, the ones after a failure are not run.
+typedef struct nes_movie_verify_data
+{
+    nes_movie_t m_movie;
+    const void *m_ines_image;
+    size_t m_ines_size;
+    int8_t *m_results; // nes_movie_verify_result_t of each segment that ran
+    std::atomic<uint32_t> m_next;
+    std::atomic<uint32_t> m_failure; // The first segment that failed so far
+} *nes_movie_verify_t;
+
+static void nes_movie_put(uint8_t *a_out, uint64_t a_value, int a_bytes)
+{
+    for (int i = 0; i < a_bytes; i++)
+    {
+        a_out[i] = (uint8_t)(a_value >> (i * 8));
+    }
+}
+
+static uint64_t nes_movie_get(const uint8_t *a_in, int a_bytes)
+{
+    uint64_t value = 0;
+
+    for (int i = a_bytes - 1; i >= 0; i--)
+    {
+        value = (value << 8) | a_in[i];
+    }
+
+    return value;
+}
+
+uint64_t nes_movie_hash_rom(const void *a_ines_image, size_t a_size)
+{
+    const uint8_t *image = (const uint8_t *)a_ines_image;
+    uint64_t hash = NES_MOVIE_FNV_OFFSET;
+
+    for (size_t i = 0; i < a_size; i++)
+    {
+        hash = (hash ^ image[i]) * NES_MOVIE_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+nes_movie_t nes_movie_create(uint64_t a_rom_hash)
+{
+    nes_movie_t movie = (nes_movie_t)calloc(1, sizeof(struct nes_movie_data));
+
+    movie->m_rom_hash = a_rom_hash;
+
+    return movie;
+}
+
+static void nes_movie_clear_keyframes(nes_movie_t a_movie)
+{
+    free(a_movie->m_keyframes);
+    free(a_movie->m_keyframe_buffer);
+
+    a_movie->m_keyframes = nullptr;
+    a_movie->m_keyframe_count = 0;
+    a_movie->m_keyframe_interval = 0;
+    a_movie->m_keyframe_data = nullptr;
+    a_movie->m_keyframe_buffer = nullptr;
+}
+
+void nes_movie_destroy(nes_movie_t a_movie)
+{
+    nes_movie_clear_keyframes(a_movie);
+
+    if (a_movie->m_capacity)
+    {
+        free(a_movie->m_frames);
+    }
+
+    if (a_movie->m_map)
+    {
+        munmap(a_movie->m_map, a_movie->m_map_size);
+    }
+
+    free(a_movie);
+}
+
+void nes_movie_record(nes_movie_t a_movie, const struct nes_movie_frame_data *a_frame)
+{
+    // Mapped frames have no capacity
+    if (a_movie->m_count >= a_movie->m_capacity)
+    {
+        uint32_t capacity = a_movie->m_capacity ? a_movie->m_capacity * 2 : NES_MOVIE_MIN_CAPACITY;
+
+        while (capacity <= a_movie->m_count)
+        {
+            capacity *= 2;
+        }
+
+        nes_movie_frame_t frames = (nes_movie_frame_t)malloc(capacity * sizeof(struct nes_movie_frame_data));
+
+        // The frames of a loaded movie are copied out of the file mapping first
+        if (a_movie->m_count)
+        {
+            memcpy(frames, a_movie->m_frames, a_movie->m_count * sizeof(struct nes_movie_frame_data));
+        }
+
+        if (a_movie->m_capacity)
+        {
+            free(a_movie->m_frames);
+        }
+
+        a_movie->m_frames = frames;
+        a_movie->m_capacity = capacity;
+    }
+
+    a_movie->m_frames[a_movie->m_count++] = *a_frame;
+}
+
+// The keyframe index at the end of a mapped file, false if it is cut off or points outside of the file
+static bool nes_movie_map_keyframes(nes_movie_t a_movie)
+{
+    const uint8_t *data = (const uint8_t *)a_movie->m_map;
+    size_t size = a_movie->m_map_size;
+
+    if (size < NES_MOVIE_FOOTER_SIZE)
+    {
+        return false;
+    }
+
+    const uint8_t *footer = data + size - NES_MOVIE_FOOTER_SIZE;
+    uint32_t count = (uint32_t)nes_movie_get(footer + 4, 4);
+    uint64_t index = nes_movie_get(footer + 16, 8);
+
+    if (nes_movie_get(footer, 4) != NES_MOVIE_KEYFRAME_MAGIC ||
+        index > size - NES_MOVIE_FOOTER_SIZE ||
+        (uint64_t)count * NES_MOVIE_KEYFRAME_ENTRY_SIZE > size - NES_MOVIE_FOOTER_SIZE - index)
+    {
+        return false;
+    }
+
+    a_movie->m_keyframes = (nes_movie_keyframe_t)malloc(((size_t)count * sizeof(struct nes_movie_keyframe_data)) + 1);
+    a_movie->m_keyframe_count = count;
+    a_movie->m_keyframe_interval = (uint32_t)nes_movie_get(footer + 8, 4);
+    a_movie->m_keyframe_data = data;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint8_t *entry = data + index + ((size_t)i * NES_MOVIE_KEYFRAME_ENTRY_SIZE);
+        nes_movie_keyframe_t keyframe = &a_movie->m_keyframes[i];
+
+        keyframe->m_offset = nes_movie_get(entry, 8);
+        keyframe->m_frame = (uint32_t)nes_movie_get(entry + 8, 4);
+        keyframe->m_size = (uint32_t)nes_movie_get(entry + 12, 4);
+
+        if (keyframe->m_offset > index || keyframe->m_size > index - keyframe->m_offset ||
+            keyframe->m_frame > a_movie->m_count || (i && keyframe->m_frame <= a_movie->m_keyframes[i - 1].m_frame))
+        {
+            nes_movie_clear_keyframes(a_movie);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+nes_movie_t nes_movie_load(const char *a_path)
+{
+    int fd = open(a_path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size < NES_MOVIE_HEADER_SIZE)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // The mapping keeps its own reference to the file
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    const uint8_t *header = (const uint8_t *)map;
+    uint32_t count = (uint32_t)nes_movie_get(header + 8, 4);
+    uint32_t flags = (uint32_t)nes_movie_get(header + 12, 4);
+
+    if (nes_movie_get(header, 4) != NES_MOVIE_MAGIC ||
+        nes_movie_get(header + 4, 2) != NES_MOVIE_VERSION ||
+        nes_movie_get(header + 6, 2) != NES_MOVIE_FRAME_SIZE ||
+        (uint64_t)count * NES_MOVIE_FRAME_SIZE > (uint64_t)st.st_size - NES_MOVIE_HEADER_SIZE)
+    {
+        munmap(map, st.st_size);
+        return nullptr;
+    }
+
+    nes_movie_t movie = nes_movie_create(nes_movie_get(header + 16, 8));
+
+    movie->m_map = map;
+    movie->m_map_size = st.st_size;
+    movie->m_frames = (nes_movie_frame_t)(header + NES_MOVIE_HEADER_SIZE);
+    movie->m_count = count;
+
+    if ((flags & NES_MOVIE_FLAG_KEYFRAMES) && !nes_movie_map_keyframes(movie))
+    {
+        nes_movie_destroy(movie);
+        return nullptr;
+    }
+
+    return movie;
+}
+
+static bool nes_movie_write(FILE *a_file, uint64_t a_value, int a_bytes)
+{
+    uint8_t bytes[8];
+
+    nes_movie_put(bytes, a_value, a_bytes);
+
+    return fwrite(bytes, a_bytes, 1, a_file) == 1;
+}
+
+bool nes_movie_save(nes_movie_t a_movie, const char *a_path)
+{
+    // Saving over the file the movie is mapped from would pull the frames from under it
+    char path[4096];
+
+    if (snprintf(path, sizeof(path), "%s.tmp", a_path) >= (int)sizeof(path))
+    {
+        return false;
+    }
+
+    FILE *file = fopen(path, "wb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    uint8_t header[NES_MOVIE_HEADER_SIZE] = {};
+
+    nes_movie_put(header, NES_MOVIE_MAGIC, 4);
+    nes_movie_put(header + 4, NES_MOVIE_VERSION, 2);
+    nes_movie_put(header + 6, NES_MOVIE_FRAME_SIZE, 2);
+    nes_movie_put(header + 8, a_movie->m_count, 4);
+    nes_movie_put(header + 12, a_movie->m_keyframe_count ? NES_MOVIE_FLAG_KEYFRAMES : 0, 4);
+    nes_movie_put(header + 16, a_movie->m_rom_hash, 8);
+
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+
+    if (ok && a_movie->m_count)
+    {
+        ok = fwrite(a_movie->m_frames, (size_t)a_movie->m_count * sizeof(struct nes_movie_frame_data), 1, file) == 1;
+    }
+
+    if (a_movie->m_keyframe_count)
+    {
+        uint64_t offset = NES_MOVIE_HEADER_SIZE + ((uint64_t)a_movie->m_count * NES_MOVIE_FRAME_SIZE);
+
+        for (uint32_t i = 0; ok && i < a_movie->m_keyframe_count; i++)
+        {
+            nes_movie_keyframe_t keyframe = &a_movie->m_keyframes[i];
+
+            ok = fwrite(a_movie->m_keyframe_data + keyframe->m_offset, keyframe->m_size, 1, file) == 1;
+        }
+
+        // The index follows the states, the footer points back to it
+        uint64_t index = offset;
+
+        for (uint32_t i = 0; i < a_movie->m_keyframe_count; i++)
+        {
+            index += a_movie->m_keyframes[i].m_size;
+        }
+
+        for (uint32_t i = 0; ok && i < a_movie->m_keyframe_count; i++)
+        {
+            ok = nes_movie_write(file, offset, 8) &&
+                 nes_movie_write(file, a_movie->m_keyframes[i].m_frame, 4) &&
+                 nes_movie_write(file, a_movie->m_keyframes[i].m_size, 4);
+
+            offset += a_movie->m_keyframes[i].m_size;
+        }
+
+        ok = ok &&
+             nes_movie_write(file, NES_MOVIE_KEYFRAME_MAGIC, 4) &&
+             nes_movie_write(file, a_movie->m_keyframe_count, 4) &&
+             nes_movie_write(file, a_movie->m_keyframe_interval, 4) &&
+             nes_movie_write(file, 0, 4) &&
+             nes_movie_write(file, index, 8);
+    }
+
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(path, a_path) != 0)
+    {
+        remove(path);
+        return false;
+    }
+
+    return true;
+}
+
+// The decimal number at the start of a field, the text is not terminated
+static int nes_movie_fm2_number(const char *a_field, size_t a_length)
+{
+    int number = 0;
+
+    for (size_t i = 0; i < a_length && a_field[i] >= '0' && a_field[i] <= '9'; i++)
+    {
+        number = (number * 10) + (a_field[i] - '0');
+    }
+
+    return number;
+}
+
+// A gamepad field is "RLDUTSBA", one character per button in the order of the NES_BUTTON_* bits. '.' and ' ' are
+// released, anything else held.
+static uint8_t nes_movie_fm2_gamepad(const char *a_field, size_t a_length)
+{
+    uint8_t buttons = 0;
+
+    for (size_t i = 0; i < a_length && i < 8; i++)
+    {
+        if (a_field[i] != '.' && a_field[i] != ' ')
+        {
+            buttons |= (uint8_t)(1 << i);
+        }
+    }
+
+    return buttons;
+}
+
+nes_movie_t nes_movie_import_fm2(const char *a_text, size_t a_size)
+{
+    nes_movie_t movie = nes_movie_create(0);
+    int ports[2] = { NES_MOVIE_FM2_GAMEPAD, NES_MOVIE_FM2_GAMEPAD };
+    const char *end = a_text + a_size;
+    const char *line = a_text;
+
+    while (line < end)
+    {
+        const char *line_end = (const char *)memchr(line, '\n', end - line);
+
+        if (!line_end)
+        {
+            line_end = end;
+        }
+
+        size_t length = line_end - line;
+
+        if (length && line[length - 1] == '\r')
+        {
+            length--;
+        }
+
+        if (length && line[0] == '|')
+        {
+            // |commands|port0|port1|port2|
+            const char *fields[NES_MOVIE_FM2_MAX_FIELDS] = {};
+            size_t lengths[NES_MOVIE_FM2_MAX_FIELDS] = {};
+            int field_count = 0;
+            const char *field = line + 1;
+
+            while (field < line + length && field_count < NES_MOVIE_FM2_MAX_FIELDS)
+            {
+                const char *bar = (const char *)memchr(field, '|', (line + length) - field);
+                const char *field_end = bar ? bar : line + length;
+
+                fields[field_count] = field;
+                lengths[field_count] = field_end - field;
+                field_count++;
+
+                field = field_end + 1;
+            }
+
+            struct nes_movie_frame_data frame = {};
+
+            frame.m_commands = (uint8_t)(nes_movie_fm2_number(fields[0], lengths[0]) & (NES_MOVIE_RESET | NES_MOVIE_POWER));
+
+            for (int port = 0; port < 2; port++)
+            {
+                if (ports[port] == NES_MOVIE_FM2_GAMEPAD && port + 1 < field_count)
+                {
+                    frame.m_joypad[port] = nes_movie_fm2_gamepad(fields[port + 1], lengths[port + 1]);
+                }
+            }
+
+            nes_movie_record(movie, &frame);
+        }
+        else if (length)
+        {
+            // Header lines are "key value"
+            char key[32];
+            size_t key_length = 0;
+
+            while (key_length < length && key_length < sizeof(key) - 1 && line[key_length] != ' ')
+            {
+                key[key_length] = line[key_length];
+                key_length++;
+            }
+
+            key[key_length] = '\0';
+
+            int number = (key_length < length) ? nes_movie_fm2_number(line + key_length + 1, length - key_length - 1) : 0;
+
+            if ((strcmp(key, "binary") == 0 && number) || strcmp(key, "savestate") == 0)
+            {
+                nes_movie_destroy(movie);
+                return nullptr;
+            }
+
+            if (strcmp(key, "port0") == 0)
+            {
+                ports[0] = number;
+            }
+            else if (strcmp(key, "port1") == 0)
+            {
+                ports[1] = number;
+            }
+        }
+
+        line = line_end + 1;
+    }
+
+    return movie;
+}
+
+nes_movie_t nes_movie_open(const char *a_path)
+{
+    size_t length = strlen(a_path);
+
+    if (length < 4 || strcmp(a_path + length - 4, ".fm2") != 0)
+    {
+        return nes_movie_load(a_path);
+    }
+
+    size_t size;
+    uint8_t *text = nes_host_read_file(a_path, &size);
+
+    if (!text)
+    {
+        return nullptr;
+    }
+
+    nes_movie_t movie = nes_movie_import_fm2((const char *)text, size);
+
+    free(text);
+
+    return movie;
+}
+
+uint64_t nes_movie_rom_hash(nes_movie_t a_movie)
+{
+    return a_movie->m_rom_hash;
+}
+
+void nes_movie_set_rom_hash(nes_movie_t a_movie, uint64_t a_rom_hash)
+{
+    a_movie->m_rom_hash = a_rom_hash;
+}
+
+uint32_t nes_movie_frame_count(nes_movie_t a_movie)
+{
+    return a_movie->m_count;
+}
+
+const struct nes_movie_frame_data *nes_movie_frame(nes_movie_t a_movie, uint32_t a_frame)
+{
+    return (a_frame < a_movie->m_count) ? &a_movie->m_frames[a_frame] : nullptr;
+}
+
+void nes_movie_apply(nes_movie_t a_movie, uint32_t a_frame, nes_system_t a_system)
+{
+    const struct nes_movie_frame_data *frame = nes_movie_frame(a_movie, a_frame);
+
+    if (!frame)
+    {
+        return;
+    }
+
+    // Power starts over anyway, a reset with it is moot
+    if (frame->m_commands & NES_MOVIE_POWER)
+    {
+        nes_system_power(a_system);
+    }
+    else if (frame->m_commands & NES_MOVIE_RESET)
+    {
+        nes_system_reset(a_system);
+    }
+
+    nes_system_set_joypad(a_system, 0, frame->m_joypad[0]);
+    nes_system_set_joypad(a_system, 1, frame->m_joypad[1]);
+}
+
+uint32_t nes_movie_play(nes_movie_t a_movie, nes_system_t a_system, uint32_t a_first, uint32_t a_count)
+{
+    uint32_t frames = 0;
+
+    for (uint32_t frame = a_first; frame < a_movie->m_count && frames < a_count; frame++, frames++)
+    {
+        nes_movie_apply(a_movie, frame, a_system);
+        nes_system_step_frame(a_system);
+    }
+
+    return frames;
+}
+
+uint32_t nes_movie_play_hashed(nes_movie_t a_movie, nes_system_t a_system, uint32_t a_first, uint32_t a_count, uint64_t *a_hashes)
+{
+    uint32_t frames = 0;
+
+    for (uint32_t frame = a_first; frame < a_movie->m_count && frames < a_count; frame++, frames++)
+    {
+        nes_movie_apply(a_movie, frame, a_system);
+        nes_system_step_frame(a_system);
+
+        a_hashes[frames] = nes_system_state_hash(a_system);
+    }
+
+    return frames;
+}
+
+bool nes_movie_save_hash_log(const char *a_path, uint64_t a_rom_hash, const uint64_t *a_hashes, uint32_t a_count)
+{
+    FILE *file = fopen(a_path, "wb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    bool ok = nes_movie_write(file, NES_MOVIE_HASH_LOG_MAGIC, 4) &&
+              nes_movie_write(file, a_count, 4) &&
+              nes_movie_write(file, a_rom_hash, 8);
+
+    for (uint32_t i = 0; i < a_count && ok; i++)
+    {
+        ok = nes_movie_write(file, a_hashes[i], 8);
+    }
+
+    return (fclose(file) == 0) && ok;
+}
+
+uint64_t *nes_movie_load_hash_log(const char *a_path, uint64_t *a_rom_hash, uint32_t *a_count)
+{
+    FILE *file = fopen(a_path, "rb");
+
+    if (!file)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+    uint8_t header[NES_MOVIE_HASH_LOG_HEADER_SIZE];
+
+    if (fstat(fileno(file), &st) != 0 || fread(header, sizeof(header), 1, file) != 1 ||
+        nes_movie_get(header, 4) != NES_MOVIE_HASH_LOG_MAGIC ||
+        nes_movie_get(header + 4, 4) * sizeof(uint64_t) > (uint64_t)st.st_size - NES_MOVIE_HASH_LOG_HEADER_SIZE)
+    {
+        fclose(file);
+        return nullptr;
+    }
+
+    uint32_t count = (uint32_t)nes_movie_get(header + 4, 4);
+    uint64_t *hashes = (uint64_t *)malloc(((size_t)count * sizeof(uint64_t)) + 1);
+    uint8_t bytes[8];
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (fread(bytes, sizeof(bytes), 1, file) != 1)
+        {
+            free(hashes);
+            fclose(file);
+            return nullptr;
+        }
+
+        hashes[i] = nes_movie_get(bytes, 8);
+    }
+
+    fclose(file);
+
+    *a_rom_hash = nes_movie_get(header + 8, 8);
+    *a_count = count;
+
+    return hashes;
+}
+
+bool nes_movie_add_keyframes(nes_movie_t a_movie, const void *a_ines_image, size_t a_size, uint32_t a_interval)
+{
+    if (a_interval == 0 || (a_movie->m_rom_hash && a_movie->m_rom_hash != nes_movie_hash_rom(a_ines_image, a_size)))
+    {
+        return false;
+    }
+
+    nes_system_t system = nes_system_create();
+
+    nes_system_set_muted(system, true);
+    nes_system_set_output(system, NES_SYSTEM_OUTPUT_NONE);
+
+    if (nes_system_load_rom(system, a_ines_image, a_size, nullptr) != NES_SYSTEM_OK)
+    {
+        nes_system_destroy(system);
+        return false;
+    }
+
+    // Every a_interval frames and at the end, power on needs none
+    uint32_t count = (a_movie->m_count + a_interval - 1) / a_interval;
+    size_t state_size = nes_system_state_size(system);
+
+    nes_movie_clear_keyframes(a_movie);
+
+    a_movie->m_keyframes = (nes_movie_keyframe_t)malloc(((size_t)count * sizeof(struct nes_movie_keyframe_data)) + 1);
+    a_movie->m_keyframe_buffer = (uint8_t *)malloc((count * state_size) + 1);
+    a_movie->m_keyframe_data = a_movie->m_keyframe_buffer;
+    a_movie->m_keyframe_interval = a_interval;
+
+    for (uint32_t frame = 0; frame < a_movie->m_count; frame++)
+    {
+        nes_movie_apply(a_movie, frame, system);
+        nes_system_step_frame(system);
+
+        if (((frame + 1) % a_interval) == 0 || frame + 1 == a_movie->m_count)
+        {
+            nes_movie_keyframe_t keyframe = &a_movie->m_keyframes[a_movie->m_keyframe_count++];
+
+            keyframe->m_offset = (a_movie->m_keyframe_count - 1) * state_size;
+            keyframe->m_frame = frame + 1;
+            keyframe->m_size = (uint32_t)state_size;
+
+            nes_system_state_save(system, a_movie->m_keyframe_buffer + keyframe->m_offset, state_size);
+        }
+    }
+
+    nes_system_destroy(system);
+
+    return true;
+}
+
+uint32_t nes_movie_keyframe_count(nes_movie_t a_movie)
+{
+    return a_movie->m_keyframe_count;
+}
+
+uint32_t nes_movie_keyframe_interval(nes_movie_t a_movie)
+{
+    return a_movie->m_keyframe_interval;
+}
+
+bool nes_movie_keyframe(nes_movie_t a_movie, uint32_t a_index, uint32_t *a_frame, const void **a_state, size_t *a_size)
+{
+    if (a_index >= a_movie->m_keyframe_count)
+    {
+        return false;
+    }
+
+    nes_movie_keyframe_t keyframe = &a_movie->m_keyframes[a_index];
+
+    *a_frame = keyframe->m_frame;
+    *a_state = a_movie->m_keyframe_data + keyframe->m_offset;
+    *a_size = keyframe->m_size;
+
+    return true;
+}
+
+bool nes_movie_seek(nes_movie_t a_movie, nes_system_t a_system, uint32_t a_frame)
+{
+    if (a_frame > a_movie->m_count || nes_system_state_size(a_system) == 0)
+    {
+        return false;
+    }
+
+    // The number of keyframes at or before a_frame, the last of them is the one to start from
+    uint32_t low = 0;
+    uint32_t high = a_movie->m_keyframe_count;
+
+    while (low < high)
+    {
+        uint32_t middle = low + ((high - low) / 2);
+
+        if (a_movie->m_keyframes[middle].m_frame <= a_frame)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    uint32_t start = 0;
+
+    if (low)
+    {
+        nes_movie_keyframe_t keyframe = &a_movie->m_keyframes[low - 1];
+
+        if (!nes_system_state_load(a_system, a_movie->m_keyframe_data + keyframe->m_offset, keyframe->m_size))
+        {
+            return false;
+        }
+
+        start = keyframe->m_frame;
+    }
+    else
+    {
+        nes_system_power(a_system);
+    }
+
+    nes_movie_play(a_movie, a_system, start, a_frame - start);
+
+    return true;
+}
+
+static nes_movie_verify_result_t nes_movie_verify_segment(nes_movie_t a_movie, nes_system_t a_system, uint32_t a_segment, uint8_t *a_state, size_t a_state_size)
+{
+    nes_movie_keyframe_t end = &a_movie->m_keyframes[a_segment];
+    uint32_t start = 0;
+
+    if (a_segment)
+    {
+        nes_movie_keyframe_t keyframe = &a_movie->m_keyframes[a_segment - 1];
+
+        if (!nes_system_state_load(a_system, a_movie->m_keyframe_data + keyframe->m_offset, keyframe->m_size))
+        {
+            return NES_MOVIE_VERIFY_INVALID;
+        }
+
+        start = keyframe->m_frame;
+    }
+    else
+    {
+        nes_system_power(a_system);
+    }
+
+    if (end->m_size != a_state_size)
+    {
+        return NES_MOVIE_VERIFY_INVALID;
+    }
+
+    nes_movie_play(a_movie, a_system, start, end->m_frame - start);
+    nes_system_state_save(a_system, a_state, a_state_size);
+
+    return (memcmp(a_state, a_movie->m_keyframe_data + end->m_offset, a_state_size) == 0) ? NES_MOVIE_VERIFY_OK : NES_MOVIE_VERIFY_DIVERGED;
+}
+
+static void nes_movie_verify_work(nes_movie_verify_t a_verify)
+{
+    nes_system_t system = nes_system_create();
+    uint8_t *state = nullptr;
+    size_t state_size = 0;
+    uint32_t segment;
+
+    nes_system_set_muted(system, true);
+    nes_system_set_output(system, NES_SYSTEM_OUTPUT_NONE);
+
+    if (nes_system_load_rom(system, a_verify->m_ines_image, a_verify->m_ines_size, nullptr) == NES_SYSTEM_OK)
+    {
+        state_size = nes_system_state_size(system);
+        state = (uint8_t *)malloc(state_size);
+    }
+
+    while ((segment = a_verify->m_next.fetch_add(1, std::memory_order_relaxed)) < a_verify->m_movie->m_keyframe_count &&
+           segment < a_verify->m_failure.load(std::memory_order_relaxed))
+    {
+        nes_movie_verify_result_t result = state ? nes_movie_verify_segment(a_verify->m_movie, system, segment, state, state_size) : NES_MOVIE_VERIFY_INVALID;
+
+        a_verify->m_results[segment] = (int8_t)result;
+
+        if (result != NES_MOVIE_VERIFY_OK)
+        {
+            uint32_t failure = a_verify->m_failure.load(std::memory_order_relaxed);
+
+            while (segment < failure && !a_verify->m_failure.compare_exchange_weak(failure, segment, std::memory_order_relaxed))
+            {
+            }
+        }
+    }
+
+    free(state);
+    nes_system_destroy(system);
+}
+
+nes_movie_verify_result_t nes_movie_verify(nes_movie_t a_movie, const void *a_ines_image, size_t a_size, uint32_t a_threads, uint32_t *a_segment)
+{
+    *a_segment = 0;
+
+    if (a_movie->m_keyframe_count == 0 || (a_movie->m_rom_hash && a_movie->m_rom_hash != nes_movie_hash_rom(a_ines_image, a_size)))
+    {
+        return NES_MOVIE_VERIFY_INVALID;
+    }
+
+    nes_movie_verify_t verify = new nes_movie_verify_data();
+
+    verify->m_movie = a_movie;
+    verify->m_ines_image = a_ines_image;
+    verify->m_ines_size = a_size;
+    verify->m_results = (int8_t *)calloc(a_movie->m_keyframe_count, 1);
+    verify->m_next.store(0, std::memory_order_relaxed);
+    verify->m_failure.store(a_movie->m_keyframe_count, std::memory_order_relaxed);
+
+    uint32_t threads = a_threads ? a_threads : std::thread::hardware_concurrency();
+
+    if (threads > a_movie->m_keyframe_count)
+    {
+        threads = a_movie->m_keyframe_count;
+    }
+
+    // The caller's thread is the first worker
+    std::thread *workers = new std::thread[threads ? threads - 1 : 0];
+
+    for (uint32_t i = 0; i + 1 < threads; i++)
+    {
+        workers[i] = std::thread(nes_movie_verify_work, verify);
+    }
+
+    nes_movie_verify_work(verify);
+
+    for (uint32_t i = 0; i + 1 < threads; i++)
+    {
+        workers[i].join();
+    }
+
+    delete[] workers;
+
+    *a_segment = verify->m_failure.load(std::memory_order_relaxed);
+
+    nes_movie_verify_result_t result = (*a_segment < a_movie->m_keyframe_count) ? (nes_movie_verify_result_t)verify->m_results[*a_segment] : NES_MOVIE_VERIFY_OK;
+
+    free(verify->m_results);
+    delete verify;
+
+    return result;
+}
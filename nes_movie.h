@@ -0,0 +1,132 @@
+#pragma once
+
+// Input movies: the joypads and the reset and power buttons of every frame from power on, for runs that can be
+// played back exactly, by later builds too. Emulation is deterministic, a movie played on the cartridge it was
+// recorded on reproduces the run frame by frame.
+//
+// File layout, little endian: a 24-byte header (NES_MOVIE_MAGIC, a uint16_t version, a uint16_t frame size, a
+// uint32_t frame count, uint32_t NES_MOVIE_FLAG_* and the uint64_t hash of the iNES image, see
+// nes_movie_hash_rom), then the frames as nes_movie_frame_data, 3 bytes each.
+//
+// With NES_MOVIE_FLAG_KEYFRAMES the frames are followed by save states (see nes_system_state_save) taken every few
+// frames, then an index of them, 16 bytes per keyframe (the uint64_t file offset of the state, the uint32_t frame it
+// was taken before and the uint32_t state size), and a 24-byte footer at the very end (NES_MOVIE_KEYFRAME_MAGIC, the
+// uint32_t keyframe count, the uint32_t interval, 4 reserved bytes and the uint64_t offset of the index). Movies are
+// mapped, not read, seeking to any frame of a long session restores a keyframe and runs at most the interval.
+// Keyframes are only as portable as save states, the same build on the same kind of host.
+//
+// Hash logs go alongside movies: the nes_system_state_hash after every frame of a run, for finding the first frame
+// two builds disagree on. A 16-byte header (NES_MOVIE_HASH_LOG_MAGIC, the uint32_t frame count and the uint64_t ROM
+// hash), then a uint64_t per frame. The hashes are comparable between builds on the same kind of host.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes_system.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NES_MOVIE_MAGIC 0x564F4D4E // "NMOV"
+#define NES_MOVIE_VERSION 1
+#define NES_MOVIE_KEYFRAME_MAGIC 0x59454B4E // "NKEY"
+#define NES_MOVIE_HASH_LOG_MAGIC 0x4853484E // "NHSH"
+
+#define NES_MOVIE_FLAG_KEYFRAMES 0x01
+
+// Commands of a frame, carried out before the frame runs. The values are the ones of FM2 files.
+#define NES_MOVIE_RESET 0x01 // nes_system_reset
+#define NES_MOVIE_POWER 0x02 // nes_system_power
+
+typedef struct nes_movie_data *nes_movie_t;
+
+typedef enum nes_movie_verify_result
+{
+    NES_MOVIE_VERIFY_OK = 0,
+    NES_MOVIE_VERIFY_DIVERGED = -1, // A segment ended in another state than its keyframe
+    NES_MOVIE_VERIFY_INVALID = -2,  // No keyframes, not the movie's cartridge or a keyframe of another build
+} nes_movie_verify_result_t;
+
+typedef struct nes_movie_frame_data
+{
+    uint8_t m_joypad[2]; // NES_BUTTON_*
+    uint8_t m_commands;  // NES_MOVIE_*
+} *nes_movie_frame_t;
+
+// 64-bit FNV-1a of the iNES image, the cartridge a movie belongs to
+uint64_t nes_movie_hash_rom(const void *a_ines_image, size_t a_size);
+
+// An empty movie for the cartridge with a_rom_hash, 0 if it is not known
+nes_movie_t nes_movie_create(uint64_t a_rom_hash);
+
+void nes_movie_destroy(nes_movie_t a_movie);
+
+// Map the file, NULL if it cannot be or is not a movie. The file must not be changed while the movie is loaded.
+nes_movie_t nes_movie_load(const char *a_path);
+
+// Write the movie with its keyframes to a new file that then replaces a_path, which may be the one it was loaded
+// from
+bool nes_movie_save(nes_movie_t a_movie, const char *a_path);
+
+// Import the input log of an FM2 text movie (FCEUX). Gamepads on the first two ports are kept, other devices read as
+// no buttons held, soft and hard resets become NES_MOVIE_RESET and NES_MOVIE_POWER. FM2 identifies the cartridge by
+// an MD5 that is not checked, the movie has no ROM hash. NULL for binary FM2 and movies that start from a state.
+nes_movie_t nes_movie_import_fm2(const char *a_text, size_t a_size);
+
+// nes_movie_import_fm2 for a path ending in .fm2, nes_movie_load for anything else
+nes_movie_t nes_movie_open(const char *a_path);
+
+uint64_t nes_movie_rom_hash(nes_movie_t a_movie);
+void nes_movie_set_rom_hash(nes_movie_t a_movie, uint64_t a_rom_hash);
+
+uint32_t nes_movie_frame_count(nes_movie_t a_movie);
+
+// NULL past the end
+const struct nes_movie_frame_data *nes_movie_frame(nes_movie_t a_movie, uint32_t a_frame);
+
+// Append a frame
+void nes_movie_record(nes_movie_t a_movie, const struct nes_movie_frame_data *a_frame);
+
+// Carry out the commands of a_frame and set the joypads, the next nes_system_step_frame runs it
+void nes_movie_apply(nes_movie_t a_movie, uint32_t a_frame, nes_system_t a_system);
+
+// Apply and run the frames from a_first on, up to a_count of them and the end of the movie. Returns the frames run.
+uint32_t nes_movie_play(nes_movie_t a_movie, nes_system_t a_system, uint32_t a_first, uint32_t a_count);
+
+// nes_movie_play that stores nes_system_state_hash after each frame in a_hashes
+uint32_t nes_movie_play_hashed(nes_movie_t a_movie, nes_system_t a_system, uint32_t a_first, uint32_t a_count, uint64_t *a_hashes);
+
+bool nes_movie_save_hash_log(const char *a_path, uint64_t a_rom_hash, const uint64_t *a_hashes, uint32_t a_count);
+
+// The hashes of a hash log, to be freed with free(). NULL if the file cannot be read or is not a hash log.
+uint64_t *nes_movie_load_hash_log(const char *a_path, uint64_t *a_rom_hash, uint32_t *a_count);
+
+// Play the movie on the cartridge from power on and take a keyframe every a_interval frames and at the end,
+// replacing the keyframes there were. False if the image does not match the movie's ROM hash or is not supported.
+bool nes_movie_add_keyframes(nes_movie_t a_movie, const void *a_ines_image, size_t a_size, uint32_t a_interval);
+
+uint32_t nes_movie_keyframe_count(nes_movie_t a_movie);
+
+// The frames between keyframes the movie was saved with, 0 without keyframes
+uint32_t nes_movie_keyframe_interval(nes_movie_t a_movie);
+
+// Keyframe a_index, ordered by frame: the frame it was taken before and its state. The state stays valid while the
+// movie exists. False past the last one.
+bool nes_movie_keyframe(nes_movie_t a_movie, uint32_t a_index, uint32_t *a_frame, const void **a_state, size_t *a_size);
+
+// Bring a_system, which has the movie's cartridge, to the start of a_frame (the movie's frame count for its end):
+// restore the last keyframe before and run the frames from there, or power on without one. False if a_frame is past
+// the end, there is no cartridge or the keyframe does not load.
+bool nes_movie_seek(nes_movie_t a_movie, nes_system_t a_system, uint32_t a_frame);
+
+// Check that the movie plays the same as when its keyframes were taken. The segments between keyframes, from power
+// on to the first one and from each to the next, run on a_threads threads (0 for one per CPU) and the state each ends
+// in is compared with the keyframe it ends at. *a_segment is the first segment that failed, the one ending at that
+// keyframe index, or the keyframe count.
+nes_movie_verify_result_t nes_movie_verify(nes_movie_t a_movie, const void *a_ines_image, size_t a_size, uint32_t a_threads, uint32_t *a_segment);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "nes_runner.h"
+#include "nes_host.h"
+
+#define NES_RUNNER_CACHE_LINE 64
+
+// The jobs [begin, end) a worker has not started yet, packed as end << 32 | begin so that the owner taking from
+// the front and thieves taking the back half can both update it with one compare and swap. Jobs are only ever
+// taken, a range never grows again except when an empty one is refilled by its owner after a steal.
+typedef struct nes_runner_queue_data
+{
+    alignas(NES_RUNNER_CACHE_LINE) std::atomic<uint64_t> m_range;
+} *nes_runner_queue_t;
+
+typedef struct nes_runner_data
+{
+    nes_runner_job_t m_jobs;
+    nes_runner_queue_t m_queues;
+    uint32_t m_workers;
+    bool m_pin_threads;
+    uint32_t m_cpu_count;
+    int m_cpus[NES_RUNNER_MAX_THREADS]; // The CPUs the process may run on, for pinning
+} *nes_runner_t;
+
+static uint64_t nes_runner_range(uint32_t a_begin, uint32_t a_end)
+{
+    return ((uint64_t)a_end << 32) | a_begin;
+}
+
+// Take the next job from the front of the worker's own queue
+static bool nes_runner_take(nes_runner_t a_runner, uint32_t a_worker, uint32_t *a_job)
+{
+    std::atomic<uint64_t> *range = &a_runner->m_queues[a_worker].m_range;
+    uint64_t value = range->load(std::memory_order_acquire);
+
+    for (;;)
+    {
+        uint32_t begin = (uint32_t)value;
+        uint32_t end = (uint32_t)(value >> 32);
+
+        if (begin >= end)
+        {
+            return false;
+        }
+
+        if (range->compare_exchange_weak(value, nes_runner_range(begin + 1, end), std::memory_order_acq_rel))
+        {
+            *a_job = begin;
+            return true;
+        }
+    }
+}
+
+// Take the back half of the first other queue that has jobs left, its owner keeps the front half. Run the first of
+// the stolen jobs and queue the rest on the worker's own queue, which is empty.
+static bool nes_runner_steal(nes_runner_t a_runner, uint32_t a_worker, uint32_t *a_job)
+{
+    for (uint32_t i = 1; i < a_runner->m_workers; i++)
+    {
+        std::atomic<uint64_t> *range = &a_runner->m_queues[(a_worker + i) % a_runner->m_workers].m_range;
+        uint64_t value = range->load(std::memory_order_acquire);
+
+        for (;;)
+        {
+            uint32_t begin = (uint32_t)value;
+            uint32_t end = (uint32_t)(value >> 32);
+
+            if (begin >= end)
+            {
+                break;
+            }
+
+            uint32_t middle = begin + ((end - begin) / 2);
+
+            if (range->compare_exchange_weak(value, nes_runner_range(begin, middle), std::memory_order_acq_rel))
+            {
+                if (middle == begin)
+                {
+                    // A single job left, take it from the back
+                    *a_job = end - 1;
+                    return true;
+                }
+
+                a_runner->m_queues[a_worker].m_range.store(nes_runner_range(middle + 1, end), std::memory_order_release);
+                *a_job = middle;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void nes_runner_run_job(nes_runner_t a_runner, uint32_t a_worker, uint32_t a_index)
+{
+    nes_runner_job_t job = &a_runner->m_jobs[a_index];
+    uint64_t start = nes_host_now_ns();
+
+    job->m_frames_run = 0;
+    job->m_worker = a_worker;
+
+    nes_system_t system = nes_system_create();
+
+    // Nobody listens, and nobody looks unless there is a callback
+    nes_system_set_muted(system, true);
+    nes_system_set_output(system, job->m_frame_callback ? NES_SYSTEM_OUTPUT_RGB : NES_SYSTEM_OUTPUT_NONE);
+
+    // Battery RAM stays in memory, jobs must not write each other's save files
+    job->m_result = nes_system_load_rom(system, job->m_ines_image, job->m_ines_size, nullptr);
+
+    if (job->m_result == NES_SYSTEM_OK)
+    {
+        size_t input = 0;
+
+        for (uint32_t frame = 0; frame < job->m_frames; frame++)
+        {
+            while (input < job->m_input_count && job->m_inputs[input].m_frame <= frame)
+            {
+                nes_system_set_joypad(system, 0, job->m_inputs[input].m_joypad[0]);
+                nes_system_set_joypad(system, 1, job->m_inputs[input].m_joypad[1]);
+                input++;
+            }
+
+            nes_system_step_frame(system);
+
+            job->m_frames_run++;
+
+            if (job->m_frame_callback && !job->m_frame_callback(a_index, system, frame, job->m_context))
+            {
+                break;
+            }
+        }
+    }
+
+    nes_system_destroy(system);
+
+    job->m_ns = nes_host_now_ns() - start;
+}
+
+static void nes_runner_worker(nes_runner_t a_runner, uint32_t a_worker)
+{
+    if (a_runner->m_pin_threads && a_runner->m_cpu_count)
+    {
+        nes_runner_pin_thread(a_runner->m_cpus[a_worker % a_runner->m_cpu_count]);
+    }
+
+    uint32_t job;
+
+    // A worker that finds every queue empty is done, no jobs are ever added
+    while (nes_runner_take(a_runner, a_worker, &job) || nes_runner_steal(a_runner, a_worker, &job))
+    {
+        nes_runner_run_job(a_runner, a_worker, job);
+    }
+}
+
+uint32_t nes_runner_cpus(int *a_cpus, uint32_t a_max)
+{
+    uint32_t count = 0;
+
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE && count < a_max; cpu++)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                a_cpus[count++] = cpu;
+            }
+        }
+    }
+#endif
+
+    return count;
+}
+
+uint32_t nes_runner_thread_count(uint32_t a_threads, size_t a_count, uint32_t a_cpu_count)
+{
+    uint32_t threads = a_threads;
+
+    if (threads == 0)
+    {
+        threads = a_cpu_count ? a_cpu_count : std::thread::hardware_concurrency();
+    }
+
+    if (threads > a_count)
+    {
+        threads = (uint32_t)a_count;
+    }
+
+    if (threads > NES_RUNNER_MAX_THREADS)
+    {
+        threads = NES_RUNNER_MAX_THREADS;
+    }
+
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+
+    return threads;
+}
+
+void nes_runner_pin_thread(int a_cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(a_cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+uint64_t nes_runner_run(nes_runner_job_t a_jobs, size_t a_count, const struct nes_runner_config_data *a_config)
+{
+    uint64_t start = nes_host_now_ns();
+
+    if (a_count == 0)
+    {
+        return 0;
+    }
+
+    nes_runner_t runner = (nes_runner_t)calloc(1, sizeof(struct nes_runner_data));
+
+    runner->m_jobs = a_jobs;
+    runner->m_pin_threads = a_config->m_pin_threads;
+    runner->m_cpu_count = nes_runner_cpus(runner->m_cpus, NES_RUNNER_MAX_THREADS);
+
+    uint32_t workers = nes_runner_thread_count(a_config->m_threads, a_count, runner->m_cpu_count);
+
+    runner->m_workers = workers;
+    runner->m_queues = new nes_runner_queue_data[workers];
+
+    // Contiguous shares of about the same size, jobs next to each other often run the same cartridge
+    for (uint32_t i = 0; i < workers; i++)
+    {
+        runner->m_queues[i].m_range.store(nes_runner_range((uint32_t)((a_count * i) / workers), (uint32_t)((a_count * (i + 1)) / workers)),
+                                          std::memory_order_relaxed);
+    }
+
+    std::thread *threads = new std::thread[workers];
+
+    for (uint32_t i = 0; i < workers; i++)
+    {
+        threads[i] = std::thread(nes_runner_worker, runner, i);
+    }
+
+    for (uint32_t i = 0; i < workers; i++)
+    {
+        threads[i].join();
+    }
+
+    delete[] threads;
+    delete[] runner->m_queues;
+    free(runner);
+
+    return nes_host_now_ns() - start;
+}
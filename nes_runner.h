@@ -0,0 +1,71 @@
+#pragma once
+
+// Runs many independent machines (see nes_system.h) on a pool of worker threads, for test ROMs and bots. Each job
+// is a cartridge, an input script and a number of frames. The jobs are split evenly between the workers up front,
+// a worker that runs out of jobs steals half of the jobs another worker has not started yet. Workers share nothing
+// but the job ranges, the machines themselves only share the read-only device ops tables.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nes_system.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NES_RUNNER_MAX_THREADS 1024
+
+// The joypads from m_frame on, until the next entry
+typedef struct nes_runner_input_data
+{
+    uint32_t m_frame;
+    uint8_t m_joypad[2]; // NES_BUTTON_*
+} *nes_runner_input_t;
+
+// Called on the worker thread after every frame of a job, return false to finish the job early
+typedef bool (*nes_runner_frame_callback_t)(size_t a_job, nes_system_t a_system, uint32_t a_frame, void *a_context);
+
+typedef struct nes_runner_job_data
+{
+    // Set by the caller. The image and the script are only read, jobs may share them.
+    const void *m_ines_image;
+    size_t m_ines_size;
+    const struct nes_runner_input_data *m_inputs; // Ordered by frame, NULL for no input
+    size_t m_input_count;
+    uint32_t m_frames;
+    nes_runner_frame_callback_t m_frame_callback; // NULL for none
+    void *m_context;
+
+    // Set by the runner
+    nes_system_result_t m_result;
+    uint32_t m_frames_run;
+    uint32_t m_worker; // Index of the worker that ran the job
+    uint64_t m_ns;     // Wall time from loading the cartridge to the last frame
+} *nes_runner_job_t;
+
+typedef struct nes_runner_config_data
+{
+    uint32_t m_threads; // 0 for one per CPU the process may run on
+    bool m_pin_threads; // Pin worker i to the i-th of those CPUs, wrapping around
+} *nes_runner_config_t;
+
+// Run all jobs and return once they are finished. Returns the wall time in nanoseconds.
+uint64_t nes_runner_run(nes_runner_job_t a_jobs, size_t a_count, const struct nes_runner_config_data *a_config);
+
+// Thread pool helpers, nes_batch.h uses them too
+
+// Fill a_cpus with the CPUs the process may run on, at most a_max. Returns how many, 0 where they cannot be told.
+uint32_t nes_runner_cpus(int *a_cpus, uint32_t a_max);
+
+// Threads for a_count work items: a_threads, or one per CPU of a_cpu_count (see nes_runner_cpus) if 0, at most
+// a_count and NES_RUNNER_MAX_THREADS and at least 1
+uint32_t nes_runner_thread_count(uint32_t a_threads, size_t a_count, uint32_t a_cpu_count);
+
+// Pin the calling thread to a_cpu, does nothing where threads cannot be pinned
+void nes_runner_pin_thread(int a_cpu);
+
+#ifdef __cplusplus
+}
+#endif
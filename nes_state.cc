@@ -0,0 +1,251 @@
+#include <string.h>
+
+#include "nes_state.h"
+#include "bus.h"
+#include "cpu.h"
+#include "ppu.h"
+
+#define NES_STATE_MAX_DEVICES 64
+
+// XXH64 primes, see nes_state_xxh64
+#define NES_STATE_PRIME1 0x9E3779B185EBCA87ull
+#define NES_STATE_PRIME2 0xC2B2AE3D27D4EB4Full
+#define NES_STATE_PRIME3 0x165667B19E3779F9ull
+#define NES_STATE_PRIME4 0x85EBCA77C2B2AE63ull
+#define NES_STATE_PRIME5 0x27D4EB2F165667C5ull
+
+// Of the PPU in nes_state_hash
+#define NES_STATE_HASH_OAM 0x100
+#define NES_STATE_HASH_PALETTE 0x20
+
+// Collect the devices with state in a stable order, each device once even if it is attached at several places
+static size_t nes_state_devices(nes_machine_t a_machine, bus_device_t *a_devices)
+{
+    size_t count = a_machine->m_bus->devices(a_devices, 0, NES_STATE_MAX_DEVICES);
+
+    count = ppu_device_bus(a_machine->m_ppu)->devices(a_devices, count, NES_STATE_MAX_DEVICES);
+
+    size_t stateful = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (a_devices[i]->m_ops->state_size)
+        {
+            a_devices[stateful++] = a_devices[i];
+        }
+    }
+
+    return stateful;
+}
+
+static size_t nes_state_devices_size(bus_device_t *a_devices, size_t a_count)
+{
+    size_t size = sizeof(struct nes_state_header_data) + sizeof(struct cpu_data) + sizeof(struct apu_device_tick_state_data);
+
+    for (size_t i = 0; i < a_count; i++)
+    {
+        size += a_devices[i]->m_ops->state_size(a_devices[i]);
+    }
+
+    return size;
+}
+
+static uint64_t nes_state_rotl(uint64_t a_value, int a_bits)
+{
+    return (a_value << a_bits) | (a_value >> (64 - a_bits));
+}
+
+static uint64_t nes_state_read64(const uint8_t *a_p)
+{
+    uint64_t value;
+    memcpy(&value, a_p, sizeof(value));
+    return value;
+}
+
+static uint64_t nes_state_xxh64_round(uint64_t a_acc, uint64_t a_input)
+{
+    return nes_state_rotl(a_acc + (a_input * NES_STATE_PRIME2), 31) * NES_STATE_PRIME1;
+}
+
+static uint64_t nes_state_xxh64_merge(uint64_t a_acc, uint64_t a_lane)
+{
+    return ((a_acc ^ nes_state_xxh64_round(0, a_lane)) * NES_STATE_PRIME1) + NES_STATE_PRIME4;
+}
+
+// XXH64 in host byte order. The four lanes of each 32-byte stripe are independent, they run in parallel on the
+// execution units or in vector registers if the compiler sees fit.
+static uint64_t nes_state_xxh64(const uint8_t *a_data, size_t a_size)
+{
+    const uint8_t *p = a_data;
+    const uint8_t *end = a_data + a_size;
+    uint64_t hash;
+
+    if (a_size >= 32)
+    {
+        uint64_t lanes[4] = { NES_STATE_PRIME1 + NES_STATE_PRIME2, NES_STATE_PRIME2, 0, 0 - NES_STATE_PRIME1 };
+
+        for (; p + 32 <= end; p += 32)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                lanes[i] = nes_state_xxh64_round(lanes[i], nes_state_read64(p + (i * 8)));
+            }
+        }
+
+        hash = nes_state_rotl(lanes[0], 1) + nes_state_rotl(lanes[1], 7) + nes_state_rotl(lanes[2], 12) + nes_state_rotl(lanes[3], 18);
+
+        for (int i = 0; i < 4; i++)
+        {
+            hash = nes_state_xxh64_merge(hash, lanes[i]);
+        }
+    }
+    else
+    {
+        hash = NES_STATE_PRIME5;
+    }
+
+    hash += a_size;
+
+    for (; p + 8 <= end; p += 8)
+    {
+        hash = (nes_state_rotl(hash ^ nes_state_xxh64_round(0, nes_state_read64(p)), 27) * NES_STATE_PRIME1) + NES_STATE_PRIME4;
+    }
+
+    if (p + 4 <= end)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        hash = (nes_state_rotl(hash ^ (value * NES_STATE_PRIME1), 23) * NES_STATE_PRIME2) + NES_STATE_PRIME3;
+        p += 4;
+    }
+
+    for (; p < end; p++)
+    {
+        hash = nes_state_rotl(hash ^ (*p * NES_STATE_PRIME5), 11) * NES_STATE_PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= NES_STATE_PRIME2;
+    hash ^= hash >> 29;
+    hash *= NES_STATE_PRIME3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+size_t nes_state_size(nes_machine_t a_machine)
+{
+    bus_device_t devices[NES_STATE_MAX_DEVICES];
+    size_t count = nes_state_devices(a_machine, devices);
+
+    return nes_state_devices_size(devices, count);
+}
+
+size_t nes_state_save(nes_machine_t a_machine, void *a_buffer, size_t a_size)
+{
+    bus_device_t devices[NES_STATE_MAX_DEVICES];
+    size_t count = nes_state_devices(a_machine, devices);
+    size_t size = nes_state_devices_size(devices, count);
+
+    if (a_size < size)
+    {
+        return 0;
+    }
+
+    uint8_t *p = (uint8_t *)a_buffer;
+
+    struct nes_state_header_data header = {};
+    header.m_magic = NES_STATE_MAGIC;
+    header.m_version = NES_STATE_VERSION;
+    header.m_device_count = (uint16_t)count;
+    header.m_size = (uint32_t)size;
+
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+
+    memcpy(p, a_machine->m_cpu, sizeof(struct cpu_data));
+    p += sizeof(struct cpu_data);
+
+    memcpy(p, a_machine->m_apu_tick_state, sizeof(struct apu_device_tick_state_data));
+    p += sizeof(struct apu_device_tick_state_data);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        devices[i]->m_ops->state_save(devices[i], p);
+        p += devices[i]->m_ops->state_size(devices[i]);
+    }
+
+    return size;
+}
+
+bool nes_state_load(nes_machine_t a_machine, const void *a_buffer, size_t a_size)
+{
+    bus_device_t devices[NES_STATE_MAX_DEVICES];
+    size_t count = nes_state_devices(a_machine, devices);
+    size_t size = nes_state_devices_size(devices, count);
+
+    const uint8_t *p = (const uint8_t *)a_buffer;
+
+    struct nes_state_header_data header;
+
+    if (a_size < sizeof(header))
+    {
+        return false;
+    }
+
+    memcpy(&header, p, sizeof(header));
+
+    // The sizes of all parts follow from the machine, matching totals are as far as a plain layout can be checked
+    if (header.m_magic != NES_STATE_MAGIC || header.m_version != NES_STATE_VERSION ||
+        header.m_device_count != count || header.m_size != size || a_size < size)
+    {
+        return false;
+    }
+
+    p += sizeof(header);
+
+    memcpy(a_machine->m_cpu, p, sizeof(struct cpu_data));
+    p += sizeof(struct cpu_data);
+
+    memcpy(a_machine->m_apu_tick_state, p, sizeof(struct apu_device_tick_state_data));
+    p += sizeof(struct apu_device_tick_state_data);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        devices[i]->m_ops->state_load(devices[i], p);
+        p += devices[i]->m_ops->state_size(devices[i]);
+    }
+
+    return true;
+}
+
+uint64_t nes_state_hash(nes_machine_t a_machine, void *a_buffer)
+{
+    bus_device_t devices[NES_STATE_MAX_DEVICES];
+    size_t count = nes_state_devices(a_machine, devices);
+    uint8_t *p = (uint8_t *)a_buffer;
+    const struct cpu_data::register_data *registers = &a_machine->m_cpu->m_registers;
+
+    *p++ = registers->a;
+    *p++ = registers->x;
+    *p++ = registers->y;
+    *p++ = registers->s;
+    *p++ = (uint8_t)registers->pc;
+    *p++ = (uint8_t)(registers->pc >> 8);
+    *p++ = registers->status.raw;
+
+    ppu_device_read_memory(a_machine->m_ppu, p, p + NES_STATE_HASH_OAM);
+    p += NES_STATE_HASH_OAM + NES_STATE_HASH_PALETTE;
+
+    // Both of them hold more state than the registers and memory the game can see
+    for (size_t i = 0; i < count; i++)
+    {
+        if (devices[i] != a_machine->m_ppu && devices[i] != a_machine->m_apu)
+        {
+            devices[i]->m_ops->state_save(devices[i], p);
+            p += devices[i]->m_ops->state_size(devices[i]);
+        }
+    }
+
+    return nes_state_xxh64((const uint8_t *)a_buffer, p - (uint8_t *)a_buffer);
+}
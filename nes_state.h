@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "hw_types.h"
+#include "apu.h"
+
+// Binary save states. A state holds the CPU, every device on the CPU bus and on the PPU's bus that has state ops
+// (see bus_device_ops_data) and the APU tick state the frontend shares with the APU. ROM contents and the frame
+// buffer are not part of it, so a state is only valid for the cartridge it was taken from.
+//
+// Layout: a nes_state_header_data followed by the CPU and then each device once, in the order they first appear
+// on the CPU bus and then on the PPU's bus. Every part is a plain copy of the device's memory, a state is only
+// meant to be loaded by the same build on the same kind of host.
+//
+// Take and load states between CPU cycles, that is outside of cpu.tick and the device callbacks.
+
+#define NES_STATE_MAGIC 0x5353454E // "NESS"
+#define NES_STATE_VERSION 1
+
+typedef struct nes_state_header_data
+{
+    uint32_t m_magic;
+    uint16_t m_version;
+    uint16_t m_device_count;
+    uint32_t m_size; // Including the header
+} *nes_state_header_t;
+
+// The parts of the machine that make up a state
+typedef struct nes_machine_data
+{
+    cpu_t m_cpu;
+    bus_t m_bus; // CPU bus
+    bus_device_t m_ppu; // Attached to m_bus, its own bus is walked too
+    bus_device_t m_apu; // Attached to m_bus, left out of nes_state_hash
+    apu_device_tick_state_t m_apu_tick_state;
+} *nes_machine_t;
+
+// Size of a state of a_machine, it only changes when devices are attached or removed
+size_t nes_state_size(nes_machine_t a_machine);
+
+// Returns the number of bytes written, 0 if a_size is too small
+size_t nes_state_save(nes_machine_t a_machine, void *a_buffer, size_t a_size);
+
+// Returns false and leaves the machine untouched if the state does not match the layout of a_machine
+bool nes_state_load(nes_machine_t a_machine, const void *a_buffer, size_t a_size);
+
+// A 64-bit hash of what the game has made of the machine: the CPU registers, OAM and palette RAM of the PPU and the
+// state of the other devices but the APU, that is internal RAM, nametables, mapper registers and cartridge RAM. The
+// timing state of the CPU, PPU and APU is left out, so a build that keeps it differently still hashes the same.
+// Cheap enough for every frame, a_buffer is scratch space of nes_state_size bytes.
+uint64_t nes_state_hash(nes_machine_t a_machine, void *a_buffer);
@@ -0,0 +1,578 @@
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+
+#include "nes_system.h"
+#include "cpu.h"
+#include "bus.h"
+#include "scheduler.h"
+#include "apu.h"
+#include "ppu.h"
+#include "ram_device.h"
+#include "mapper.h"
+#include "nes_state.h"
+
+#define NES_SYSTEM_MAX_DEVICES 64
+#define NES_SYSTEM_DEFAULT_SAMPLE_RATE 44100
+
+static_assert(NES_SYSTEM_FRAME_WIDTH == PPU_FRAME_VISIBLE_WIDTH && NES_SYSTEM_FRAME_HEIGHT == PPU_FRAME_VISIBLE_HEIGHT, "Frame size");
+static_assert(sizeof(struct ppu_rgb_color_data) == 3, "The frame buffer is handed out as bytes");
+
+// The cartridge image, the mappers read ROM from it in place. Freed with the last machine that uses it.
+typedef struct nes_rom_data
+{
+    std::atomic<uint32_t> m_refs;
+    size_t m_size;
+    uint8_t *m_image;
+} *nes_rom_t;
+
+// The image follows the header in the same allocation, see nes_system_load_rom
+static void nes_rom_free(nes_rom_t a_rom)
+{
+    a_rom->~nes_rom_data();
+    free(a_rom);
+}
+
+typedef struct nes_system_data
+{
+    struct cpu_data m_cpu;
+    struct bus_data m_bus; // CPU bus
+    struct scheduler_data m_scheduler; // The PPU and APU events, the CPU runs on its own up to the next one
+    bus_device_t m_ram;
+    bus_device_t m_ppu;
+    bus_device_t m_apu;
+    struct apu_device_tick_state_data m_apu_tick_state;
+    struct nes_machine_data m_machine; // The parts above, for nes_state_save and nes_state_load
+    nes_rom_t m_rom;                   // nullptr until a cartridge is loaded, there are no devices before
+    char *m_save_path;                 // Of the cartridge, nullptr when battery RAM is kept in memory only
+    uint8_t *m_hash_buffer;            // Scratch space for nes_state_hash, grown to the state size
+    size_t m_hash_buffer_size;
+
+    uint32_t m_nmi;
+    bool m_frame_done; // Set by the frame callback, the frame is finished at the next CPU cycle boundary
+    uint8_t m_joypad[2];
+
+    // Settings, kept across cartridges and passed on to clones
+    uint32_t m_sample_rate;
+    ppu_output_t m_output;
+    bool m_muted;
+    uint8_t *m_output_buffer; // Not passed on to clones
+    struct ppu_luma_format_data m_luma_format;
+} *nes_system_t;
+
+static void nes_system_frame_done(ppu_rgb_color_t a_frame, void *a_context)
+{
+    ((nes_system_t)a_context)->m_frame_done = true;
+}
+
+static void nes_system_destroy_devices(nes_system_t a_system)
+{
+    bus_device_t devices[NES_SYSTEM_MAX_DEVICES];
+
+    size_t count = a_system->m_bus.devices(devices, 0, NES_SYSTEM_MAX_DEVICES);
+
+    count = ppu_device_bus(a_system->m_ppu)->devices(devices, count, NES_SYSTEM_MAX_DEVICES);
+
+    // Last to first, the devices on the PPU's bus go before the PPU and a mapper's PPU side devices before the one
+    // on the CPU bus that frees them all
+    while (count--)
+    {
+        if (devices[count]->m_ops->destroy)
+        {
+            devices[count]->m_ops->destroy(devices[count]);
+        }
+    }
+
+    a_system->m_bus.initialize();
+    a_system->m_ram = nullptr;
+    a_system->m_ppu = nullptr;
+    a_system->m_apu = nullptr;
+}
+
+static void nes_system_release_rom(nes_system_t a_system)
+{
+    nes_rom_t rom = a_system->m_rom;
+
+    if (!rom)
+    {
+        return;
+    }
+
+    nes_system_destroy_devices(a_system);
+
+    a_system->m_rom = nullptr;
+
+    free(a_system->m_save_path);
+    a_system->m_save_path = nullptr;
+
+    // Acquire-release, the last owner sees every other owner done with the image before freeing it
+    if (rom->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        nes_rom_free(rom);
+    }
+}
+
+// Create the devices and map a_rom, the machine is not powered on yet
+static mapper_return_t nes_system_map(nes_system_t a_system, nes_rom_t a_rom, const char *a_save_path)
+{
+    a_system->m_bus.initialize();
+
+    // 2 KiB of internal RAM, mirrored up to $1FFF
+    a_system->m_ram = ram_device_create(NES_SYSTEM_RAM_SIZE);
+    a_system->m_bus.attach(a_system->m_ram, 0, 0x2000);
+
+    // The PPU registers are mirrored every 8 bytes up to $3FFF
+    a_system->m_ppu = ppu_device_create();
+    a_system->m_bus.attach(a_system->m_ppu, 0x2000, 0x2000);
+
+    a_system->m_apu = apu_device_create();
+    a_system->m_bus.attach(a_system->m_apu, 0x4000, 0x100);
+
+    mapper_return_t result = mapper_map_ines((ines_header_t)a_rom->m_image, &a_system->m_bus, a_system->m_ppu, a_save_path);
+
+    if (result != MAPPER_OK)
+    {
+        nes_system_destroy_devices(a_system);
+        return result;
+    }
+
+    a_rom->m_refs.fetch_add(1, std::memory_order_relaxed);
+    a_system->m_rom = a_rom;
+
+    a_system->m_machine = { &a_system->m_cpu, &a_system->m_bus, a_system->m_ppu, a_system->m_apu, &a_system->m_apu_tick_state };
+
+    a_system->m_scheduler.initialize();
+    a_system->m_bus.m_scheduler = &a_system->m_scheduler;
+
+    ppu_device_set_clock(a_system->m_ppu, &a_system->m_bus, nes_system_frame_done, a_system, &a_system->m_nmi);
+    apu_device_set_cpu_bus(a_system->m_apu, &a_system->m_bus);
+
+    ppu_device_set_output(a_system->m_ppu, a_system->m_output);
+    ppu_device_set_output_buffer(a_system->m_ppu, a_system->m_output_buffer);
+    ppu_device_set_luma_format(a_system->m_ppu, &a_system->m_luma_format, nullptr, nullptr);
+    apu_device_set_sample_rate(a_system->m_apu, a_system->m_sample_rate);
+    apu_device_set_muted(a_system->m_apu, a_system->m_muted);
+
+    return MAPPER_OK;
+}
+
+// The devices are freshly mapped
+static void nes_system_power_on(nes_system_t a_system)
+{
+    a_system->m_apu_tick_state = {};
+    a_system->m_nmi = 0;
+    a_system->m_frame_done = false;
+
+    a_system->m_cpu.power_on(&a_system->m_bus);
+}
+
+nes_system_t nes_system_create(void)
+{
+    nes_system_t system = (nes_system_t)calloc(1, sizeof(struct nes_system_data));
+
+    system->m_bus.initialize();
+    system->m_sample_rate = NES_SYSTEM_DEFAULT_SAMPLE_RATE;
+    system->m_output = PPU_OUTPUT_RGB;
+    system->m_luma_format = { 1, 0, 0, 0, 0 };
+
+    return system;
+}
+
+nes_system_result_t nes_system_load_rom(nes_system_t a_system, const void *a_ines_image, size_t a_size, const char *a_save_path)
+{
+    if (!mapper_ines_size(a_ines_image, a_size))
+    {
+        return NES_SYSTEM_INVALID_IMAGE;
+    }
+
+    nes_system_release_rom(a_system);
+
+    // Constructed in place, the image goes after it
+    nes_rom_t rom = new (malloc(sizeof(struct nes_rom_data) + a_size)) nes_rom_data();
+
+    rom->m_size = a_size;
+    rom->m_image = (uint8_t *)(rom + 1);
+    memcpy(rom->m_image, a_ines_image, a_size);
+
+    mapper_return_t result = nes_system_map(a_system, rom, a_save_path);
+
+    if (result != MAPPER_OK)
+    {
+        nes_rom_free(rom);
+        return (result == MAPPER_UNSUPPORTED) ? NES_SYSTEM_UNSUPPORTED : NES_SYSTEM_INVALID_IMAGE;
+    }
+
+    a_system->m_save_path = a_save_path ? strdup(a_save_path) : nullptr;
+
+    nes_system_power_on(a_system);
+
+    return NES_SYSTEM_OK;
+}
+
+nes_system_t nes_clone(nes_system_t a_system)
+{
+    if (!a_system->m_rom)
+    {
+        return nullptr;
+    }
+
+    nes_system_t clone = (nes_system_t)calloc(1, sizeof(struct nes_system_data));
+
+    clone->m_sample_rate = a_system->m_sample_rate;
+    clone->m_output = a_system->m_output;
+    clone->m_muted = a_system->m_muted;
+    clone->m_luma_format = a_system->m_luma_format;
+
+    if (nes_system_map(clone, a_system->m_rom, nullptr) != MAPPER_OK)
+    {
+        free(clone);
+        return nullptr;
+    }
+
+    // The writable state is small, copying it up front is cheaper than tracking writes to it
+    size_t size = nes_state_size(&a_system->m_machine);
+    uint8_t *state = (uint8_t *)malloc(size);
+
+    nes_state_save(&a_system->m_machine, state, size);
+    nes_state_load(&clone->m_machine, state, size);
+
+    free(state);
+
+    // The clone's clock starts over, a loaded state continues right after the cycle it was taken in. Unless nothing
+    // has run yet, then the PPU has to start where it does at power on.
+    if (!a_system->m_bus.m_clock)
+    {
+        ppu_device_set_clock(clone->m_ppu, &clone->m_bus, nes_system_frame_done, clone, &clone->m_nmi);
+    }
+
+    // Not part of the state, but while rendering is off it still shows an older frame
+    memcpy(ppu_device_frame_buffer(clone->m_ppu), ppu_device_frame_buffer(a_system->m_ppu),
+           sizeof(struct ppu_rgb_color_data) * PPU_FRAME_VISIBLE_WIDTH * PPU_FRAME_VISIBLE_HEIGHT);
+
+    clone->m_nmi = a_system->m_nmi;
+    memcpy(clone->m_joypad, a_system->m_joypad, sizeof(clone->m_joypad));
+
+    return clone;
+}
+
+void nes_system_reset(nes_system_t a_system)
+{
+    if (!a_system->m_rom)
+    {
+        return;
+    }
+
+    // The cartridge does not see the reset line
+    ppu_device_reset(a_system->m_ppu);
+    apu_device_reset(a_system->m_apu);
+    a_system->m_cpu.reset(&a_system->m_bus);
+}
+
+void nes_system_power(nes_system_t a_system)
+{
+    nes_rom_t rom = a_system->m_rom;
+
+    if (!rom)
+    {
+        return;
+    }
+
+    // Hold on to the image and the save path while the devices are made again
+    char *save_path = a_system->m_save_path;
+
+    a_system->m_save_path = nullptr;
+    rom->m_refs.fetch_add(1, std::memory_order_relaxed);
+
+    nes_system_release_rom(a_system);
+
+    // The image was mapped before, it maps again
+    if (nes_system_map(a_system, rom, save_path) == MAPPER_OK)
+    {
+        a_system->m_save_path = save_path;
+        nes_system_power_on(a_system);
+    }
+    else
+    {
+        free(save_path);
+    }
+
+    if (rom->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        nes_rom_free(rom);
+    }
+}
+
+void nes_system_destroy(nes_system_t a_system)
+{
+    nes_system_release_rom(a_system);
+
+    free(a_system->m_hash_buffer);
+    free(a_system);
+}
+
+// Run the APU up to the clock and pass on what it changed
+static void nes_system_run_apu(nes_system_t a_system)
+{
+    cpu_t cpu = &a_system->m_cpu;
+    apu_device_tick_state_t apu_tick_state = &a_system->m_apu_tick_state;
+
+    apu_device_run(a_system->m_apu, &a_system->m_bus, apu_tick_state, UINT32_MAX);
+
+    cpu->irq(apu_tick_state->out.irq);
+
+    // The joypads are latched while the game holds the strobe high, see nes_system_set_joypad for the changes after
+    if (apu_tick_state->out.poll_joypad)
+    {
+        apu_tick_state->in.joypad1.raw = a_system->m_joypad[0];
+        apu_tick_state->in.joypad2.raw = a_system->m_joypad[1];
+    }
+
+    if (apu_tick_state->out.oam_dma)
+    {
+        // Handle OAM DMA transfer
+        apu_tick_state->out.oam_dma = 0;
+        // Stall the CPU for 513/514 cycles, the actual "DMA" transfer will be performed in the APU
+        cpu->stall(cpu->m_tickcount & 1 ? 513 : 514);
+    }
+
+    if (apu_tick_state->out.dmc_stall)
+    {
+        cpu->stall(apu_tick_state->out.dmc_stall);
+        apu_tick_state->out.dmc_stall = 0;
+    }
+}
+
+void nes_system_step_frame(nes_system_t a_system)
+{
+    if (!a_system->m_rom)
+    {
+        return;
+    }
+
+    cpu_t cpu = &a_system->m_cpu;
+    bus_t bus = &a_system->m_bus;
+
+    for (;;)
+    {
+        if (a_system->m_frame_done)
+        {
+            // The CPU finishes the cycle the frame ended in and the APU catches up, states can be taken here
+            cpu->run(bus, 1);
+            nes_system_run_apu(a_system);
+
+            a_system->m_frame_done = false;
+            return;
+        }
+
+        // Up to the next event the CPU runs in one go, an APU access it has to react to in the same cycle posts one
+        // for the cycle after
+        cpu->run(bus, UINT32_MAX);
+
+        bool apu = false;
+        bool ppu = false;
+        scheduler_event_t event;
+
+        while (a_system->m_scheduler.pop(bus->m_clock + 1, &event))
+        {
+            if (event == SCHEDULER_EVENT_PPU_VBLANK || event == SCHEDULER_EVENT_PPU_FRAME_END)
+            {
+                ppu = true;
+            }
+            else
+            {
+                apu = true;
+            }
+        }
+
+        // The APU ran after the CPU in the cycle that is done, the PPU runs before it in the next one
+        if (apu)
+        {
+            nes_system_run_apu(a_system);
+        }
+
+        if (ppu)
+        {
+            // The PPU runs behind and catches up when the CPU touches it, or here when it raises NMI or ends the
+            // frame. NMI is taken at the next instruction boundary.
+            ppu_device_handle_event(a_system->m_ppu);
+
+            if (a_system->m_nmi)
+            {
+                cpu->nmi();
+                a_system->m_nmi = 0;
+            }
+        }
+    }
+}
+
+void nes_system_set_joypad(nes_system_t a_system, int a_port, uint8_t a_buttons)
+{
+    a_system->m_joypad[a_port & 1] = a_buttons;
+
+    // With the strobe held high the joypads follow the buttons, the APU latches them when it goes low
+    if (a_system->m_rom && a_system->m_apu_tick_state.out.poll_joypad)
+    {
+        if (a_port & 1)
+        {
+            a_system->m_apu_tick_state.in.joypad2.raw = a_buttons;
+        }
+        else
+        {
+            a_system->m_apu_tick_state.in.joypad1.raw = a_buttons;
+        }
+    }
+}
+
+const uint8_t *nes_system_frame_buffer(nes_system_t a_system)
+{
+    return a_system->m_rom ? (const uint8_t *)ppu_device_frame_buffer(a_system->m_ppu) : nullptr;
+}
+
+void nes_system_set_output(nes_system_t a_system, nes_system_output_t a_output)
+{
+    switch (a_output)
+    {
+    case NES_SYSTEM_OUTPUT_NONE:
+        a_system->m_output = PPU_OUTPUT_NONE;
+        break;
+    case NES_SYSTEM_OUTPUT_INDEX:
+        a_system->m_output = PPU_OUTPUT_INDEX;
+        break;
+    case NES_SYSTEM_OUTPUT_LUMA:
+        a_system->m_output = PPU_OUTPUT_LUMA;
+        break;
+    default:
+        a_system->m_output = PPU_OUTPUT_RGB;
+        break;
+    }
+
+    if (a_system->m_rom)
+    {
+        ppu_device_set_output(a_system->m_ppu, a_system->m_output);
+    }
+}
+
+void nes_system_set_output_buffer(nes_system_t a_system, uint8_t *a_buffer)
+{
+    a_system->m_output_buffer = a_buffer;
+
+    if (a_system->m_rom)
+    {
+        ppu_device_set_output_buffer(a_system->m_ppu, a_buffer);
+    }
+}
+
+bool nes_system_set_luma_format(nes_system_t a_system, const struct nes_system_luma_format_data *a_format, uint16_t *a_width, uint16_t *a_height)
+{
+    struct ppu_luma_format_data format = { a_format->m_scale, a_format->m_crop_left, a_format->m_crop_right, a_format->m_crop_top, a_format->m_crop_bottom };
+
+    if (!ppu_luma_format_size(&format, a_width, a_height))
+    {
+        return false;
+    }
+
+    a_system->m_luma_format = format;
+
+    if (a_system->m_rom)
+    {
+        ppu_device_set_luma_format(a_system->m_ppu, &format, nullptr, nullptr);
+    }
+
+    return true;
+}
+
+void nes_system_set_sample_rate(nes_system_t a_system, uint32_t a_sample_rate)
+{
+    a_system->m_sample_rate = a_sample_rate;
+
+    if (a_system->m_rom)
+    {
+        apu_device_set_sample_rate(a_system->m_apu, a_sample_rate);
+    }
+}
+
+size_t nes_system_read_samples(nes_system_t a_system, int16_t *a_samples, size_t a_count)
+{
+    return a_system->m_rom ? apu_device_read_samples(a_system->m_apu, a_samples, a_count) : 0;
+}
+
+void nes_system_set_muted(nes_system_t a_system, bool a_muted)
+{
+    a_system->m_muted = a_muted;
+
+    if (a_system->m_rom)
+    {
+        apu_device_set_muted(a_system->m_apu, a_muted);
+    }
+}
+
+size_t nes_system_state_size(nes_system_t a_system)
+{
+    return a_system->m_rom ? nes_state_size(&a_system->m_machine) : 0;
+}
+
+size_t nes_system_state_save(nes_system_t a_system, void *a_buffer, size_t a_size)
+{
+    return a_system->m_rom ? nes_state_save(&a_system->m_machine, a_buffer, a_size) : 0;
+}
+
+bool nes_system_state_load(nes_system_t a_system, const void *a_buffer, size_t a_size)
+{
+    if (!a_system->m_rom || !nes_state_load(&a_system->m_machine, a_buffer, a_size))
+    {
+        return false;
+    }
+
+    // States are taken between frames, right after a CPU cycle and with no NMI pending
+    a_system->m_nmi = 0;
+    a_system->m_frame_done = false;
+
+    return true;
+}
+
+uint64_t nes_system_state_hash(nes_system_t a_system)
+{
+    if (!a_system->m_rom)
+    {
+        return 0;
+    }
+
+    size_t size = nes_state_size(&a_system->m_machine);
+
+    if (size > a_system->m_hash_buffer_size)
+    {
+        free(a_system->m_hash_buffer);
+        a_system->m_hash_buffer = (uint8_t *)malloc(size);
+        a_system->m_hash_buffer_size = size;
+    }
+
+    return nes_state_hash(&a_system->m_machine, a_system->m_hash_buffer);
+}
+
+void nes_system_read_ram(nes_system_t a_system, uint8_t *a_ram)
+{
+    if (!a_system->m_rom)
+    {
+        memset(a_ram, 0, NES_SYSTEM_RAM_SIZE);
+        return;
+    }
+
+    ram_device_read_buffer(a_system->m_ram, 0, a_ram, NES_SYSTEM_RAM_SIZE);
+}
+
+uint8_t nes_system_peek(nes_system_t a_system, uint16_t a_addr)
+{
+    // Reading PPU and APU registers changes them
+    if (!a_system->m_rom || (a_addr >= 0x2000 && a_addr < 0x6000))
+    {
+        return 0;
+    }
+
+    return a_system->m_bus.read8(a_addr);
+}
+
+void nes_system_sync(nes_system_t a_system)
+{
+    a_system->m_bus.sync();
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+// Plain C interface to a whole NES, the CPU with its RAM, the PPU, the APU and a cartridge. A nes_system_t owns all
+// of its devices. The core is built as libnessie.a, link it with a C++ toolchain (or add -lstdc++ -lm).
+//
+// Machines made from one cartridge image share its ROM, it is only ever read. A clone only costs the writable
+// state: CPU and PPU RAM, OAM, palette, APU, mapper registers, CHR RAM and PRG RAM. Different machines share no
+// mutable data and can run on different threads at the same time, one machine must only be used by one thread at
+// a time.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NES_SYSTEM_FRAME_WIDTH 256
+#define NES_SYSTEM_FRAME_HEIGHT 240
+#define NES_SYSTEM_RAM_SIZE 0x800 // Internal RAM, CPU $0000-$07FF
+
+// Joypad buttons for nes_system_set_joypad
+#define NES_BUTTON_RIGHT  0x01
+#define NES_BUTTON_LEFT   0x02
+#define NES_BUTTON_DOWN   0x04
+#define NES_BUTTON_UP     0x08
+#define NES_BUTTON_START  0x10
+#define NES_BUTTON_SELECT 0x20
+#define NES_BUTTON_B      0x40
+#define NES_BUTTON_A      0x80
+
+typedef struct nes_system_data *nes_system_t;
+
+typedef enum nes_system_result
+{
+    NES_SYSTEM_OK = 0,
+    NES_SYSTEM_UNSUPPORTED = -1,   // The cartridge uses a mapper that is not implemented
+    NES_SYSTEM_INVALID_IMAGE = -2, // Not an iNES image or shorter than its header says
+} nes_system_result_t;
+
+typedef enum nes_system_output
+{
+    NES_SYSTEM_OUTPUT_RGB,   // Compose every frame (default)
+    NES_SYSTEM_OUTPUT_NONE,  // Emulate frames without composing them
+    NES_SYSTEM_OUTPUT_INDEX, // Store the palette index (0-63) of each pixel in the buffer set with nes_system_set_output_buffer
+    NES_SYSTEM_OUTPUT_LUMA   // Store a downscaled grayscale frame there, see nes_system_set_luma_format
+} nes_system_output_t;
+
+// Format of NES_SYSTEM_OUTPUT_LUMA: the frame minus the crop margins, each m_scale x m_scale block averaged into
+// one byte of luma. Blocks cut off at the right and bottom edge are dropped. { 2, 0, 0, 0, 0 } gives 128x120,
+// { 2, 44, 44, 36, 36 } the 84x84 of the middle 168x168 pixels.
+typedef struct nes_system_luma_format_data
+{
+    uint8_t m_scale; // 1 to 16
+    uint8_t m_crop_left;
+    uint8_t m_crop_right;
+    uint8_t m_crop_top;
+    uint8_t m_crop_bottom;
+} *nes_system_luma_format_t;
+
+// A machine without a cartridge, nes_system_step_frame does nothing until one is loaded
+nes_system_t nes_system_create(void);
+
+// Copy the iNES image, insert it and power on, replacing the cartridge and the devices there were. a_save_path is
+// where battery-backed PRG RAM is persisted, NULL keeps it in memory only.
+nes_system_result_t nes_system_load_rom(nes_system_t a_system, const void *a_ines_image, size_t a_size, const char *a_save_path);
+
+// A new machine in the state of a_system that shares its ROM, with the same settings. Battery RAM of the clone is
+// kept in memory only. NULL if a_system has no cartridge.
+nes_system_t nes_clone(nes_system_t a_system);
+
+void nes_system_destroy(nes_system_t a_system);
+
+// Press the reset button, between frames. The CPU restarts at the reset vector, the PPU and APU registers are
+// cleared as on the console, RAM and the cartridge keep their contents.
+void nes_system_reset(nes_system_t a_system);
+
+// Switch the console off and on again. Everything starts over as after nes_system_load_rom, battery RAM is kept if
+// it has a save file.
+void nes_system_power(nes_system_t a_system);
+
+// Emulate up to the end of the next frame, the end of the visible picture
+void nes_system_step_frame(nes_system_t a_system);
+
+// Buttons held on joypad a_port (0 or 1), the game sees them the next time it reads the joypad
+void nes_system_set_joypad(nes_system_t a_system, int a_port, uint8_t a_buttons);
+
+// The last composed frame, NES_SYSTEM_FRAME_WIDTH x NES_SYSTEM_FRAME_HEIGHT pixels of 8-bit R, G and B.
+// NULL without a cartridge.
+const uint8_t *nes_system_frame_buffer(nes_system_t a_system);
+
+void nes_system_set_output(nes_system_t a_system, nes_system_output_t a_output);
+
+// Where NES_SYSTEM_OUTPUT_INDEX and NES_SYSTEM_OUTPUT_LUMA store the frame, NES_SYSTEM_FRAME_WIDTH x
+// NES_SYSTEM_FRAME_HEIGHT bytes for NES_SYSTEM_OUTPUT_INDEX. The PPU writes it in place, it must stay valid while
+// it is set. Lines drawn with rendering off keep what was there before. Clones start without one.
+void nes_system_set_output_buffer(nes_system_t a_system, uint8_t *a_buffer);
+
+// Set the format of NES_SYSTEM_OUTPUT_LUMA (m_scale 1 without crop by default) and return the frame size in it.
+// Returns false and keeps the format if the scale is out of range or the crop leaves less than one block.
+bool nes_system_set_luma_format(nes_system_t a_system, const struct nes_system_luma_format_data *a_format, uint16_t *a_width, uint16_t *a_height);
+
+// 16-bit mono PCM, 44100 Hz unless changed. Pull the samples of every frame or they pile up.
+void nes_system_set_sample_rate(nes_system_t a_system, uint32_t a_sample_rate);
+size_t nes_system_read_samples(nes_system_t a_system, int16_t *a_samples, size_t a_count);
+
+// Run the APU without generating sound, for frames that are thrown away again
+void nes_system_set_muted(nes_system_t a_system, bool a_muted);
+
+// Save states, only valid for the cartridge they were taken from. The size is 0 without a cartridge.
+size_t nes_system_state_size(nes_system_t a_system);
+
+// Returns the number of bytes written, 0 if a_size is too small
+size_t nes_system_state_save(nes_system_t a_system, void *a_buffer, size_t a_size);
+
+// Returns false and leaves the machine untouched if the state does not fit the cartridge. Battery RAM with a save file
+// is loaded into the file as well, so rewinding or running ahead rewrites the save file to the loaded state.
+bool nes_system_state_load(nes_system_t a_system, const void *a_buffer, size_t a_size);
+
+// A hash of the CPU registers, RAM, nametables, OAM, palette and cartridge state, for finding the first frame two
+// builds disagree on. Unlike save states it leaves out timing and the APU, and does not depend on how a build keeps
+// them. 0 without a cartridge.
+uint64_t nes_system_state_hash(nes_system_t a_system);
+
+// Copy the NES_SYSTEM_RAM_SIZE bytes of internal RAM to a_ram
+void nes_system_read_ram(nes_system_t a_system, uint8_t *a_ram);
+
+// Read a byte of the CPU address space without side effects. The registers at $2000-$5FFF read as 0. 0 without a
+// cartridge.
+uint8_t nes_system_peek(nes_system_t a_system, uint16_t a_addr);
+
+// Schedule a write back of battery RAM to the save file
+void nes_system_sync(nes_system_t a_system);
+
+#ifdef __cplusplus
+}
+#endif
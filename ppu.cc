@@ -1,8 +1,11 @@
 #include "ppu.h"
 #include "bus.h"
+#include "scheduler.h"
 
 #include <malloc.h>
 #include <assert.h>
+#include <string.h>
+#include <stddef.h>
 
 // The PPU addresses a 14-bit (16kB) address space, $0000-$3FFF, completely separate from the CPU's address bus.
 // It is either directly accessed by the PPU itself, or via the CPU with memory mapped registers at $2006 and $2007.
@@ -19,14 +22,25 @@
 // $3F00-$3F1F     $0020    Palette RAM indexes      Internal to PPU
 // $3F20-$3FFF     $00E0    Mirrors of $3F00-$3F1F   Internal to PPU
 
+#define DEVICE_TO_PPU(p) ((ppu_device_t)(p))
 
-#define PPU_FRAME_VISIBLE_WIDTH 256
+// Everything from the registers up to the bus is PPU state, the bus, the fetch hook and the frame buffer are not
+#define PPU_STATE_OFFSET offsetof(struct ppu_device_data, m_registers)
+#define PPU_STATE_SIZE (offsetof(struct ppu_device_data, m_bus) - PPU_STATE_OFFSET)
 
-#define PPU_FRAME_VISIBLE_HEIGHT 240
+#define PPU_FETCH_CYCLE(ppu) (((ppu->m_cycle - 1) & 7))
 
-#define DEVICE_TO_PPU(p) ((ppu_device_t)(p))
+#define PPU_LINE_DOTS 342 // m_cycle runs 0-341
+#define PPU_FRAME_DOTS (262 * PPU_LINE_DOTS)
+#define PPU_FRAME_END_POSITION ((240 * PPU_LINE_DOTS) + 255) // See ppu_scanline_post_render
+#define PPU_VBLANK_POSITION ((241 * PPU_LINE_DOTS) + 1)      // See ppu_scanline_vblank
 
-#define PPU_FETCH_CYCLE(ppu) (((ppu->m_cycle - 1) & 7))
+// Entries of m_luma_columns and m_luma_rows, see ppu_luma_store
+#define PPU_LUMA_INDEX 0x00FF // Output column or row
+#define PPU_LUMA_FIRST 0x0100 // First column or row of a block
+#define PPU_LUMA_LAST 0x0200  // Last column or row of a block
+#define PPU_LUMA_NONE 0xFFFF  // Cropped or in a partial block
+#define PPU_LUMA_MAX_SCALE 16 // The sum of a block fits 16 bits
 
 typedef struct ppu_device_data *ppu_device_t;
 
@@ -167,6 +181,34 @@ struct ppu_device_data
 
     struct bus_data m_bus;
 
+    // Pattern fetch hook, see ppu_device_set_fetch_hook
+    ppu_fetch_hook_t m_fetch_hook;
+    void *m_fetch_hook_context;
+    uint8_t m_fetch_hook_tile_first;
+    uint8_t m_fetch_hook_tile_span; // a_tile_last - a_tile_first
+
+    ppu_output_t m_output; // See ppu_device_set_output
+    uint8_t *m_output_buffer; // See ppu_device_set_output_buffer
+
+    // Catch-up mode, see ppu_device_set_clock
+    bus_t m_cpu_bus;
+    uint64_t m_dot; // Dots run, 3 per CPU cycle of bus_data::m_clock
+    ppu_frame_callback_t m_frame_cb;
+    void *m_frame_cb_user_data;
+    uint32_t *m_nmi_out;
+
+    // Where sprite zero can hit on the current line, derived from the state, see ppu_sprite_zero_predict
+    uint32_t m_sprite_zero_dot;    // The dot showing bit 7 of m_sprite_zero_pattern
+    uint8_t m_sprite_zero_pattern; // Opaque pixels of sprite zero, 0 when it is not on the line
+
+    // PPU_OUTPUT_LUMA, see ppu_device_set_luma_format
+    const uint8_t *m_luma; // Luma of the 64 colors
+    uint16_t m_luma_columns[PPU_FRAME_VISIBLE_WIDTH];
+    uint16_t m_luma_rows[PPU_FRAME_VISIBLE_HEIGHT];
+    uint16_t m_luma_width;
+    uint16_t m_luma_divisor;
+    uint16_t m_luma_sums[PPU_FRAME_VISIBLE_WIDTH]; // Sums of the blocks of the output row being composed
+
     struct ppu_rgb_color_data frame[PPU_FRAME_VISIBLE_WIDTH * PPU_FRAME_VISIBLE_HEIGHT]; // Frame buffer
 };
 
@@ -183,6 +225,95 @@ static struct ppu_rgb_color_data const s_nes_palette[64] =
     {204, 210, 120}, {180, 222, 120}, {168, 226, 144}, {152, 226, 180}, {160, 214, 228}, {160, 162, 160}, {  0,   0,   0}, {  0,   0,   0}
 };
 
+typedef struct ppu_luma_table_data
+{
+    uint8_t m_luma[64];
+} *ppu_luma_table_t;
+
+static struct ppu_luma_table_data ppu_luma_table_build()
+{
+    struct ppu_luma_table_data table;
+
+    for (int i = 0; i < 64; i++)
+    {
+        // ITU-R BT.601 weights in 8-bit fixed point, they add up to 256
+        table.m_luma[i] = (uint8_t)(((77 * s_nes_palette[i].r) + (150 * s_nes_palette[i].g) + (29 * s_nes_palette[i].b) + 128) >> 8);
+    }
+
+    return table;
+}
+
+static const uint8_t *ppu_luma_table()
+{
+    // Built once on first use, the initialization of a function static is thread-safe
+    static const struct ppu_luma_table_data s_table = ppu_luma_table_build();
+
+    return s_table.m_luma;
+}
+
+// Add a pixel to its block, the first pixel of a block starts the sum and the last one stores the average
+static void ppu_luma_store(ppu_device_t a_ppu, uint32_t a_x, uint32_t a_y, uint8_t a_color)
+{
+    uint16_t column = a_ppu->m_luma_columns[a_x];
+    uint16_t row = a_ppu->m_luma_rows[a_y];
+
+    if (column == PPU_LUMA_NONE || row == PPU_LUMA_NONE)
+    {
+        return;
+    }
+
+    uint16_t *sum = &a_ppu->m_luma_sums[column & PPU_LUMA_INDEX];
+
+    *sum = ((column & row & PPU_LUMA_FIRST) ? 0 : *sum) + a_ppu->m_luma[a_color];
+
+    if (column & row & PPU_LUMA_LAST)
+    {
+        a_ppu->m_output_buffer[((row & PPU_LUMA_INDEX) * a_ppu->m_luma_width) + (column & PPU_LUMA_INDEX)] = (uint8_t)(*sum / a_ppu->m_luma_divisor);
+    }
+}
+
+// Map the pixels of one axis to output blocks, returns the number of blocks
+static uint16_t ppu_luma_axis(uint16_t *a_entries, uint32_t a_size, uint32_t a_crop_first, uint32_t a_crop_last, uint32_t a_scale)
+{
+    uint32_t blocks = (a_size - a_crop_first - a_crop_last) / a_scale;
+
+    for (uint32_t i = 0; i < a_size; i++)
+    {
+        uint32_t offset = i - a_crop_first;
+
+        if (i < a_crop_first || offset >= blocks * a_scale)
+        {
+            a_entries[i] = PPU_LUMA_NONE;
+            continue;
+        }
+
+        a_entries[i] = (uint16_t)(offset / a_scale);
+        a_entries[i] |= ((offset % a_scale) == 0) ? PPU_LUMA_FIRST : 0;
+        a_entries[i] |= ((offset % a_scale) == (a_scale - 1)) ? PPU_LUMA_LAST : 0;
+    }
+
+    return (uint16_t)blocks;
+}
+
+// Sprite zero can only hit at the dots where its pixel is opaque. Work them out from its counter and pattern as they
+// are before a_dot, then PPU_OUTPUT_NONE tests the background at those dots only. Called at the start of every
+// visible line and when PPUMASK changes, which stops and restarts the sprite counters.
+static void ppu_sprite_zero_predict(ppu_device_t a_ppu, uint32_t a_dot)
+{
+    a_ppu->m_sprite_zero_pattern = 0;
+
+    if (!a_ppu->m_registers.mask.sprites || a_ppu->m_nsprites == 0 || !a_ppu->sprite_attributes[0].is_sprite_zero)
+    {
+        return;
+    }
+
+    uint8_t counter = a_ppu->sprite_x_counter[0];
+
+    // A counter at 0 shifts the pattern from a_dot on, bit 7 was shown one dot before
+    a_ppu->m_sprite_zero_dot = counter ? a_dot + counter - 1 : a_dot - 1;
+    a_ppu->m_sprite_zero_pattern = a_ppu->sprite_shift_pat_lo[0] | a_ppu->sprite_shift_pat_hi[0];
+}
+
 static void ppu_ctrl_write(ppu_device_t a_ppu, uint8_t a_value)
 {
     a_ppu->m_registers.ctrl.raw = a_value;
@@ -193,6 +324,8 @@ static void ppu_ctrl_write(ppu_device_t a_ppu, uint8_t a_value)
 static void ppu_mask_write(ppu_device_t a_ppu, uint8_t a_value)
 {
     a_ppu->m_registers.mask.raw = a_value;
+
+    ppu_sprite_zero_predict(a_ppu, a_ppu->m_cycle);
 }
 
 static uint8_t ppu_status_read(ppu_device_t a_ppu)
@@ -431,6 +564,21 @@ static void ppu_update_shift_registers(ppu_device_t a_ppu)
     }
 }
 
+static inline void ppu_fetch_notify(ppu_device_t a_ppu, uint8_t a_tile, uint16_t a_addr)
+{
+    // No mapper registered a hook(NROM, MMC1...), this is the only cost per tile fetch
+    if (__builtin_expect(a_ppu->m_fetch_hook == nullptr, 1))
+    {
+        return;
+    }
+
+    // Unsigned wrap around makes this a single compare for the range check
+    if ((uint8_t)(a_tile - a_ppu->m_fetch_hook_tile_first) <= a_ppu->m_fetch_hook_tile_span)
+    {
+        a_ppu->m_fetch_hook(a_ppu->m_fetch_hook_context, a_addr);
+    }
+}
+
 static void ppu_vram_fetch_tick(ppu_device_t a_ppu)
 {
     switch (PPU_FETCH_CYCLE(a_ppu))
@@ -461,9 +609,13 @@ static void ppu_vram_fetch_tick(ppu_device_t a_ppu)
         a_ppu->bg_next_tile_lsb = a_ppu->m_bus.read8((a_ppu->m_registers.ctrl.background_table << 12) | (a_ppu->bg_next_tile_id << 4) | (a_ppu->v.fine_y + 0));
         break;
     case 6:
+    {
         // Get the pattern table address (high byte)
-        a_ppu->bg_next_tile_msb = a_ppu->m_bus.read8((a_ppu->m_registers.ctrl.background_table << 12) | (a_ppu->bg_next_tile_id << 4) | (a_ppu->v.fine_y + 8));
-        break;
+        uint16_t addr = (a_ppu->m_registers.ctrl.background_table << 12) | (a_ppu->bg_next_tile_id << 4) | (a_ppu->v.fine_y + 8);
+        a_ppu->bg_next_tile_msb = a_ppu->m_bus.read8(addr);
+        ppu_fetch_notify(a_ppu, a_ppu->bg_next_tile_id, addr);
+    }
+    break;
     case 7:
         if ((a_ppu->m_cycle <= 256) || (a_ppu->m_cycle == 328) || (a_ppu->m_cycle == 336))
         {
@@ -605,6 +757,7 @@ static void ppu_sprite_fetch(ppu_device_t a_ppu)
         // Read sprite pattern data
         a_ppu->sprite_shift_pat_lo[a_ppu->m_secondary_oam_idx] = a_ppu->m_bus.read8(addr);
         a_ppu->sprite_shift_pat_hi[a_ppu->m_secondary_oam_idx] = a_ppu->m_bus.read8(addr + 8);
+        ppu_fetch_notify(a_ppu, sprite->id, addr + 8);
 
         if (sprite->attr.flip_x)
         {
@@ -622,8 +775,33 @@ static void ppu_sprite_fetch(ppu_device_t a_ppu)
     }
 }
 
+// Sprite zero hit at the current pixel without composing it, for PPU_OUTPUT_NONE at the dots ppu_sprite_zero_predict
+// found. Sprite zero is the first sprite of the line whenever it is on it, so it is the sprite drawn wherever its
+// pixel is opaque.
+static void ppu_sprite_zero_test(ppu_device_t a_ppu)
+{
+    if (a_ppu->m_registers.status.sprite_zero_hit || !a_ppu->m_registers.mask.background || !a_ppu->m_registers.mask.sprites ||
+        a_ppu->m_nsprites == 0 || !a_ppu->sprite_attributes[0].is_sprite_zero || a_ppu->sprite_x_counter[0] != 0)
+    {
+        return;
+    }
+
+    uint16_t bit_mux = 0x8000 >> a_ppu->fine_x;
+
+    if (((a_ppu->sprite_shift_pat_lo[0] | a_ppu->sprite_shift_pat_hi[0]) & 0x80) &&
+        ((a_ppu->bg_shift_pat_lo | a_ppu->bg_shift_pat_hi) & bit_mux))
+    {
+        a_ppu->m_registers.status.sprite_zero_hit = 1;
+    }
+}
+
 static void ppu_scanline_visible(ppu_device_t a_ppu)
 {
+    if (a_ppu->m_cycle == 1)
+    {
+        ppu_sprite_zero_predict(a_ppu, 1);
+    }
+
     if (a_ppu->m_cycle <= 256 || (a_ppu->m_cycle >= 321 && a_ppu->m_cycle <= 336))
     {
         if (a_ppu->m_cycle <= 256)
@@ -656,7 +834,17 @@ static void ppu_scanline_visible(ppu_device_t a_ppu)
         return;
     }
 
-    if (a_ppu->m_cycle <= 256)
+    if (a_ppu->m_cycle <= 256 && a_ppu->m_output == PPU_OUTPUT_NONE)
+    {
+        // Nobody looks at the pixel, sprite zero hit is all that is left of it
+        uint32_t bit = a_ppu->m_cycle - a_ppu->m_sprite_zero_dot;
+
+        if (bit < 8 && ((a_ppu->m_sprite_zero_pattern << bit) & 0x80))
+        {
+            ppu_sprite_zero_test(a_ppu);
+        }
+    }
+    else if (a_ppu->m_cycle <= 256)
     {
         // Determine background pixel
         uint8_t bg_pixel = 0;
@@ -759,9 +947,21 @@ static void ppu_scanline_visible(ppu_device_t a_ppu)
 
         uint8_t color_value = a_ppu->m_palette[color_address & 0x1F] & 0x3F; // Mask to 6 bits
 
-        // Convert to RGB using the NES palette
-        a_ppu->frame[(a_ppu->m_scanline * PPU_FRAME_VISIBLE_WIDTH) + (a_ppu->m_cycle - 1)] = s_nes_palette[color_value];
-    
+        uint32_t offset = (a_ppu->m_scanline * PPU_FRAME_VISIBLE_WIDTH) + (a_ppu->m_cycle - 1);
+
+        if (a_ppu->m_output == PPU_OUTPUT_RGB)
+        {
+            // Convert to RGB using the NES palette
+            a_ppu->frame[offset] = s_nes_palette[color_value];
+        }
+        else if (a_ppu->m_output == PPU_OUTPUT_INDEX && a_ppu->m_output_buffer)
+        {
+            a_ppu->m_output_buffer[offset] = color_value;
+        }
+        else if (a_ppu->m_output == PPU_OUTPUT_LUMA && a_ppu->m_output_buffer)
+        {
+            ppu_luma_store(a_ppu, a_ppu->m_cycle - 1, a_ppu->m_scanline, color_value);
+        }
     }
 }
 
@@ -773,7 +973,7 @@ static void ppu_scanline_post_render(ppu_device_t a_ppu, ppu_frame_callback_t a_
         // Call the frame callback if provided
         if (a_frame_cb)
         {
-            a_frame_cb((ppu_rgb_color_t)a_ppu->frame, a_frame_cb_data);
+            a_frame_cb(a_ppu->m_output == PPU_OUTPUT_RGB ? (ppu_rgb_color_t)a_ppu->frame : nullptr, a_frame_cb_data);
         }
     }
 }
@@ -820,50 +1020,242 @@ static void ppu_scanline(ppu_device_t a_ppu, ppu_frame_callback_t a_frame_cb, vo
     }
 }
 
-void ppu_device_tick(bus_device_t a_ppu_device, ppu_frame_callback_t a_frame_cb, void *a_frame_cb_user_data, uint32_t *a_nmi_out)
+static inline void ppu_step(ppu_device_t a_ppu, ppu_frame_callback_t a_frame_cb, void *a_frame_cb_user_data, uint32_t *a_nmi_out)
 {
-    ppu_device_t ppu = DEVICE_TO_PPU(a_ppu_device);
-
     // Skip cycle 0 on scanline 0 of odd frames when rendering is enabled
-    bool skip_cycle = (ppu->m_scanline == 0 && ppu->m_cycle == 0 && ppu->frame_odd && (ppu->m_registers.mask.background || ppu->m_registers.mask.sprites));
+    bool skip_cycle = (a_ppu->m_scanline == 0 && a_ppu->m_cycle == 0 && a_ppu->frame_odd && (a_ppu->m_registers.mask.background || a_ppu->m_registers.mask.sprites));
 
     if (skip_cycle)
     {
         // Skip directly to cycle 1
-        ppu->m_cycle = 1;
+        a_ppu->m_cycle = 1;
     }
 
-    if (ppu->m_cycle == 0)
+    if (a_ppu->m_cycle == 0)
     {
         // Idle cycle
-        ppu_scanline_idle_cycle(ppu);
+        ppu_scanline_idle_cycle(a_ppu);
     }
     else
     {
-        ppu_scanline(ppu, a_frame_cb, a_frame_cb_user_data, a_nmi_out);
+        ppu_scanline(a_ppu, a_frame_cb, a_frame_cb_user_data, a_nmi_out);
     }
 
-    if (ppu->m_cycle < 341)
+    if (a_ppu->m_cycle < 341)
     {
         // Increment the cycle
-        ppu->m_cycle++;
+        a_ppu->m_cycle++;
     }
     else
     {
         // End of the scanline
-        ppu->m_cycle = 0;
-        ppu->m_scanline = (ppu->m_scanline + 1) % 262;
+        a_ppu->m_cycle = 0;
+        a_ppu->m_scanline = (a_ppu->m_scanline + 1) % 262;
+    }
+}
+
+uint32_t ppu_device_run(bus_device_t a_ppu_device, uint32_t a_dots, ppu_frame_callback_t a_frame_cb, void *a_frame_cb_user_data, uint32_t *a_nmi_out)
+{
+    ppu_device_t ppu = DEVICE_TO_PPU(a_ppu_device);
+
+    for (uint32_t dots = 1; dots <= a_dots; dots++)
+    {
+        uint32_t position = (ppu->m_scanline * PPU_LINE_DOTS) + ppu->m_cycle;
+
+        ppu_step(ppu, a_frame_cb, a_frame_cb_user_data, a_nmi_out);
+
+        // The owner has to see the frame end and the NMI edge before the PPU goes on
+        if (position == PPU_FRAME_END_POSITION || position == PPU_VBLANK_POSITION)
+        {
+            return dots;
+        }
+    }
+
+    return a_dots;
+}
+
+void ppu_device_tick(bus_device_t a_ppu_device, ppu_frame_callback_t a_frame_cb, void *a_frame_cb_user_data, uint32_t *a_nmi_out)
+{
+    ppu_step(DEVICE_TO_PPU(a_ppu_device), a_frame_cb, a_frame_cb_user_data, a_nmi_out);
+}
+
+// Dots to run until the one at a_event has run, from a_position. Odd frames skip a dot when the path crosses the
+// start of the frame, which is assumed to happen since rendering may be turned on before.
+static uint32_t ppu_dots_until(uint32_t a_position, uint32_t a_event)
+{
+    if (a_event >= a_position)
+    {
+        return a_event - a_position + (a_position == 0 ? 0 : 1);
+    }
+
+    return a_event + PPU_FRAME_DOTS - a_position;
+}
+
+// Post the start of vertical blank and the end of the frame for the CPU cycles whose dots include them. A register
+// write may change the course of the PPU before, the owner syncs and they are posted again.
+static void ppu_schedule(ppu_device_t a_ppu)
+{
+    if (!a_ppu->m_cpu_bus || !a_ppu->m_cpu_bus->m_scheduler)
+    {
+        return;
+    }
+
+    uint32_t position = (a_ppu->m_scanline * PPU_LINE_DOTS) + a_ppu->m_cycle;
+    scheduler_t scheduler = a_ppu->m_cpu_bus->m_scheduler;
+
+    scheduler->post(SCHEDULER_EVENT_PPU_VBLANK, (a_ppu->m_dot + ppu_dots_until(position, PPU_VBLANK_POSITION) + 2) / 3);
+    scheduler->post(SCHEDULER_EVENT_PPU_FRAME_END, (a_ppu->m_dot + ppu_dots_until(position, PPU_FRAME_END_POSITION) + 2) / 3);
+}
+
+void ppu_device_set_clock(bus_device_t a_ppu_device, bus_t a_cpu_bus, ppu_frame_callback_t a_frame_cb, void *a_frame_cb_user_data, uint32_t *a_nmi_out)
+{
+    ppu_device_t ppu = DEVICE_TO_PPU(a_ppu_device);
+
+    ppu->m_cpu_bus = a_cpu_bus;
+
+    // At power on the PPU only has the last dot of the first CPU cycle
+    ppu->m_dot = a_cpu_bus ? (a_cpu_bus->m_clock * 3) + 2 : 0;
+    ppu->m_frame_cb = a_frame_cb;
+    ppu->m_frame_cb_user_data = a_frame_cb_user_data;
+    ppu->m_nmi_out = a_nmi_out;
+
+    ppu_schedule(ppu);
+}
+
+// Run the dots up to the end of CPU cycle a_clock
+static void ppu_sync_to(ppu_device_t a_ppu, uint64_t a_clock)
+{
+    uint64_t end = a_clock * 3;
+
+    while (a_ppu->m_dot < end)
+    {
+        a_ppu->m_dot += ppu_device_run(&a_ppu->m_device, (uint32_t)(end - a_ppu->m_dot), a_ppu->m_frame_cb, a_ppu->m_frame_cb_user_data, a_ppu->m_nmi_out);
+    }
+}
+
+void ppu_device_sync(bus_device_t a_ppu_device)
+{
+    ppu_device_t ppu = DEVICE_TO_PPU(a_ppu_device);
+
+    if (ppu->m_cpu_bus)
+    {
+        ppu_sync_to(ppu, ppu->m_cpu_bus->m_clock);
     }
 }
 
+void ppu_device_handle_event(bus_device_t a_ppu_device)
+{
+    ppu_device_t ppu = DEVICE_TO_PPU(a_ppu_device);
+
+    ppu_sync_to(ppu, ppu->m_cpu_bus->m_clock + 1);
+    ppu_schedule(ppu);
+}
+
+void ppu_device_set_fetch_hook(bus_device_t a_ppu_device, uint8_t a_tile_first, uint8_t a_tile_last, ppu_fetch_hook_t a_hook, void *a_context)
+{
+    ppu_device_t ppu = DEVICE_TO_PPU(a_ppu_device);
+
+    assert(a_tile_first <= a_tile_last);
+
+    ppu->m_fetch_hook = a_hook;
+    ppu->m_fetch_hook_context = a_context;
+    ppu->m_fetch_hook_tile_first = a_tile_first;
+    ppu->m_fetch_hook_tile_span = a_tile_last - a_tile_first;
+}
+
 void ppu_device_attach(bus_device_t a_ppu_device, bus_device_t a_bus_device, uint16_t a_base, uint32_t a_size)
 {
     ppu_device_t ppu = DEVICE_TO_PPU(a_ppu_device);
     ppu->m_bus.attach(a_bus_device, a_base, a_size);
 }
 
+void ppu_device_set_output(bus_device_t a_ppu_device, ppu_output_t a_output)
+{
+    DEVICE_TO_PPU(a_ppu_device)->m_output = a_output;
+}
+
+void ppu_device_set_output_buffer(bus_device_t a_ppu_device, uint8_t *a_buffer)
+{
+    DEVICE_TO_PPU(a_ppu_device)->m_output_buffer = a_buffer;
+}
+
+bool ppu_luma_format_size(const struct ppu_luma_format_data *a_format, uint16_t *a_width, uint16_t *a_height)
+{
+    uint32_t scale = a_format->m_scale;
+
+    if (scale == 0 || scale > PPU_LUMA_MAX_SCALE ||
+        a_format->m_crop_left + a_format->m_crop_right + scale > PPU_FRAME_VISIBLE_WIDTH ||
+        a_format->m_crop_top + a_format->m_crop_bottom + scale > PPU_FRAME_VISIBLE_HEIGHT)
+    {
+        return false;
+    }
+
+    if (a_width)
+    {
+        *a_width = (uint16_t)((PPU_FRAME_VISIBLE_WIDTH - a_format->m_crop_left - a_format->m_crop_right) / scale);
+    }
+
+    if (a_height)
+    {
+        *a_height = (uint16_t)((PPU_FRAME_VISIBLE_HEIGHT - a_format->m_crop_top - a_format->m_crop_bottom) / scale);
+    }
+
+    return true;
+}
+
+bool ppu_device_set_luma_format(bus_device_t a_ppu_device, const struct ppu_luma_format_data *a_format, uint16_t *a_width, uint16_t *a_height)
+{
+    ppu_device_t ppu = DEVICE_TO_PPU(a_ppu_device);
+
+    if (!ppu_luma_format_size(a_format, a_width, a_height))
+    {
+        return false;
+    }
+
+    ppu->m_luma = ppu_luma_table();
+    ppu->m_luma_width = ppu_luma_axis(ppu->m_luma_columns, PPU_FRAME_VISIBLE_WIDTH, a_format->m_crop_left, a_format->m_crop_right, a_format->m_scale);
+    ppu_luma_axis(ppu->m_luma_rows, PPU_FRAME_VISIBLE_HEIGHT, a_format->m_crop_top, a_format->m_crop_bottom, a_format->m_scale);
+    ppu->m_luma_divisor = (uint16_t)(a_format->m_scale * a_format->m_scale);
+
+    return true;
+}
+
+void ppu_device_reset(bus_device_t a_ppu_device)
+{
+    ppu_device_t ppu = DEVICE_TO_PPU(a_ppu_device);
+
+    ppu_device_sync(a_ppu_device);
+
+    // The reset line clears the control and mask registers, the write toggle and the read buffer. The rest, VRAM,
+    // OAM and the position in the frame included, goes on as it is.
+    ppu_ctrl_write(ppu, 0);
+    ppu_mask_write(ppu, 0);
+    ppu->w = 0;
+    ppu->vram_data = 0;
+}
+
+ppu_rgb_color_t ppu_device_frame_buffer(bus_device_t a_ppu_device)
+{
+    return DEVICE_TO_PPU(a_ppu_device)->frame;
+}
+
+bus_t ppu_device_bus(bus_device_t a_ppu_device)
+{
+    return &DEVICE_TO_PPU(a_ppu_device)->m_bus;
+}
+
+void ppu_device_read_memory(bus_device_t a_ppu_device, uint8_t *a_oam, uint8_t *a_palette)
+{
+    ppu_device_t ppu = DEVICE_TO_PPU(a_ppu_device);
+
+    memcpy(a_oam, ppu->m_primary_oam.raw, sizeof(ppu->m_primary_oam.raw));
+    memcpy(a_palette, ppu->m_palette, sizeof(ppu->m_palette));
+}
+
 static uint8_t ppu_read8(bus_device_t a_dev, uint16_t a_addr)
 {
+    ppu_device_sync(a_dev);
+
     switch (a_addr & 0x7)
     {
     case 2: // PPUSTATUS
@@ -878,6 +1270,8 @@ static uint8_t ppu_read8(bus_device_t a_dev, uint16_t a_addr)
 
 static void ppu_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
 {
+    ppu_device_sync(a_dev);
+
     switch (a_addr & 0x7)
     {
     case 0: // PPUCTRL
@@ -904,16 +1298,47 @@ static void ppu_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
     }
 }
 
+static size_t ppu_state_size(bus_device_t a_dev)
+{
+    return PPU_STATE_SIZE;
+}
+
+static void ppu_state_save(bus_device_t a_dev, uint8_t *a_buffer)
+{
+    ppu_device_sync(a_dev);
+
+    memcpy(a_buffer, (uint8_t *)DEVICE_TO_PPU(a_dev) + PPU_STATE_OFFSET, PPU_STATE_SIZE);
+}
+
+static void ppu_state_load(bus_device_t a_dev, const uint8_t *a_buffer)
+{
+    ppu_device_t ppu = DEVICE_TO_PPU(a_dev);
+
+    memcpy((uint8_t *)ppu + PPU_STATE_OFFSET, a_buffer, PPU_STATE_SIZE);
+    ppu_sprite_zero_predict(ppu, ppu->m_cycle);
+
+    if (ppu->m_cpu_bus)
+    {
+        ppu->m_dot = ppu->m_cpu_bus->m_clock * 3;
+        ppu_schedule(ppu);
+    }
+}
+
 static struct bus_device_ops_data g_ppu_ops =
 {
         .read8 = ppu_read8,
-        .write8 = ppu_write8
+        .write8 = ppu_write8,
+        .sync = nullptr,
+        .state_size = ppu_state_size,
+        .state_save = ppu_state_save,
+        .state_load = ppu_state_load,
+        .destroy = ppu_device_destroy
 };
 
 bus_device_t ppu_device_create()
 {
-    ppu_device_t ppu = (ppu_device_t)malloc(sizeof(ppu_device_data));
-    *ppu = {};
+    // Zeroed including the padding, states are compared byte for byte
+    ppu_device_t ppu = (ppu_device_t)calloc(1, sizeof(ppu_device_data));
     ppu->m_device.m_ops = &g_ppu_ops;
 
     for (int i = 0; i < 0x100; i++)
@@ -923,6 +1348,9 @@ bus_device_t ppu_device_create()
 
     ppu->m_bus.initialize();
 
+    struct ppu_luma_format_data luma_format = { 1, 0, 0, 0, 0 };
+    ppu_device_set_luma_format(&ppu->m_device, &luma_format, nullptr, nullptr);
+
     return &ppu->m_device;
 }
 
@@ -2,6 +2,10 @@
 
 #include "hw_types.h"
 
+#define PPU_FRAME_VISIBLE_WIDTH 256
+
+#define PPU_FRAME_VISIBLE_HEIGHT 240
+
 typedef struct ppu_rgb_color_data
 {
     uint8_t r;
@@ -9,12 +13,93 @@ typedef struct ppu_rgb_color_data
     uint8_t b;
 } *ppu_rgb_color_t;
 
+// a_frame_buffer is nullptr when the frame was not composed in RGB, see ppu_device_set_output
 typedef void (*ppu_frame_callback_t)(ppu_rgb_color_t a_frame_buffer, void *a_user_data);
 
+typedef enum ppu_output
+{
+    PPU_OUTPUT_RGB,   // Compose the frame buffer (default)
+    PPU_OUTPUT_NONE,  // Emulate the frame without composing pixels, for frames nobody looks at
+    PPU_OUTPUT_INDEX, // Store the 6-bit palette index of each pixel in the buffer set with ppu_device_set_output_buffer
+    PPU_OUTPUT_LUMA   // Store a cropped, downscaled grayscale frame there, see ppu_device_set_luma_format
+} ppu_output_t;
+
+// PPU_OUTPUT_LUMA keeps the frame minus the crop margins, each m_scale x m_scale block of it averaged into one byte
+// of luma. Blocks cut off at the right and bottom edge are dropped. 128x120 is m_scale 2 without crop, 84x84 is
+// m_scale 2 of the 168x168 pixels left by cropping 44 columns on both sides and 36 lines at top and bottom.
+typedef struct ppu_luma_format_data
+{
+    uint8_t m_scale; // 1 to 16
+    uint8_t m_crop_left;
+    uint8_t m_crop_right;
+    uint8_t m_crop_top;
+    uint8_t m_crop_bottom;
+} *ppu_luma_format_t;
+
+// Called after the PPU has fetched the high bit plane of a background or sprite tile whose
+// number is in the range registered with ppu_device_set_fetch_hook. a_addr is the pattern
+// table address that was read ($0xx8-$0xxF or $1xx8-$1xxF).
+typedef void (*ppu_fetch_hook_t)(void *a_context, uint16_t a_addr);
+
 bus_device_t ppu_device_create();
 
 void ppu_device_destroy(bus_device_t a_ppu_device);
 
 void ppu_device_tick(bus_device_t a_ppu_device, ppu_frame_callback_t a_frame_cb, void *a_frame_cb_user_data, uint32_t *a_nmi_out);
 
-void ppu_device_attach(bus_device_t a_ppu_device, bus_device_t a_bus_device, uint16_t a_base, uint32_t a_size);
\ No newline at end of file
+// Run up to a_dots dots, stopping after the dot that finishes the frame (the callback was called) or the one that
+// starts vertical blank (NMI may have been raised). Returns the dots run.
+uint32_t ppu_device_run(bus_device_t a_ppu_device, uint32_t a_dots, ppu_frame_callback_t a_frame_cb, void *a_frame_cb_user_data, uint32_t *a_nmi_out);
+
+// Catch-up mode: instead of being ticked in lockstep with the CPU, the PPU counts the dots it ran and runs up to
+// bus_data::m_clock of a_cpu_bus on its own whenever the CPU accesses one of its registers or ppu_device_sync is
+// called, 3 dots per cycle. The callback and the NMI flag are the ones ppu_device_tick would be given. The PPU is
+// taken to be powered on at the clock now and to have run the cycle on the clock whenever a state is loaded.
+// a_cpu_bus = nullptr goes back to lockstep.
+//
+// The PPU posts SCHEDULER_EVENT_PPU_VBLANK and SCHEDULER_EVENT_PPU_FRAME_END on the bus' scheduler for the CPU cycle
+// in which it raises NMI or finishes a frame, unless a register write changes its course before. They may be a cycle
+// early, the owner calls ppu_device_handle_event before the CPU runs that cycle.
+void ppu_device_set_clock(bus_device_t a_ppu_device, bus_t a_cpu_bus, ppu_frame_callback_t a_frame_cb, void *a_frame_cb_user_data, uint32_t *a_nmi_out);
+
+// Run the dots up to the end of the CPU cycle on the clock. Whatever else changes what the PPU reads, like mapper CHR
+// banks, has to call it first.
+void ppu_device_sync(bus_device_t a_ppu_device);
+
+// Run the dots of the CPU cycle after the one on the clock, which may call the frame callback and raise NMI, and post
+// the next events
+void ppu_device_handle_event(bus_device_t a_ppu_device);
+
+// Register a pattern fetch hook for tiles a_tile_first to a_tile_last (inclusive), a_hook = nullptr removes it.
+// Only one hook can be registered, it is meant for mappers that latch on PPU fetches (MMC2/MMC4).
+void ppu_device_set_fetch_hook(bus_device_t a_ppu_device, uint8_t a_tile_first, uint8_t a_tile_last, ppu_fetch_hook_t a_hook, void *a_context);
+
+void ppu_device_attach(bus_device_t a_ppu_device, bus_device_t a_bus_device, uint16_t a_base, uint32_t a_size);
+
+// Takes effect from the next pixel, switch between frames to get whole frames of one kind
+void ppu_device_set_output(bus_device_t a_ppu_device, ppu_output_t a_output);
+
+// Where PPU_OUTPUT_INDEX and PPU_OUTPUT_LUMA store the pixels, PPU_FRAME_VISIBLE_WIDTH x PPU_FRAME_VISIBLE_HEIGHT
+// bytes for PPU_OUTPUT_INDEX. The buffer is written in place and must stay valid while it is set, nullptr stores
+// nothing.
+void ppu_device_set_output_buffer(bus_device_t a_ppu_device, uint8_t *a_buffer);
+
+// The size of a frame in a_format, false if the scale is out of range or the crop leaves less than one block
+bool ppu_luma_format_size(const struct ppu_luma_format_data *a_format, uint16_t *a_width, uint16_t *a_height);
+
+// Set the format of PPU_OUTPUT_LUMA and return the size of a frame in it. Returns false and leaves the format
+// unchanged if ppu_luma_format_size does. The default is m_scale 1 without crop.
+bool ppu_device_set_luma_format(bus_device_t a_ppu_device, const struct ppu_luma_format_data *a_format, uint16_t *a_width, uint16_t *a_height);
+
+// The reset button, between CPU cycles
+void ppu_device_reset(bus_device_t a_ppu_device);
+
+// The last frame composed in RGB, PPU_FRAME_VISIBLE_WIDTH x PPU_FRAME_VISIBLE_HEIGHT pixels. Lines are only composed
+// while rendering is enabled, the others keep what was there before.
+ppu_rgb_color_t ppu_device_frame_buffer(bus_device_t a_ppu_device);
+
+// The PPU's own address space with the pattern tables and nametables the mapper attached
+bus_t ppu_device_bus(bus_device_t a_ppu_device);
+
+// Copy the 256 bytes of OAM and the 32 of palette RAM
+void ppu_device_read_memory(bus_device_t a_ppu_device, uint8_t *a_oam, uint8_t *a_palette);
\ No newline at end of file
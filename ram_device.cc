@@ -1,4 +1,9 @@
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "ram_device.h"
 #include "bus.h"
@@ -9,7 +14,9 @@ typedef struct ram_device_data
 {
     struct bus_device_data m_device;
     uint16_t m_size;
-    uint8_t m_data[2];
+    uint8_t m_file_backed; // m_data points to a shared file mapping instead of m_storage
+    uint8_t *m_data;
+    uint8_t m_storage[2];
 } *ram_device_t;
 
 static uint8_t ram_read8(bus_device_t a_dev, uint16_t a_addr)
@@ -25,19 +32,96 @@ static void ram_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
     ram->m_data[a_addr & (ram->m_size - 1)] = a_value;
 }
 
-struct bus_device_ops_data g_ram_ops = 
+// Writes to ROM are ignored, they usually target mapper registers that this device does not have
+static void rom_write8(bus_device_t a_dev, uint16_t a_addr, uint8_t a_value)
+{
+}
+
+static size_t ram_state_size(bus_device_t a_dev)
+{
+    return DEVICE_TO_RAM(a_dev)->m_size;
+}
+
+static void ram_state_save(bus_device_t a_dev, uint8_t *a_buffer)
+{
+    ram_device_t ram = DEVICE_TO_RAM(a_dev);
+
+    memcpy(a_buffer, ram->m_data, ram->m_size);
+}
+
+static void ram_state_load(bus_device_t a_dev, const uint8_t *a_buffer)
+{
+    ram_device_t ram = DEVICE_TO_RAM(a_dev);
+
+    memcpy(ram->m_data, a_buffer, ram->m_size);
+}
+
+// Every page written to in the shared mapping goes back to the file, and rewind and run-ahead load a state each frame.
+// Battery RAM rarely changes between those states, so only copy when it did.
+static void ram_file_state_load(bus_device_t a_dev, const uint8_t *a_buffer)
+{
+    ram_device_t ram = DEVICE_TO_RAM(a_dev);
+
+    if (memcmp(ram->m_data, a_buffer, ram->m_size) != 0)
+    {
+        memcpy(ram->m_data, a_buffer, ram->m_size);
+    }
+}
+
+static void ram_sync(bus_device_t a_dev)
+{
+    ram_device_t ram = DEVICE_TO_RAM(a_dev);
+
+    // Schedule the write back, the kernel does it anyway but this bounds the window for power loss
+    msync(ram->m_data, ram->m_size, MS_ASYNC);
+}
+
+static struct bus_device_ops_data g_ram_ops =
 {
     .read8 = ram_read8,
-    .write8 = ram_write8
+    .write8 = ram_write8,
+    .sync = nullptr,
+    .state_size = ram_state_size,
+    .state_save = ram_state_save,
+    .state_load = ram_state_load,
+    .destroy = ram_device_destroy
 };
 
-bus_device_t ram_device_create(uint16_t a_size)
+static struct bus_device_ops_data g_ram_file_ops =
+{
+    .read8 = ram_read8,
+    .write8 = ram_write8,
+    .sync = ram_sync,
+    .state_size = ram_state_size,
+    .state_save = ram_state_save,
+    .state_load = ram_file_state_load,
+    .destroy = ram_device_destroy
+};
+
+// ROM contents come from the cartridge image, they are not part of the state
+static struct bus_device_ops_data g_rom_ops =
+{
+    .read8 = ram_read8,
+    .write8 = rom_write8,
+    .sync = nullptr,
+    .state_size = nullptr,
+    .state_save = nullptr,
+    .state_load = nullptr,
+    .destroy = ram_device_destroy
+};
+
+static uint16_t ram_device_round_size(uint16_t a_size)
 {
     // Round up the size to the nearest page
     a_size = (a_size + PAGE_MASK) & ~PAGE_MASK;
 
     // Round up to nearest power of 2, makes modulo operations faster by using bitwise AND
-    a_size = 1 << (32 - __builtin_clz(a_size - 1));
+    return 1 << (32 - __builtin_clz(a_size - 1));
+}
+
+bus_device_t ram_device_create(uint16_t a_size)
+{
+    a_size = ram_device_round_size(a_size);
 
     ram_device_t ram = (ram_device_t)malloc(sizeof(ram_device_data) + a_size);
 
@@ -45,6 +129,8 @@ bus_device_t ram_device_create(uint16_t a_size)
 
     ram->m_size = a_size;
 
+    ram->m_data = ram->m_storage;
+
     ram->m_device.m_ops = &g_ram_ops;
 
     for (int i = 0; i < ram->m_size; i++)
@@ -55,6 +141,80 @@ bus_device_t ram_device_create(uint16_t a_size)
     return &ram->m_device;
 }
 
+bus_device_t ram_device_create_rom(const uint8_t *a_data, uint16_t a_size)
+{
+    ram_device_t rom = (ram_device_t)malloc(sizeof(ram_device_data));
+
+    *rom = {};
+
+    rom->m_size = a_size;
+
+    // Only ever read, writes go to rom_write8
+    rom->m_data = (uint8_t *)a_data;
+
+    rom->m_device.m_ops = &g_rom_ops;
+
+    return &rom->m_device;
+}
+
+bus_device_t ram_device_create_file_backed(uint16_t a_size, const char *a_path)
+{
+    a_size = ram_device_round_size(a_size);
+
+    int fd = open(a_path, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+
+    // A new (or short) save file is grown to the device size, the new bytes read as zero
+    if ((fstat(fd, &st) != 0) || ((st.st_size < a_size) && (ftruncate(fd, a_size) != 0)))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void *data = mmap(nullptr, a_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // The mapping keeps its own reference to the file
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    ram_device_t ram = (ram_device_t)malloc(sizeof(ram_device_data));
+
+    *ram = {};
+
+    ram->m_size = a_size;
+
+    ram->m_file_backed = 1;
+
+    ram->m_data = (uint8_t *)data;
+
+    ram->m_device.m_ops = &g_ram_file_ops;
+
+    return &ram->m_device;
+}
+
+void ram_device_destroy(bus_device_t a_ram_device)
+{
+    ram_device_t ram = DEVICE_TO_RAM(a_ram_device);
+
+    if (ram->m_file_backed)
+    {
+        // Dirty pages stay in the page cache and are written back by the kernel, no copy needed
+        munmap(ram->m_data, ram->m_size);
+    }
+
+    free(ram);
+}
+
 uint16_t ram_device_size(bus_device_t a_device)
 {
     ram_device_t ram = DEVICE_TO_RAM(a_device);
@@ -82,4 +242,20 @@ size_t ram_device_write_buffer(bus_device_t a_ram_device, uint16_t a_addr, const
     }
 
     return bytes_written;
-}
\ No newline at end of file
+}
+
+size_t ram_device_read_buffer(bus_device_t a_ram_device, uint16_t a_addr, uint8_t *a_buffer, size_t a_size)
+{
+    ram_device_t ram = DEVICE_TO_RAM(a_ram_device);
+
+    if (a_addr >= ram->m_size)
+    {
+        return 0;
+    }
+
+    size_t bytes_read = (a_size < (size_t)(ram->m_size - a_addr)) ? a_size : (size_t)(ram->m_size - a_addr);
+
+    memcpy(a_buffer, ram->m_data + a_addr, bytes_read);
+
+    return bytes_read;
+}
@@ -4,8 +4,24 @@
 
 bus_device_t ram_device_create(uint16_t a_size);
 
+// Create a read-only device over a_data, which is not copied and has to outlive the device. a_size must be a power
+// of two of at least a page. Bus writes are ignored and the contents are not part of save states.
+bus_device_t ram_device_create_rom(const uint8_t *a_data, uint16_t a_size);
+
+// Create a RAM device backed by a MAP_SHARED mapping of the file at a_path, the file is created or grown to the
+// device size. Writes land directly in the page cache and are written back by the kernel, there is no explicit
+// save step, and loading a state writes the contents it has to the file. Returns nullptr if the file could not be
+// mapped.
+bus_device_t ram_device_create_file_backed(uint16_t a_size, const char *a_path);
+
+void ram_device_destroy(bus_device_t a_ram_device);
+
 uint16_t ram_device_size(bus_device_t a_ram_device);
 
-// Utility function to write a buffer to the RAM device
+// Utility function to write a buffer to the RAM device, not for ROM devices
 // Returns the number of bytes written
-size_t ram_device_write_buffer(bus_device_t a_ram_device, uint16_t a_addr, const uint8_t *a_buffer, size_t a_size);
\ No newline at end of file
+size_t ram_device_write_buffer(bus_device_t a_ram_device, uint16_t a_addr, const uint8_t *a_buffer, size_t a_size);
+
+// Utility function to read the RAM device into a buffer
+// Returns the number of bytes read
+size_t ram_device_read_buffer(bus_device_t a_ram_device, uint16_t a_addr, uint8_t *a_buffer, size_t a_size);
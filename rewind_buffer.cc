@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind_buffer.h"
+#include "nes_host.h"
+
+// Unchanged bytes inside a run of changed ones are kept as literals unless there are at least this many in a row,
+// a shorter run is cheaper than the header of a new record
+#define REWIND_MIN_ZERO_RUN 4
+#define REWIND_RECORD_MAX 0xFFFF
+
+// A delta is a sequence of records, each a little endian uint16_t count of unchanged bytes to skip, a uint16_t count
+// of literals and that many XORed bytes. Unchanged bytes at the end are not recorded.
+//
+// The history is a ring of entries, a uint32_t length, the delta and the length again. The leading length lets the
+// oldest entry be dropped, the trailing one lets the newest be popped.
+typedef struct rewind_buffer_data
+{
+    size_t m_state_size;
+    uint32_t m_interval;
+    uint32_t m_frame;
+
+    uint8_t *m_current;  // Newest snapshot
+    bool m_has_current;
+    uint8_t *m_scratch;  // Delta being encoded
+
+    uint8_t *m_ring;
+    size_t m_capacity;
+    size_t m_head;       // Where the next entry goes
+    size_t m_tail;       // Oldest entry
+    size_t m_end;        // End of the entries behind m_tail when the ring has wrapped
+    bool m_wrapped;      // The entries are [m_tail, m_end) and [0, m_head), otherwise [m_tail, m_head)
+    uint32_t m_count;
+    size_t m_used;
+
+    uint64_t m_push_count;
+    uint64_t m_push_ns;
+} *rewind_buffer_t;
+
+static uint8_t *rewind_buffer_put_record(uint8_t *a_out, size_t a_skip, const uint8_t *a_old, const uint8_t *a_new, size_t a_count)
+{
+    uint16_t header[2] = { (uint16_t)a_skip, (uint16_t)a_count };
+
+    memcpy(a_out, header, sizeof(header));
+    a_out += sizeof(header);
+
+    for (size_t i = 0; i < a_count; i++)
+    {
+        a_out[i] = a_old[i] ^ a_new[i];
+    }
+
+    return a_out + a_count;
+}
+
+static size_t rewind_buffer_encode(const uint8_t *a_old, const uint8_t *a_new, size_t a_size, uint8_t *a_out)
+{
+    uint8_t *out = a_out;
+    size_t pos = 0;
+
+    while (pos < a_size)
+    {
+        size_t skip_start = pos;
+
+        // Skip unchanged bytes, eight at a time while possible
+        while (pos + 8 <= a_size)
+        {
+            uint64_t old_word;
+            uint64_t new_word;
+            memcpy(&old_word, a_old + pos, 8);
+            memcpy(&new_word, a_new + pos, 8);
+
+            if (old_word != new_word)
+            {
+                break;
+            }
+
+            pos += 8;
+        }
+
+        while (pos < a_size && a_old[pos] == a_new[pos])
+        {
+            pos++;
+        }
+
+        if (pos == a_size)
+        {
+            break;
+        }
+
+        size_t skip = pos - skip_start;
+
+        // The literal ends where enough unchanged bytes follow
+        size_t literal_start = pos;
+        size_t zeros = 0;
+
+        while (pos < a_size && zeros < REWIND_MIN_ZERO_RUN)
+        {
+            zeros = (a_old[pos] == a_new[pos]) ? zeros + 1 : 0;
+            pos++;
+        }
+
+        pos -= zeros;
+
+        while (skip > REWIND_RECORD_MAX)
+        {
+            out = rewind_buffer_put_record(out, REWIND_RECORD_MAX, nullptr, nullptr, 0);
+            skip -= REWIND_RECORD_MAX;
+        }
+
+        for (size_t literal = literal_start; literal < pos; literal += REWIND_RECORD_MAX)
+        {
+            size_t count = (pos - literal < REWIND_RECORD_MAX) ? pos - literal : REWIND_RECORD_MAX;
+
+            out = rewind_buffer_put_record(out, skip, a_old + literal, a_new + literal, count);
+            skip = 0;
+        }
+    }
+
+    return out - a_out;
+}
+
+// XOR the delta into a_state, which turns either of the two snapshots it was made from into the other one
+static void rewind_buffer_apply(uint8_t *a_state, const uint8_t *a_delta, size_t a_length)
+{
+    const uint8_t *end = a_delta + a_length;
+    uint8_t *state = a_state;
+
+    while (a_delta < end)
+    {
+        uint16_t header[2];
+        memcpy(header, a_delta, sizeof(header));
+        a_delta += sizeof(header);
+
+        state += header[0];
+
+        for (size_t i = 0; i < header[1]; i++)
+        {
+            state[i] ^= a_delta[i];
+        }
+
+        state += header[1];
+        a_delta += header[1];
+    }
+}
+
+static void rewind_buffer_clear(rewind_buffer_t a_rewind)
+{
+    a_rewind->m_head = 0;
+    a_rewind->m_tail = 0;
+    a_rewind->m_end = 0;
+    a_rewind->m_wrapped = false;
+    a_rewind->m_count = 0;
+    a_rewind->m_used = 0;
+}
+
+static void rewind_buffer_drop_oldest(rewind_buffer_t a_rewind)
+{
+    uint32_t length;
+    memcpy(&length, a_rewind->m_ring + a_rewind->m_tail, sizeof(length));
+
+    a_rewind->m_tail += length + 2 * sizeof(uint32_t);
+    a_rewind->m_used -= length + 2 * sizeof(uint32_t);
+
+    if (--a_rewind->m_count == 0)
+    {
+        rewind_buffer_clear(a_rewind);
+    }
+    else if (a_rewind->m_wrapped && a_rewind->m_tail == a_rewind->m_end)
+    {
+        a_rewind->m_tail = 0;
+        a_rewind->m_wrapped = false;
+    }
+}
+
+static void rewind_buffer_store(rewind_buffer_t a_rewind, const uint8_t *a_delta, uint32_t a_length)
+{
+    size_t entry_size = a_length + 2 * sizeof(uint32_t);
+
+    if (entry_size > a_rewind->m_capacity)
+    {
+        // Does not fit at all, the history before this snapshot is lost
+        rewind_buffer_clear(a_rewind);
+        return;
+    }
+
+    // Make room at m_head, wrapping around and dropping the oldest entries as needed
+    for (;;)
+    {
+        if (!a_rewind->m_wrapped)
+        {
+            if (a_rewind->m_head + entry_size <= a_rewind->m_capacity)
+            {
+                break;
+            }
+
+            a_rewind->m_end = a_rewind->m_head;
+            a_rewind->m_head = 0;
+            a_rewind->m_wrapped = a_rewind->m_count > 0;
+            continue;
+        }
+
+        if (a_rewind->m_head + entry_size <= a_rewind->m_tail)
+        {
+            break;
+        }
+
+        rewind_buffer_drop_oldest(a_rewind);
+    }
+
+    uint8_t *entry = a_rewind->m_ring + a_rewind->m_head;
+
+    memcpy(entry, &a_length, sizeof(a_length));
+    memcpy(entry + sizeof(a_length), a_delta, a_length);
+    memcpy(entry + sizeof(a_length) + a_length, &a_length, sizeof(a_length));
+
+    a_rewind->m_head += entry_size;
+    a_rewind->m_used += entry_size;
+    a_rewind->m_count++;
+}
+
+rewind_buffer_t rewind_buffer_create(size_t a_state_size, size_t a_budget, uint32_t a_interval)
+{
+    rewind_buffer_t rewind = (rewind_buffer_t)calloc(1, sizeof(struct rewind_buffer_data));
+
+    rewind->m_state_size = a_state_size;
+    rewind->m_interval = a_interval ? a_interval : 1;
+    rewind->m_current = (uint8_t *)malloc(a_state_size);
+    // Worst case of the encoding, a record header for every REWIND_MIN_ZERO_RUN + 1 bytes
+    rewind->m_scratch = (uint8_t *)malloc(2 * a_state_size + 64);
+    rewind->m_capacity = a_budget;
+    rewind->m_ring = (uint8_t *)malloc(a_budget);
+
+    return rewind;
+}
+
+void rewind_buffer_destroy(rewind_buffer_t a_rewind)
+{
+    free(a_rewind->m_ring);
+    free(a_rewind->m_scratch);
+    free(a_rewind->m_current);
+    free(a_rewind);
+}
+
+void rewind_buffer_push(rewind_buffer_t a_rewind, const uint8_t *a_state)
+{
+    if (a_rewind->m_frame++ % a_rewind->m_interval)
+    {
+        return;
+    }
+
+    uint64_t start = nes_host_now_ns();
+
+    if (a_rewind->m_has_current)
+    {
+        size_t length = rewind_buffer_encode(a_rewind->m_current, a_state, a_rewind->m_state_size, a_rewind->m_scratch);
+
+        rewind_buffer_store(a_rewind, a_rewind->m_scratch, (uint32_t)length);
+    }
+
+    memcpy(a_rewind->m_current, a_state, a_rewind->m_state_size);
+    a_rewind->m_has_current = true;
+
+    a_rewind->m_push_count++;
+    a_rewind->m_push_ns += nes_host_now_ns() - start;
+}
+
+bool rewind_buffer_step_back(rewind_buffer_t a_rewind, uint8_t *a_state)
+{
+    if (!a_rewind->m_has_current)
+    {
+        return false;
+    }
+
+    if (a_rewind->m_count)
+    {
+        uint32_t length;
+        memcpy(&length, a_rewind->m_ring + a_rewind->m_head - sizeof(length), sizeof(length));
+
+        size_t entry_size = length + 2 * sizeof(uint32_t);
+
+        a_rewind->m_head -= entry_size;
+
+        rewind_buffer_apply(a_rewind->m_current, a_rewind->m_ring + a_rewind->m_head + sizeof(length), length);
+
+        a_rewind->m_used -= entry_size;
+
+        if (--a_rewind->m_count == 0)
+        {
+            rewind_buffer_clear(a_rewind);
+        }
+        else if (a_rewind->m_wrapped && a_rewind->m_head == 0)
+        {
+            a_rewind->m_head = a_rewind->m_end;
+            a_rewind->m_wrapped = false;
+        }
+    }
+
+    // The next push is a full interval from the snapshot stepped back to
+    a_rewind->m_frame = 1;
+
+    memcpy(a_state, a_rewind->m_current, a_rewind->m_state_size);
+
+    return true;
+}
+
+void rewind_buffer_stats(rewind_buffer_t a_rewind, rewind_buffer_stats_t a_stats)
+{
+    a_stats->m_snapshots = a_rewind->m_has_current ? a_rewind->m_count + 1 : 0;
+    a_stats->m_bytes_used = a_rewind->m_used;
+    a_stats->m_bytes_raw = (size_t)a_stats->m_snapshots * a_rewind->m_state_size;
+    a_stats->m_push_count = a_rewind->m_push_count;
+    a_stats->m_push_ns = a_rewind->m_push_ns;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Rewind history of save states (see nes_state.h) in a fixed memory budget. The newest snapshot is kept as is,
+// every older one only as the XOR of it and its successor, run-length encoded. Between two frames most of the
+// state does not change, so the deltas are mostly runs of zeros. Stepping back applies one delta to the newest
+// snapshot, the cost does not depend on the length of the history. When the budget is used up the oldest deltas
+// are dropped.
+
+typedef struct rewind_buffer_data *rewind_buffer_t;
+
+typedef struct rewind_buffer_stats_data
+{
+    uint32_t m_snapshots;      // Snapshots that can be stepped back to, including the newest
+    size_t m_bytes_used;       // Bytes taken by the deltas
+    size_t m_bytes_raw;        // Bytes the same snapshots take as full states
+    uint64_t m_push_count;     // Snapshots stored since creation
+    uint64_t m_push_ns;        // Time spent encoding them
+} *rewind_buffer_stats_t;
+
+// a_budget is the memory for the deltas in bytes, a snapshot is stored every a_interval frames
+rewind_buffer_t rewind_buffer_create(size_t a_state_size, size_t a_budget, uint32_t a_interval);
+
+void rewind_buffer_destroy(rewind_buffer_t a_rewind);
+
+// Call once per frame with the current state, only every a_interval-th call stores it
+void rewind_buffer_push(rewind_buffer_t a_rewind, const uint8_t *a_state);
+
+// Step back to the previous snapshot and copy it to a_state. At the oldest snapshot it stays there.
+// Returns false if nothing has been pushed yet
+bool rewind_buffer_step_back(rewind_buffer_t a_rewind, uint8_t *a_state);
+
+void rewind_buffer_stats(rewind_buffer_t a_rewind, rewind_buffer_stats_t a_stats);
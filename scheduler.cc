@@ -0,0 +1,127 @@
+#include "scheduler.h"
+
+void scheduler_data::initialize()
+{
+    m_next = UINT64_MAX;
+    m_count = 0;
+
+    for (int i = 0; i < SCHEDULER_EVENT_COUNT; i++)
+    {
+        m_positions[i] = SCHEDULER_EVENT_COUNT;
+    }
+}
+
+void scheduler_data::place(uint8_t a_position, uint8_t a_event)
+{
+    m_heap[a_position] = a_event;
+    m_positions[a_event] = a_position;
+}
+
+void scheduler_data::sift_up(uint8_t a_position)
+{
+    uint8_t event = m_heap[a_position];
+
+    while (a_position > 0)
+    {
+        uint8_t parent = (a_position - 1) / 2;
+
+        if (m_cycles[m_heap[parent]] <= m_cycles[event])
+        {
+            break;
+        }
+
+        place(a_position, m_heap[parent]);
+        a_position = parent;
+    }
+
+    place(a_position, event);
+}
+
+void scheduler_data::sift_down(uint8_t a_position)
+{
+    uint8_t event = m_heap[a_position];
+
+    for (;;)
+    {
+        uint8_t child = (a_position * 2) + 1;
+
+        if (child >= m_count)
+        {
+            break;
+        }
+
+        if (child + 1 < m_count && m_cycles[m_heap[child + 1]] < m_cycles[m_heap[child]])
+        {
+            child++;
+        }
+
+        if (m_cycles[event] <= m_cycles[m_heap[child]])
+        {
+            break;
+        }
+
+        place(a_position, m_heap[child]);
+        a_position = child;
+    }
+
+    place(a_position, event);
+}
+
+void scheduler_data::remove(uint8_t a_position)
+{
+    uint8_t event = m_heap[a_position];
+
+    m_positions[event] = SCHEDULER_EVENT_COUNT;
+
+    if (a_position != --m_count)
+    {
+        // The last event takes the place, it can belong above or below it
+        uint8_t moved = m_heap[m_count];
+
+        place(a_position, moved);
+        sift_up(a_position);
+        sift_down(m_positions[moved]);
+    }
+
+    m_next = m_count ? m_cycles[m_heap[0]] : UINT64_MAX;
+}
+
+void scheduler_data::post(scheduler_event_t a_event, uint64_t a_cycle)
+{
+    uint8_t position = m_positions[a_event];
+
+    if (position == SCHEDULER_EVENT_COUNT)
+    {
+        position = m_count++;
+        place(position, a_event);
+    }
+
+    m_cycles[a_event] = a_cycle;
+
+    sift_up(position);
+    sift_down(m_positions[a_event]);
+
+    m_next = m_cycles[m_heap[0]];
+}
+
+void scheduler_data::cancel(scheduler_event_t a_event)
+{
+    if (m_positions[a_event] != SCHEDULER_EVENT_COUNT)
+    {
+        remove(m_positions[a_event]);
+    }
+}
+
+bool scheduler_data::pop(uint64_t a_cycle, scheduler_event_t *a_event)
+{
+    if (m_next > a_cycle)
+    {
+        return false;
+    }
+
+    *a_event = (scheduler_event_t)m_heap[0];
+
+    remove(0);
+
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "hw_types.h"
+
+// Events the devices post for a CPU cycle (see bus_data::m_clock). The CPU runs without looking at the devices until
+// the cycle of the earliest one, the owner of the scheduler hands the due events to the devices before that cycle
+// and the devices post their next ones.
+typedef enum scheduler_event
+{
+    SCHEDULER_EVENT_PPU_VBLANK,        // Vertical blank starts, the PPU raises NMI if enabled
+    SCHEDULER_EVENT_PPU_FRAME_END,     // The PPU has finished the visible part of the frame
+    SCHEDULER_EVENT_APU_ACCESS,        // A register access changed the IRQ line, the joypad strobe or started DMA
+    SCHEDULER_EVENT_APU_FRAME_COUNTER, // Frame counter step, may raise the frame interrupt
+    SCHEDULER_EVENT_APU_DMC,           // DMC sample fetch, the end of the sample may raise the DMC interrupt
+    SCHEDULER_EVENT_APU_OAM_DMA,       // OAM DMA copies its next byte, until the transfer is complete
+    SCHEDULER_EVENT_APU_SYNTH_FRAME,   // The synthesizer frame has to be ended before its buffer overflows
+    SCHEDULER_EVENT_COUNT
+} scheduler_event_t;
+
+// Pending events in a binary min-heap on their cycle, each event is pending at most once
+struct scheduler_data
+{
+    uint64_t m_next; // Cycle of the earliest pending event, UINT64_MAX when there is none
+
+    uint64_t m_cycles[SCHEDULER_EVENT_COUNT];
+    uint8_t m_heap[SCHEDULER_EVENT_COUNT];
+    uint8_t m_positions[SCHEDULER_EVENT_COUNT]; // Of each event in m_heap, SCHEDULER_EVENT_COUNT when not pending
+    uint8_t m_count;
+
+    void initialize();
+
+    // Handle a_event before the CPU runs cycle a_cycle, a pending a_event is moved there
+    void post(scheduler_event_t a_event, uint64_t a_cycle);
+
+    void cancel(scheduler_event_t a_event);
+
+    // Take the earliest event due before the CPU runs cycle a_cycle, false if there is none
+    bool pop(uint64_t a_cycle, scheduler_event_t *a_event);
+
+private:
+    void place(uint8_t a_position, uint8_t a_event);
+    void sift_up(uint8_t a_position);
+    void sift_down(uint8_t a_position);
+    void remove(uint8_t a_position);
+};